@@ -6,8 +6,10 @@
 
 #include "Controller.h"
 #include "ObjImporter.h"
+#include "TextureLoader.h"
 #include "sgraph/AnimationVisitor.h"
 #include "sgraph/ParentSGNode.h"
+#include "sgraph/SceneSnapshot.h"
 #include "sgraph/ScenegraphImporter.h"
 #include <GLFW/glfw3.h>
 #include <fstream>
@@ -36,20 +38,69 @@ Controller::Controller(Model &m, View &v, string &f, bool &t) {
 }
 
 /**
- * @brief Auxiliary struct to expose texture paths.
+ * @brief Scene graph importer that also decodes the scene's images.
  *
- * Inherits from sgraph::ScenegraphImporter to expose the protected
- * method getTexturePaths.
+ * Inherits from sgraph::ScenegraphImporter to decode each image on the
+ * importer's worker threads while the rest of the scene is parsed.
  */
-struct SgraphImporterAccessor : public sgraph::ScenegraphImporter {
-  using sgraph::ScenegraphImporter::getTexturePaths;
+class TextureImporter : public sgraph::ScenegraphImporter {
+public:
+  /**
+   * @brief Get the decoded images after parsing, keyed by texture name.
+   *
+   * Images that failed to load are reported and left out.
+   */
+  map<string, shared_ptr<ImageLoader>> getTextureImages() const {
+    map<string, shared_ptr<ImageLoader>> textureImages;
+    const map<string, string> &paths = getTexturePaths();
+    for (auto it = paths.begin(); it != paths.end(); ++it) {
+      const ImageRequest &request = *images.at(it->second);
+      if (request.image) {
+        textureImages[it->first] = request.image;
+      } else {
+        cerr << "Error loading texture " << it->first << " from "
+             << it->second << ": " << request.error << endl;
+      }
+    }
+    return textureImages;
+  }
+
+protected:
+  void requestImage(const string &path) {
+    if (images.count(path) != 0)
+      return;
+    shared_ptr<ImageRequest> request(new ImageRequest());
+    images[path] = request;
+    getAssets().run([request, path]() {
+      try {
+        shared_ptr<ImageLoader> loader = createImageLoader(path);
+        loader->load(path);
+        request->image = loader;
+      } catch (exception &e) {
+        request->error = e.what();
+      }
+    });
+  }
+
+private:
+  /**
+   * @brief The result of decoding one image, filled in by a worker.
+   */
+  struct ImageRequest {
+    shared_ptr<ImageLoader> image;
+    string error;
+  };
+
+  // Requested images by path.
+  map<string, shared_ptr<ImageRequest>> images;
 };
 
 /**
  * @brief Initializes the scenegraph.
  *
- * Depending on the file input, loads the scenegraph from a file,
- * sets up the scenegraph in the model, and assigns texture paths.
+ * Depending on the file input, loads the scenegraph from a text file or a
+ * binary snapshot, sets up the scenegraph in the model, and assigns texture
+ * images.
  */
 void Controller::initScenegraph() {
   // Select one of multiple possible scene description files.
@@ -62,14 +113,18 @@ void Controller::initScenegraph() {
   // string inFileStr = (file == "") ? "scenegraphmodels/box.txt" : file;
   // string inFileStr = (file == "") ? "scenegraphmodels/spheres.txt" : file;
 
-  ifstream inFile(inFileStr);
-  ScenegraphImporter importer;
-  IScenegraph *scenegraph = importer.parse(inFile);
+  TextureImporter importer;
+  IScenegraph *scenegraph;
+  if (SceneSnapshot::isSnapshot(inFileStr)) {
+    scenegraph = importer.parseSnapshot(inFileStr);
+  } else {
+    ifstream inFile(inFileStr);
+    scenegraph = importer.parse(inFile);
+  }
   model.setScenegraph(scenegraph);
 
-  // Set texture paths using the exposed accessor for getTexturePaths.
-  model.setTexturePaths(
-      static_cast<SgraphImporterAccessor &>(importer).getTexturePaths());
+  // Meshes and images were loaded in parallel while the file was parsed.
+  model.setTextureImages(importer.getTextureImages());
 }
 
 /**
@@ -107,7 +162,7 @@ void Controller::run() {
 
   // Retrieve meshes from the scenegraph and initialize the view.
   map<string, util::PolygonMesh<VertexAttrib>> meshes = scenegraph->getMeshes();
-  view.init(this, meshes, this->isTextRender, model.getTexturePaths());
+  view.init(this, meshes, this->isTextRender, model.getTextureImages());
   double lastTime = glfwGetTime();
 
   if (this->isTextRender) {
@@ -140,11 +195,86 @@ void Controller::run() {
   exit(EXIT_SUCCESS);
 }
 
+/**
+ * @brief Ray traces the scenegraph to an image file without a window.
+ *
+ * Builds the camera transform on a modelview stack and hands it to a
+ * standalone ray tracer. No GLFW or OpenGL calls are made.
+ *
+ * @param outputFile Path of the image to write.
+ * @param width Width of the image in pixels.
+ * @param height Height of the image in pixels.
+ * @param pitch Camera pitch angle in degrees.
+ * @param yaw Camera yaw angle in degrees.
+ * @param threads Number of render threads, 0 for one per hardware thread.
+ * @param bitDepth Bits per channel, 8 or 16, when writing a PPM file.
+ * @param packets True to trace rays in packets of four.
+ * @param minSamples Samples taken by every pixel.
+ * @param maxSamples Samples taken by pixels on edges.
+ * @param contrast Color difference between neighbouring pixels that marks
+ * an edge.
+ * @param heatmapFile Path of an image showing the samples taken by each
+ * pixel, empty for none.
+ */
+void Controller::renderToFile(const string &outputFile, int width, int height,
+                              float pitch, float yaw, int threads,
+                              int bitDepth, bool packets, int minSamples,
+                              int maxSamples, float contrast,
+                              const string &heatmapFile) {
+  sgraph::IScenegraph *scenegraph = model.getScenegraph();
+
+  stack<glm::mat4> modelview;
+  modelview.push(View::getCameraTransform(pitch, yaw));
+  // The ray tracer does not draw through OpenGL object instances.
+  map<string, util::ObjectInstance *> objects;
+  sgraph::RaycastScenegraphRenderer rayRenderer(modelview, objects, width,
+                                                height);
+  rayRenderer.setThreadCount(threads);
+  rayRenderer.setPacketTracing(packets);
+  rayRenderer.setSampling(minSamples, maxSamples, contrast);
+  rayRenderer.setSampleHeatmap(heatmapFile);
+  rayRenderer.setMeshes(scenegraph->getMeshes());
+  // Convert each texture once, before any ray samples it
+  sgraph::TextureCache textures;
+  const map<string, shared_ptr<ImageLoader>> &images =
+      model.getTextureImages();
+  for (auto it = images.begin(); it != images.end(); ++it)
+    textures.add(it->first, it->second->getPixels(), it->second->getWidth(),
+                 it->second->getHeight());
+  rayRenderer.setTextures(&textures);
+  unique_ptr<sgraph::ImageSink> sink =
+      sgraph::createImageSink(outputFile, bitDepth);
+  if (!rayRenderer.render(scenegraph->getRoot(), *sink))
+    throw runtime_error("Cannot write image " + outputFile);
+  const sgraph::RaycastScenegraphRenderer::RenderStats &stats =
+      rayRenderer.getStats();
+  cout << "Built BVH over " << stats.primitives << " primitives ("
+       << stats.bvhNodes << " nodes) in " << stats.buildMs << " ms" << endl;
+  cout << "Traced " << stats.raysCast << " rays and " << stats.shadowRays
+       << " shadow rays in " << stats.traceSeconds << " s ("
+       << stats.raysPerSecond() << " rays/sec)" << endl;
+  if (stats.adaptive)
+    cout << "Refined " << stats.refinedPixels << " of " << width * height
+         << " pixels, " << stats.samplesPerPixel
+         << " samples per pixel on average" << endl;
+}
+
+/**
+ * @brief Saves the scenegraph as a binary snapshot.
+ *
+ * The snapshot can be loaded in place of the scene file it was made from.
+ *
+ * @param outputFile Path of the snapshot to write.
+ */
+void Controller::saveSnapshot(const string &outputFile) {
+  sgraph::SceneSnapshot::write(model.getScenegraph(), outputFile);
+}
+
 /**
  * @brief Callback for keyboard input.
  *
- * Handles key press events. Resets the camera with 'R' and sets output flag
- * with 'S'.
+ * Handles key press events. Resets the camera with 'R', toggles the
+ * progressive ray traced preview with 'P' and sets output flag with 'S'.
  *
  * @param key The key that was pressed.
  * @param scancode The system-specific scancode of the key.
@@ -160,6 +290,10 @@ void Controller::onkey(int key, int scancode, int action, int mods) {
     // Reset the camera when 'R' is pressed.
     view.resetCamera();
     break;
+  case 'P':
+    // Switch the progressive ray traced preview on or off.
+    view.toggleProgressivePreview();
+    break;
   }
   // If 'S' key is pressed, set the flag to output view details.
   if (action == GLFW_PRESS && key == GLFW_KEY_S) {
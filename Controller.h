@@ -39,6 +39,44 @@ public:
    */
   void run();
 
+  /**
+   * @brief Ray traces the scene graph straight to an image file.
+   *
+   * Renders without creating a window or OpenGL context, so it can be used
+   * on machines without a GPU.
+   *
+   * @param outputFile Path of the image to write.
+   * @param width Width of the image in pixels.
+   * @param height Height of the image in pixels.
+   * @param pitch Camera pitch angle in degrees.
+   * @param yaw Camera yaw angle in degrees.
+   * @param threads Number of render threads, 0 for one per hardware thread.
+   * @param bitDepth Bits per channel, 8 or 16, when writing a PPM file.
+   * @param packets True to trace rays in packets of four.
+   * @param minSamples Samples taken by every pixel.
+   * @param maxSamples Samples taken by pixels on edges.
+   * @param contrast Color difference between neighbouring pixels that marks
+   * an edge.
+   * @param heatmapFile Path of an image showing the samples taken by each
+   * pixel, empty for none.
+   * @throws runtime_error If the image cannot be written.
+   */
+  void renderToFile(const string &outputFile, int width, int height,
+                    float pitch, float yaw, int threads, int bitDepth,
+                    bool packets, int minSamples, int maxSamples,
+                    float contrast, const string &heatmapFile);
+
+  /**
+   * @brief Saves the scene graph as a binary snapshot.
+   *
+   * Loading the snapshot instead of the scene file skips parsing its
+   * commands; meshes and images are still loaded from their own files.
+   *
+   * @param outputFile Path of the snapshot to write.
+   * @throws runtime_error If the snapshot cannot be written.
+   */
+  void saveSnapshot(const string &outputFile);
+
   /**
    * @brief Reshapes the viewport.
    *
@@ -1,21 +1,29 @@
 #ifndef __IMAGELOADER_H_
 #define __IMAGELOADER_H_
 
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+
 /**
  * @brief This abstract class represents an image loader. There would be
  * one subclass for each file format
  *
+ * Loaders decode images into 8-bit RGB pixels stored row by row from the
+ * bottom up, as OpenGL expects them. The pixels belong to the loader and are
+ * freed with it.
  */
 class ImageLoader {
 public:
-  ImageLoader() {}
-  inline GLubyte *getPixels() { return image; }
+  ImageLoader() : width(0), height(0) {}
+  virtual ~ImageLoader() {}
+  inline GLubyte *getPixels() { return image.empty() ? NULL : &image[0]; }
   inline int getWidth() { return width; }
   inline int getHeight() { return height; }
-  virtual void load(string filename) = 0;
+  virtual void load(std::string filename) = 0;
 
 protected:
-  GLubyte *image;
+  std::vector<GLubyte> image;
   int width;
   int height;
 };
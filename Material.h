@@ -105,6 +105,7 @@ private:
     setAbsorption(1);
     setReflection(0);
     setTransparency(0);
+    setRefractiveIndex(1);
   }
 
 private:
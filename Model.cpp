@@ -4,7 +4,7 @@
 /**
  * @brief Constructs a new Model object.
  */
-Model::Model() {}
+Model::Model() : scenegraph(NULL) {}
 
 /**
  * @brief Destroys the Model object.
@@ -34,21 +34,22 @@ void Model::setScenegraph(sgraph::IScenegraph *scenegraph) {
 }
 
 /**
- * @brief Sets the texture paths.
+ * @brief Sets the decoded texture images.
  *
- * Updates the texture path mapping with the provided map.
+ * Updates the texture image mapping with the provided map.
  *
- * @param tp Map containing texture paths keyed by name.
+ * @param images Map containing decoded images keyed by texture name.
  */
-void Model::setTexturePaths(const map<string, string> &tp) {
-  texturePaths = tp;
+void Model::setTextureImages(
+    const map<string, shared_ptr<ImageLoader>> &images) {
+  textureImages = images;
 }
 
 /**
- * @brief Retrieves the texture paths.
+ * @brief Retrieves the decoded texture images.
  *
- * @return A constant reference to the map of texture paths.
+ * @return A constant reference to the map of texture images.
  */
-const map<string, string> &Model::getTexturePaths() const {
-  return texturePaths;
+const map<string, shared_ptr<ImageLoader>> &Model::getTextureImages() const {
+  return textureImages;
 }
@@ -3,7 +3,7 @@
  * @brief Definition of the Model class.
  *
  * This file contains the definition of the Model class which maintains a
- * scenegraph and a texture mapping for a polygon mesh model.
+ * scenegraph and the decoded textures for a polygon mesh model.
  */
 
 #ifndef __MODEL_H__
@@ -13,13 +13,16 @@
 #include "VertexAttrib.h"
 #include "sgraph/IScenegraph.h"
 #include <map>
+#include <memory>
 #include <string>
 
 using namespace std;
 
+class ImageLoader;
+
 /**
  * @class Model
- * @brief Represents a 3D model with an associated scenegraph and texture paths.
+ * @brief Represents a 3D model with an associated scenegraph and textures.
  */
 class Model {
 public:
@@ -50,22 +53,19 @@ public:
   // textures
 
   /**
-   * @brief Sets the texture paths for the model.
-   *
-   * This function assigns texture file paths mapped by names.
+   * @brief Sets the decoded texture images for the model.
    *
-   * @param tp A constant reference to a map where keys are texture names and
-   * values are texture file paths.
+   * @param images A constant reference to a map where keys are texture names
+   * and values are the decoded images. Names may share an image.
    */
-  void setTexturePaths(const map<string, string> &tp);
+  void setTextureImages(const map<string, shared_ptr<ImageLoader>> &images);
 
   /**
-   * @brief Retrieves the texture paths of the model.
+   * @brief Retrieves the decoded texture images of the model.
    *
-   * @return const map<string, string>& A constant reference to the map of
-   * texture paths.
+   * @return A constant reference to the map of texture images.
    */
-  const map<string, string> &getTexturePaths() const;
+  const map<string, shared_ptr<ImageLoader>> &getTextureImages() const;
 
 private:
   /**
@@ -74,9 +74,9 @@ private:
   sgraph::IScenegraph *scenegraph;
 
   /**
-   * @brief A mapping between texture names and file paths.
+   * @brief A mapping between texture names and decoded images.
    */
-  map<string, string> texturePaths;
+  map<string, shared_ptr<ImageLoader>> textureImages;
 };
 
 #endif // __MODEL_H__
@@ -0,0 +1,340 @@
+#ifndef __PNG_IMAGELOADER_H_
+#define __PNG_IMAGELOADER_H_
+
+#include "ImageLoader.h"
+#include "Inflate.h"
+#include "MappedFile.h"
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+/**
+ * @brief This class is used to load an image in the PNG format
+ *
+ * Reads every standard color type and bit depth, interlaced or not. The file
+ * is memory mapped and its image data decompressed straight into one
+ * buffer. Alpha and transparency are dropped, gray and palette images are
+ * expanded to RGB and 16-bit channels are scaled down to 8 bits. Chunk CRCs
+ * are not verified.
+ */
+class PNGImageLoader : public ImageLoader {
+
+public:
+  PNGImageLoader() {}
+
+  void load(std::string filename) {
+    util::MappedFile file(filename);
+
+    if (!file.isOpen())
+      throw std::invalid_argument("File not found!");
+
+    static const unsigned char signature[8] = {0x89, 'P',  'N',  'G',
+                                               '\r', '\n', 0x1a, '\n'};
+    const unsigned char *p =
+        reinterpret_cast<const unsigned char *>(file.getData());
+    const unsigned char *end = p + file.getSize();
+    if (file.getSize() < 8 || memcmp(p, signature, 8) != 0)
+      throw std::runtime_error("Not a PNG file: " + filename);
+    p += 8;
+
+    Header header;
+    bool haveHeader = false;
+    unsigned char palette[3 * 256];
+    int paletteSize = 0;
+    std::vector<unsigned char> compressed;
+    for (;;) {
+      if (end - p < 12)
+        throw std::runtime_error("Truncated image: " + filename);
+      size_t length = readUint32(p);
+      const unsigned char *type = p + 4;
+      const unsigned char *data = p + 8;
+      if (length > static_cast<size_t>(end - data) - 4)
+        throw std::runtime_error("Truncated image: " + filename);
+      p = data + length + 4;
+      if (memcmp(type, "IHDR", 4) == 0) {
+        if (length != 13 || !header.read(data))
+          throw std::runtime_error("Invalid image header: " + filename);
+        haveHeader = true;
+      } else if (!haveHeader) {
+        throw std::runtime_error("Invalid image header: " + filename);
+      } else if (memcmp(type, "PLTE", 4) == 0) {
+        if (length % 3 != 0 || length > sizeof(palette))
+          throw std::runtime_error("Invalid palette: " + filename);
+        memcpy(palette, data, length);
+        paletteSize = static_cast<int>(length / 3);
+      } else if (memcmp(type, "IDAT", 4) == 0) {
+        compressed.insert(compressed.end(), data, data + length);
+      } else if (memcmp(type, "IEND", 4) == 0) {
+        break;
+      } else if (!(type[0] & 0x20)) {
+        // Lowercase first letters mark chunks that may be skipped
+        throw std::runtime_error("Unsupported PNG chunk in " + filename);
+      }
+    }
+    if (header.colorType == 3 && paletteSize == 0)
+      throw std::runtime_error("Invalid palette: " + filename);
+
+    // Each pass of an interlaced image is a complete image of its own
+    int passes = header.interlaced ? 7 : 1;
+    size_t passOffset[8] = {0};
+    for (int pass = 0; pass < passes; pass++) {
+      size_t w, h;
+      passSize(header, pass, w, h);
+      passOffset[pass + 1] =
+          passOffset[pass] + ((w == 0) ? 0 : h * (1 + header.stride(w)));
+    }
+    std::vector<unsigned char> filtered(passOffset[passes]);
+    try {
+      if (compressed.empty())
+        throw std::runtime_error("No image data");
+      util::Inflater::inflate(&compressed[0], compressed.size(),
+                              filtered.empty() ? NULL : &filtered[0],
+                              filtered.size());
+    } catch (std::runtime_error &e) {
+      throw std::runtime_error(std::string(e.what()) + ": " + filename);
+    }
+
+    width = header.width;
+    height = header.height;
+    image.resize(static_cast<size_t>(width) * height * 3);
+    for (int pass = 0; pass < passes; pass++) {
+      size_t w, h;
+      passSize(header, pass, w, h);
+      if (w == 0 || h == 0)
+        continue;
+      unsigned char *rows = &filtered[passOffset[pass]];
+      if (!unfilter(rows, w, h, header))
+        throw std::runtime_error("Invalid row filter: " + filename);
+      size_t stride = header.stride(w);
+      Pass layout = header.interlaced ? adam7(pass) : Pass{0, 0, 1, 1};
+      for (size_t y = 0; y < h; y++) {
+        size_t imageY = layout.y + y * layout.dy;
+        // The file stores rows top to bottom, OpenGL wants them bottom to top
+        GLubyte *row = &image[3 * static_cast<size_t>(width) *
+                              (height - 1 - imageY)];
+        if (!convertRow(rows + y * (1 + stride) + 1, w, header, palette,
+                        paletteSize, row + 3 * layout.x, 3 * layout.dx))
+          throw std::runtime_error("Invalid palette index: " + filename);
+      }
+    }
+  }
+
+private:
+  /**
+   * @brief Where a pass of Adam7 interlacing starts, and the spacing of its
+   * pixels
+   */
+  struct Pass {
+    int x, y, dx, dy;
+  };
+
+  static const Pass &adam7(int pass) {
+    static const Pass passes[7] = {{0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8},
+                                   {2, 0, 4, 4}, {0, 2, 2, 4}, {1, 0, 2, 2},
+                                   {0, 1, 1, 2}};
+    return passes[pass];
+  }
+
+  /**
+   * @brief The fields of the IHDR chunk
+   */
+  struct Header {
+    int width, height;
+    int bitDepth, colorType;
+    bool interlaced;
+    // Samples per pixel
+    int channels;
+
+    bool read(const unsigned char *data) {
+      size_t w = readUint32(data), h = readUint32(data + 4);
+      bitDepth = data[8];
+      colorType = data[9];
+      interlaced = data[12] == 1;
+      if (w == 0 || h == 0 || w > (1u << 24) || h > (1u << 24) ||
+          w * h > (1u << 28) || data[10] != 0 || data[11] != 0 ||
+          data[12] > 1)
+        return false;
+      width = static_cast<int>(w);
+      height = static_cast<int>(h);
+      bool valid;
+      switch (colorType) {
+      case 0: // Gray
+        channels = 1;
+        valid = bitDepth == 1 || bitDepth == 2 || bitDepth == 4 ||
+                bitDepth == 8 || bitDepth == 16;
+        break;
+      case 3: // Palette
+        channels = 1;
+        valid = bitDepth == 1 || bitDepth == 2 || bitDepth == 4 ||
+                bitDepth == 8;
+        break;
+      case 2: // RGB
+      case 4: // Gray and alpha
+      case 6: // RGBA
+        channels = (colorType == 2) ? 3 : ((colorType == 4) ? 2 : 4);
+        valid = bitDepth == 8 || bitDepth == 16;
+        break;
+      default:
+        valid = false;
+      }
+      return valid;
+    }
+
+    /**
+     * @brief Bytes in a row of pixels, not counting its filter byte
+     */
+    size_t stride(size_t w) const {
+      return (w * channels * bitDepth + 7) / 8;
+    }
+
+    /**
+     * @brief Bytes per pixel as the filters count them, at least one
+     */
+    int filterDistance() const {
+      return (channels * bitDepth < 8) ? 1 : channels * bitDepth / 8;
+    }
+  };
+
+  static size_t readUint32(const unsigned char *p) {
+    return (static_cast<size_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) |
+           p[3];
+  }
+
+  /**
+   * @brief Get the size of one pass of an image, or of the whole image if it
+   * is not interlaced
+   */
+  static void passSize(const Header &header, int pass, size_t &w, size_t &h) {
+    if (!header.interlaced) {
+      w = header.width;
+      h = header.height;
+      return;
+    }
+    const Pass &layout = adam7(pass);
+    w = (header.width <= layout.x)
+            ? 0
+            : (header.width - layout.x + layout.dx - 1) / layout.dx;
+    h = (header.height <= layout.y)
+            ? 0
+            : (header.height - layout.y + layout.dy - 1) / layout.dy;
+  }
+
+  /**
+   * @brief Undo the row filters of one pass in place
+   *
+   * @param rows The rows of the pass, each starting with its filter type
+   * @return False if a row has an unknown filter type
+   */
+  static bool unfilter(unsigned char *rows, size_t w, size_t h,
+                       const Header &header) {
+    size_t stride = header.stride(w);
+    size_t bpp = header.filterDistance();
+    const unsigned char *prior = NULL;
+    for (size_t y = 0; y < h; y++) {
+      unsigned char *row = rows + y * (1 + stride) + 1;
+      int filter = row[-1];
+      // The row above the first is all zeros, which makes Up a no-op and
+      // Average and Paeth reduce to simpler forms
+      if (prior == NULL && (filter == 2 || filter == 4))
+        filter = (filter == 2) ? 0 : 1;
+      switch (filter) {
+      case 0:
+        break;
+      case 1:
+        for (size_t i = bpp; i < stride; i++)
+          row[i] += row[i - bpp];
+        break;
+      case 2:
+        for (size_t i = 0; i < stride; i++)
+          row[i] += prior[i];
+        break;
+      case 3:
+        for (size_t i = 0; i < stride; i++) {
+          int left = (i >= bpp) ? row[i - bpp] : 0;
+          int up = prior ? prior[i] : 0;
+          row[i] += static_cast<unsigned char>((left + up) >> 1);
+        }
+        break;
+      case 4:
+        for (size_t i = 0; i < bpp && i < stride; i++)
+          row[i] += prior[i];
+        for (size_t i = bpp; i < stride; i++)
+          row[i] += paeth(row[i - bpp], prior[i], prior[i - bpp]);
+        break;
+      default:
+        return false;
+      }
+      prior = row;
+    }
+    return true;
+  }
+
+  static unsigned char paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+      return static_cast<unsigned char>(a);
+    return static_cast<unsigned char>((pb <= pc) ? b : c);
+  }
+
+  /**
+   * @brief Convert one unfiltered row to 8-bit RGB
+   *
+   * @param src The samples of the row
+   * @param w The number of pixels in the row
+   * @param dst Where to write the first pixel
+   * @param step Bytes from one written pixel to the next
+   * @return False if the row refers past the end of the palette
+   */
+  static bool convertRow(const unsigned char *src, size_t w,
+                         const Header &header, const unsigned char *palette,
+                         int paletteSize, GLubyte *dst, size_t step) {
+    if (header.bitDepth == 8 && header.colorType == 2 && step == 3) {
+      memcpy(dst, src, 3 * w);
+      return true;
+    }
+    if (header.bitDepth == 8 &&
+        (header.colorType == 2 || header.colorType == 6)) {
+      for (size_t x = 0; x < w; x++, src += header.channels, dst += step) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+      }
+      return true;
+    }
+    int depth = header.bitDepth;
+    int maxValue = (1 << depth) - 1;
+    for (size_t x = 0; x < w; x++, dst += step) {
+      // Alpha, when present, is the last channel and is skipped
+      int colors = (header.channels >= 3) ? 3 : 1;
+      int rgb[3];
+      for (int c = 0; c < colors; c++) {
+        size_t i = x * header.channels + c;
+        int value;
+        if (depth == 16)
+          value = (src[2 * i] << 8) | src[2 * i + 1];
+        else if (depth == 8)
+          value = src[i];
+        else
+          value = (src[i * depth / 8] >> (8 - depth - (i * depth) % 8)) &
+                  maxValue;
+        rgb[c] = value;
+      }
+      if (header.colorType == 3) {
+        if (rgb[0] >= paletteSize)
+          return false;
+        memcpy(dst, palette + 3 * rgb[0], 3);
+        continue;
+      }
+      for (int c = 0; c < 3; c++) {
+        int value = rgb[(colors == 3) ? c : 0];
+        dst[c] = static_cast<GLubyte>(
+            (depth == 8) ? value : (value * 255 + maxValue / 2) / maxValue);
+      }
+    }
+    return true;
+  }
+};
+
+#endif
@@ -2,67 +2,131 @@
 #define __PPM_IMAGELOADER_H_
 
 #include "ImageLoader.h"
+#include "MappedFile.h"
+#include <cstring>
 #include <iostream>
-#include <sstream>
 #include <stdexcept>
+#include <string>
 
 /**
- * @brief This class is used to load an image in the ASCII PPM format
+ * @brief This class is used to load an image in the PPM or PGM format
  *
+ * Reads both the ASCII (P3, P2) and binary (P6, P5) variants with up to 16
+ * bits per channel. The file is memory mapped and parsed in place; the rows
+ * of an 8-bit binary PPM are copied straight out of the mapping. Gray images
+ * are expanded to RGB and deeper channels are scaled down to 8 bits.
  */
 class PPMImageLoader : public ImageLoader {
 
 public:
   PPMImageLoader() {}
 
-  void load(string filename) {
-    ifstream fp;
-    string str;
-    int i, j;
-    int r, g, b;
-    int factor;
+  void load(std::string filename) {
+    util::MappedFile file(filename);
 
-    fp.open(filename.c_str());
-
-    if (!fp.is_open())
+    if (!file.isOpen())
       throw std::invalid_argument("File not found!");
 
-    std::cout << "Image file opened" << endl;
-
-    // read line by line and ignore comments
-    std::stringstream input;
-    std::string line;
+    std::cout << "Image file opened" << std::endl;
+
+    const char *p = file.getData();
+    const char *end = p + file.getSize();
+    char format = (file.getSize() >= 2 && p[0] == 'P') ? p[1] : 0;
+    if (format != '2' && format != '3' && format != '5' && format != '6')
+      throw std::runtime_error("Not a PPM or PGM file: " + filename);
+    p += 2;
+
+    int w = readNumber(p, end);
+    int h = readNumber(p, end);
+    int maxValue = readNumber(p, end);
+    if (w <= 0 || h <= 0 || maxValue <= 0 || maxValue > 65535)
+      throw std::runtime_error("Invalid image header: " + filename);
+    int channels = (format == '3' || format == '6') ? 3 : 1;
+    size_t samples = static_cast<size_t>(w) * h * channels;
+
+    if (format == '5' || format == '6') {
+      // A single whitespace character separates the header from the pixels
+      if (p >= end || !isSpace(*p))
+        throw std::runtime_error("Invalid image header: " + filename);
+      p++;
+      size_t bytesPerSample = (maxValue > 255) ? 2 : 1;
+      if (static_cast<size_t>(end - p) / bytesPerSample < samples)
+        throw std::runtime_error("Truncated image: " + filename);
+    }
 
-    while (std::getline(fp, line)) {
-      if ((line.length() > 0) && (line[0] != '#')) {
-        input << line << endl;
+    width = w;
+    height = h;
+    image.resize(static_cast<size_t>(w) * h * 3);
+    size_t rowSamples = static_cast<size_t>(w) * channels;
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(p);
+    // The file stores rows top to bottom, OpenGL wants them bottom to top
+    for (int i = 0; i < h; i++) {
+      GLubyte *row = &image[3 * static_cast<size_t>(w) * (h - 1 - i)];
+      if (format == '6' && maxValue == 255) {
+        memcpy(row, bytes + i * rowSamples, rowSamples);
+        continue;
+      }
+      for (size_t j = 0; j < rowSamples; j++) {
+        int value;
+        if (format == '5' || format == '6') {
+          size_t k = i * rowSamples + j;
+          value = (maxValue > 255) ? (bytes[2 * k] << 8) | bytes[2 * k + 1]
+                                   : bytes[k];
+        } else {
+          value = readNumber(p, end);
+          if (value < 0)
+            throw std::runtime_error("Truncated image: " + filename);
+        }
+        if (value > maxValue)
+          value = maxValue;
+        GLubyte c = static_cast<GLubyte>(
+            (maxValue == 255) ? value : (value * 255 + maxValue / 2) / maxValue);
+        if (channels == 3) {
+          row[j] = c;
+        } else {
+          row[3 * j] = row[3 * j + 1] = row[3 * j + 2] = c;
+        }
       }
     }
-    fp.close();
-
-    // read in the word P3
-
-    input >> str;
-
-    // now read in the width and height
-
-    input >> width >> height;
-
-    // read in the factor
-    input >> factor;
+  }
 
-    image = new GLubyte[3 * width * height];
+private:
+  /**
+   * @brief Whether a character is whitespace in the header or ASCII pixels
+   */
+  static bool isSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' ||
+           c == '\f';
+  }
 
-    for (i = 0; i < height; i++) {
-      for (j = 0; j < width; j++) {
-        input >> r >> g >> b;
-        image[3 * ((height - 1 - i) * width + j)] = r;
-        image[3 * ((height - 1 - i) * width + j) + 1] = g;
-        image[3 * ((height - 1 - i) * width + j) + 2] = b;
-        // << "r=" << (int)r << ", g=" << (int)g << ",b=" << (int)b << endl;
+  /**
+   * @brief Read a decimal number, skipping whitespace and comments before it
+   *
+   * @param p The position to read from, advanced past the number
+   * @param end The end of the file
+   * @return The number, or -1 if there is none or it is too large
+   */
+  static int readNumber(const char *&p, const char *end) {
+    while (p < end) {
+      if (*p == '#') {
+        while (p < end && *p != '\n')
+          p++;
+      } else if (isSpace(*p)) {
+        p++;
+      } else {
+        break;
       }
     }
-    // fp.close();
+    if (p >= end || *p < '0' || *p > '9')
+      return -1;
+    int value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+      if (value > 100000000)
+        return -1;
+      value = 10 * value + (*p - '0');
+      p++;
+    }
+    return value;
   }
 };
 
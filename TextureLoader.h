@@ -0,0 +1,33 @@
+#ifndef __TEXTURELOADER_H_
+#define __TEXTURELOADER_H_
+
+#include "ImageLoader.h"
+#include "PNGImageLoader.h"
+#include "PPMImageLoader.h"
+#include <cctype>
+#include <memory>
+#include <string>
+
+/**
+ * @brief Create a loader for an image file, chosen by its extension
+ *
+ * Files ending in .png, in any case, are read as PNG; everything else is
+ * read as PPM or PGM.
+ *
+ * @param filename The path of the image file
+ * @return A loader that has not loaded anything yet
+ */
+inline std::unique_ptr<ImageLoader> createImageLoader(const string &filename) {
+  string extension;
+  size_t dot = filename.find_last_of('.');
+  if (dot != string::npos && filename.find_first_of("/\\", dot) == string::npos)
+    extension = filename.substr(dot + 1);
+  for (size_t i = 0; i < extension.size(); i++)
+    extension[i] = static_cast<char>(
+        std::tolower(static_cast<unsigned char>(extension[i])));
+  if (extension == "png")
+    return std::unique_ptr<ImageLoader>(new PNGImageLoader());
+  return std::unique_ptr<ImageLoader>(new PPMImageLoader());
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define _VERTEXATTRIB_H_
 
 #include "IVertexData.h"
+#include <cstring>
 #include <glm/glm.hpp>
 #include <sstream>
 
@@ -127,9 +128,76 @@ public:
   }
 
 private:
+  friend struct util::VertexTraits<VertexAttrib>;
+
   glm::vec4 position;
   glm::vec4 normal;
   glm::vec4 texcoord;
 };
 
+namespace util {
+
+/*
+ * VertexAttrib always stores a position, normal and texture coordinate as
+ * 4 floats each, so its attributes are read and written as plain members.
+ */
+template <> struct VertexTraits<VertexAttrib> {
+  template <class Attribute> static bool has(const VertexAttrib &) {
+    return true;
+  }
+
+  template <class Attribute> static glm::vec4 get(const VertexAttrib &v) {
+    return v.*member(Attribute());
+  }
+
+  template <class Attribute>
+  static void set(VertexAttrib &v, const glm::vec4 &value) {
+    v.*member(Attribute()) = value;
+  }
+
+  static int getSize(const VertexAttrib &, const string &attribName) {
+    memberByName(attribName);
+    return 4;
+  }
+
+  static void interleave(const vector<VertexAttrib> &vertices,
+                         const vector<string> &attribNames,
+                         vector<float> &out) {
+    // Look each attribute up once, then copy members without any lookups
+    vector<glm::vec4 VertexAttrib::*> members;
+    for (size_t a = 0; a < attribNames.size(); a++)
+      members.push_back(memberByName(attribNames[a]));
+    out.resize(vertices.size() * members.size() * 4);
+    float *dest = out.empty() ? NULL : &out[0];
+    for (size_t i = 0; i < vertices.size(); i++) {
+      for (size_t a = 0; a < members.size(); a++) {
+        memcpy(dest, &(vertices[i].*members[a]), 4 * sizeof(float));
+        dest += 4;
+      }
+    }
+  }
+
+private:
+  static glm::vec4 VertexAttrib::*member(PositionAttribute) {
+    return &VertexAttrib::position;
+  }
+  static glm::vec4 VertexAttrib::*member(NormalAttribute) {
+    return &VertexAttrib::normal;
+  }
+  static glm::vec4 VertexAttrib::*member(TexcoordAttribute) {
+    return &VertexAttrib::texcoord;
+  }
+
+  static glm::vec4 VertexAttrib::*memberByName(const string &attribName) {
+    if (attribName == PositionAttribute::name())
+      return &VertexAttrib::position;
+    if (attribName == NormalAttribute::name())
+      return &VertexAttrib::normal;
+    if (attribName == TexcoordAttribute::name())
+      return &VertexAttrib::texcoord;
+    throw runtime_error("No attribute: " + attribName + " found!");
+  }
+};
+} // namespace util
+
 #endif
@@ -6,7 +6,7 @@
 
 #include "View.h"
 #include "GLFW/glfw3.h"
-#include "PPMImageLoader.h"
+#include "ImageLoader.h"
 #include "VertexAttrib.h"
 #include "sgraph/AbstractSGNode.h"
 #include "sgraph/GLScenegraphRenderer.h"
@@ -31,9 +31,12 @@ bool View::shouldOutput =
 /**
  * @brief Constructor for the View class.
  *
- * Initializes the default texture to 0.
+ * Initializes the default texture and preview objects to 0.
  */
-View::View() : defaultTexture(0) {}
+View::View()
+    : rayRenderer(NULL), defaultTexture(0), isTextRender(false),
+      progressivePreview(false), previewStarted(false), previewTexture(0),
+      previewFramebuffer(0) {}
 
 /**
  * @brief Destructor for the View class.
@@ -50,17 +53,19 @@ View::~View() {
  * @brief Recursively collects lights from the scene graph.
  *
  * This function visits all nodes in the scene graph, converts light properties
- * to view coordinates, and accumulates them into the provided lights vector.
+ * to view coordinates using each node's cached world transform, and
+ * accumulates them into the provided lights vector.
  *
  * @param node Pointer to the current scene graph node.
- * @param transform The current transformation matrix.
+ * @param view The view transformation matrix.
  * @param lights Vector to store the collected lights.
  */
-void collectLights(sgraph::SGNode *node, const glm::mat4 &transform,
+void collectLights(sgraph::SGNode *node, const glm::mat4 &view,
                    vector<util::Light> &lights) {
   sgraph::AbstractSGNode *absNode =
       dynamic_cast<sgraph::AbstractSGNode *>(node);
-  if (absNode) {
+  if (absNode && !absNode->getLights().empty()) {
+    glm::mat4 transform = view * node->getWorldTransform();
     for (const auto &l : absNode->getLights()) {
       util::Light tl = l;
       glm::vec4 pos = tl.getPosition();
@@ -74,15 +79,9 @@ void collectLights(sgraph::SGNode *node, const glm::mat4 &transform,
   }
   sgraph::ParentSGNode *parentNode = dynamic_cast<sgraph::ParentSGNode *>(node);
   if (parentNode) {
-    vector<sgraph::SGNode *> children = parentNode->getChildren();
+    const vector<sgraph::SGNode *> &children = parentNode->getChildren();
     for (size_t i = 0; i < children.size(); i++) {
-      sgraph::TransformNode *transNode =
-          dynamic_cast<sgraph::TransformNode *>(children[i]);
-      glm::mat4 childTransform = transform;
-      if (transNode) {
-        childTransform = transform * transNode->getTransform();
-      }
-      collectLights(children[i], childTransform, lights);
+      collectLights(children[i], view, lights);
     }
   }
 }
@@ -97,11 +96,13 @@ void collectLights(sgraph::SGNode *node, const glm::mat4 &transform,
  * @param callbacks Pointer to the callbacks handler.
  * @param meshes Map of mesh names to their corresponding PolygonMesh data.
  * @param isTextRender Flag indicating if text rendering is required.
- * @param texturePaths Map of texture names to their file paths.
+ * @param images Map of texture names to their decoded images.
  */
 void View::init(Callbacks *callbacks,
                 map<string, util::PolygonMesh<VertexAttrib>> &meshes,
-                bool isTextRender, map<string, string> texturePaths) {
+                bool isTextRender,
+                const map<string, shared_ptr<ImageLoader>> &images) {
+  this->isTextRender = isTextRender;
   if (!glfwInit())
     exit(EXIT_FAILURE);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -178,26 +179,21 @@ void View::init(Callbacks *callbacks,
 
   textures["white"] = defaultTexture;
 
-  // Load model textures from given file paths.
-  map<string, string> modelTexturePaths = texturePaths;
+  // Upload the decoded model textures.
+  // Rows of RGB images are only 4-byte aligned for some widths
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-  for (auto const &entry : modelTexturePaths) {
+  for (auto const &entry : images) {
     string texName = entry.first;
-    string filePath = entry.second;
-    PPMImageLoader loader;
-    try {
-      loader.load(filePath);
-    } catch (exception &e) {
-      cerr << "Error loading texture " << texName << " from " << filePath
-           << ": " << e.what() << endl;
-      continue;
-    }
+    ImageLoader &loader = *entry.second;
     GLuint texID;
     glGenTextures(1, &texID);
     glBindTexture(GL_TEXTURE_2D, texID);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, loader.getWidth(),
                  loader.getHeight(), 0, GL_RGB, GL_UNSIGNED_BYTE,
                  loader.getPixels());
+    rayTextures.add(texName, loader.getPixels(), loader.getWidth(),
+                    loader.getHeight());
     glGenerateMipmap(GL_TEXTURE_2D);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
                     GL_LINEAR_MIPMAP_LINEAR);
@@ -221,8 +217,24 @@ void View::init(Callbacks *callbacks,
   if (!isTextRender) {
     renderer = new sgraph::GLScenegraphRenderer(
         modelview, objects, shaderLocations, textures, defaultTexture);
-    rayRenderer =
-        new sgraph::RaycastScenegraphRenderer(modelview, objects, 800, 800);
+    rayRenderer = new sgraph::RaycastScenegraphRenderer(
+        modelview, objects, RAYTRACE_SIZE, RAYTRACE_SIZE);
+    rayRenderer->setMeshes(meshes);
+    rayRenderer->setTextures(&rayTextures);
+
+    // Texture and framebuffer the progressive preview is shown through
+    glGenTextures(1, &previewTexture);
+    glBindTexture(GL_TEXTURE_2D, previewTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, RAYTRACE_SIZE, RAYTRACE_SIZE, 0,
+                 GL_RGB, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glGenFramebuffers(1, &previewFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, previewFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, previewTexture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, defaultTexture);
   }
 }
 
@@ -245,21 +257,7 @@ void View::display(sgraph::IScenegraph *scenegraph) {
     modelview.pop();
   modelview.push(glm::mat4(1.0f));
 
-  // Compute camera position from spherical coordinates.
-  float radius = 350.0f;                      // Camera distance from center.
-  float radPitch = glm::radians(cameraPitch); // Pitch angle in radians.
-  float radYaw = glm::radians(cameraYaw);     // Yaw angle in radians.
-
-  // Calculate eye position on a sphere centered at (0,0,0)
-  glm::vec3 eye;
-  eye.x = radius * cos(radPitch) * sin(radYaw);
-  eye.y = radius * sin(radPitch);
-  eye.z = radius * cos(radPitch) * cos(radYaw);
-
-  glm::vec3 center(0.0f, 0.0f, 0.0f);
-  glm::vec3 up(0.0f, 1.0f, 0.0f);
-  glm::mat4 viewMatrix = glm::lookAt(eye, center, up);
-  modelview.top() = viewMatrix;
+  modelview.top() = getCameraTransform(cameraPitch, cameraYaw);
 
   // Set the projection matrix uniform.
   glUniformMatrix4fv(shaderLocations.getLocation("projection"), 1, GL_FALSE,
@@ -289,12 +287,27 @@ void View::display(sgraph::IScenegraph *scenegraph) {
                 lights[i].getSpotCutoff());
   }
 
-  // Render the scene graph using the standard renderer.
-  scenegraph->getRoot()->accept(renderer);
-  // Render to output file if flag is set.
+  if (progressivePreview) {
+    // Restart the preview whenever the camera moves; the scene is only
+    // compiled again then, so animation shows up on the next restart.
+    if (!previewStarted || modelview.top() != previewCamera) {
+      previewCamera = modelview.top();
+      rayRenderer->startProgressive(scenegraph->getRoot());
+      previewStarted = true;
+    }
+    showPreview();
+  } else {
+    // Render the scene graph using the standard renderer.
+    scenegraph->getRoot()->accept(renderer);
+  }
+  // Render to output file if flag is set. While previewing, the preview so
+  // far is saved instead of tracing the image again.
   if (shouldOutput) {
     shouldOutput = false;
-    rayRenderer->render(scenegraph->getRoot(), "output.ppm");
+    if (progressivePreview)
+      rayRenderer->writeProgressiveImage("output.ppm");
+    else
+      rayRenderer->render(scenegraph->getRoot(), "output.ppm");
   }
   glFlush();
   program.disable();
@@ -302,6 +315,55 @@ void View::display(sgraph::IScenegraph *scenegraph) {
   glfwPollEvents();
 }
 
+/**
+ * @brief Uploads the latest preview image and copies it to the window.
+ *
+ * The image is only uploaded when the progressive render has added to it
+ * since the last frame. Its rows run from the top down, so the copy flips
+ * it vertically.
+ */
+void View::showPreview() {
+  if (rayRenderer->getProgressiveImage(previewPixels)) {
+    glBindTexture(GL_TEXTURE_2D, previewTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, RAYTRACE_SIZE, RAYTRACE_SIZE,
+                    GL_RGB, GL_FLOAT, &previewPixels[0].x);
+    glBindTexture(GL_TEXTURE_2D, defaultTexture);
+  }
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, previewFramebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, RAYTRACE_SIZE, RAYTRACE_SIZE, 0, height, width, 0,
+                    GL_COLOR_BUFFER_BIT, GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/**
+ * @brief Computes the view transform of the orbiting camera.
+ *
+ * The camera sits on a sphere around the origin, described by spherical
+ * coordinates, and looks at the origin.
+ *
+ * @param pitch Camera pitch angle in degrees.
+ * @param yaw Camera yaw angle in degrees.
+ * @return The view transform for the camera.
+ */
+glm::mat4 View::getCameraTransform(float pitch, float yaw) {
+  float radius = 350.0f;                // Camera distance from center.
+  float radPitch = glm::radians(pitch); // Pitch angle in radians.
+  float radYaw = glm::radians(yaw);     // Yaw angle in radians.
+
+  // Calculate eye position on a sphere centered at (0,0,0)
+  glm::vec3 eye;
+  eye.x = radius * cos(radPitch) * sin(radYaw);
+  eye.y = radius * sin(radPitch);
+  eye.z = radius * cos(radPitch) * cos(radYaw);
+
+  glm::vec3 center(0.0f, 0.0f, 0.0f);
+  glm::vec3 up(0.0f, 1.0f, 0.0f);
+  return glm::lookAt(eye, center, up);
+}
+
 /**
  * @brief Checks if the window should be closed.
  *
@@ -316,6 +378,12 @@ bool View::shouldWindowClose() { return glfwWindowShouldClose(window); }
  * and terminates GLFW.
  */
 void View::closeWindow() {
+  if (rayRenderer != NULL)
+    rayRenderer->stopProgressive();
+  if (previewFramebuffer != 0)
+    glDeleteFramebuffers(1, &previewFramebuffer);
+  if (previewTexture != 0)
+    glDeleteTextures(1, &previewTexture);
   for (auto it = objects.begin(); it != objects.end(); it++) {
     it->second->cleanup();
     delete it->second;
@@ -344,3 +412,19 @@ void View::resetCamera() {
   cameraPitch = -35.264f;
   cameraYaw = -135.0f;
 }
+
+/**
+ * @brief Switches the window between OpenGL drawing and the progressive ray
+ * traced preview.
+ *
+ * Turning the preview off stops its render threads.
+ */
+void View::toggleProgressivePreview() {
+  if (isTextRender)
+    return;
+  progressivePreview = !progressivePreview;
+  if (!progressivePreview) {
+    rayRenderer->stopProgressive();
+    previewStarted = false;
+  }
+}
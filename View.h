@@ -17,11 +17,14 @@
 #include <ShaderProgram.h>
 #include <glad/glad.h>
 #include <map>
+#include <memory>
 #include <stack>
 #include <string>
 
 using namespace std;
 
+class ImageLoader;
+
 /**
  * @brief The View class encapsulates the rendering view and the associated
  * OpenGL window.
@@ -43,18 +46,19 @@ public:
 
   /**
    * @brief Initializes the view with the provided callbacks, meshes, rendering
-   * mode, and texture paths.
+   * mode, and texture images.
    *
    * @param callbacks Pointer to the application's callback functions.
    * @param meshes A map associating mesh names with their corresponding polygon
    * mesh objects.
    * @param isTextRender Boolean flag indicating if text rendering mode is
    * enabled.
-   * @param texturePaths A map linking texture names to their file paths.
+   * @param images A map linking texture names to their decoded images.
    */
   void init(Callbacks *callbacks,
             map<string, util::PolygonMesh<VertexAttrib>> &meshes,
-            bool isTextRender, map<string, string> texturePaths);
+            bool isTextRender,
+            const map<string, shared_ptr<ImageLoader>> &images);
 
   /**
    * @brief Renders the provided scenegraph.
@@ -76,6 +80,23 @@ public:
    */
   void resetCamera();
 
+  /**
+   * @brief Switches between drawing the scene with OpenGL and showing a
+   * progressive ray traced preview of it.
+   */
+  void toggleProgressivePreview();
+
+  /**
+   * @brief Computes the view transform for a camera orbiting the origin.
+   *
+   * Does not require a window or OpenGL context.
+   *
+   * @param pitch The camera pitch angle in degrees.
+   * @param yaw The camera yaw angle in degrees.
+   * @return The view transform.
+   */
+  static glm::mat4 getCameraTransform(float pitch, float yaw);
+
   /**
    * @brief Checks if the window should be closed.
    *
@@ -140,6 +161,11 @@ private:
    */
   map<string, GLuint> textures;
 
+  /**
+   * @brief The same textures converted for the ray tracer.
+   */
+  sgraph::TextureCache rayTextures;
+
   /**
    * @brief Default texture identifier used when a specific texture is not
    * available.
@@ -150,6 +176,48 @@ private:
    * @brief Boolean flag indicating whether text rendering mode is active.
    */
   bool isTextRender;
+
+  /**
+   * @brief Whether the window shows the progressive ray traced preview.
+   */
+  bool progressivePreview;
+
+  /**
+   * @brief Whether a progressive render has been started for the preview.
+   */
+  bool previewStarted;
+
+  /**
+   * @brief Camera transform the running progressive render was started with.
+   */
+  glm::mat4 previewCamera;
+
+  /**
+   * @brief Latest image of the progressive render, reused between frames.
+   */
+  vector<glm::vec3> previewPixels;
+
+  /**
+   * @brief Texture holding the preview image.
+   */
+  GLuint previewTexture;
+
+  /**
+   * @brief Framebuffer with the preview texture attached, blitted to the
+   * window.
+   */
+  GLuint previewFramebuffer;
+
+  /**
+   * @brief Width and height of the ray traced images.
+   */
+  static const int RAYTRACE_SIZE = 800;
+
+  /**
+   * @brief Uploads the latest preview image, if it changed, and copies it to
+   * the window.
+   */
+  void showPreview();
 };
 
 #endif
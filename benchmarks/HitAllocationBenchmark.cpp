@@ -0,0 +1,104 @@
+/**
+ * @file HitAllocationBenchmark.cpp
+ * @brief Counts the heap allocations of a ray traced render.
+ *
+ * The scene is rendered at two sizes with global operator new counted, on a
+ * fixed number of threads. Setup (compiling the scene, building the BVH,
+ * starting threads) then allocates the same amount at any size, so if the
+ * ray loop is allocation-free the two counts match. Any allocation per ray or per hit shows up as a difference
+ * that grows with the pixel count.
+ *
+ * Usage: HitAllocationBenchmark [scene.txt] [small size] [large size]
+ */
+#include <glad/glad.h>
+
+#include "PolygonMesh.h"
+#include "VertexAttrib.h"
+#include "ObjImporter.h"
+#include "sgraph/RaycastScenegraphRenderer.h"
+#include "sgraph/ScenegraphImporter.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <new>
+
+static std::atomic<long> allocations(0);
+
+// Workers are capped at one per tile, so a small image could otherwise get
+// fewer threads, each allocating its own state, than a large one.
+static const int THREADS = 4;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = std::malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+/**
+ * @brief Discards the image, so that only the renderer allocates.
+ */
+class DiscardSink : public sgraph::ImageSink {
+public:
+  bool begin(int, int) { return true; }
+  void writeRows(int, int, const glm::vec3 *) {}
+  void end() {}
+};
+
+/**
+ * @brief Render the scene once at the given size.
+ *
+ * @return The number of allocations made by the render.
+ */
+static long countRender(sgraph::IScenegraph *scenegraph, int size) {
+  // The camera of the interactive view and of --render
+  float radius = 350, pitch = glm::radians(20.0f), yaw = glm::radians(-135.0f);
+  glm::vec3 eye(radius * cos(pitch) * sin(yaw), radius * sin(pitch),
+                radius * cos(pitch) * cos(yaw));
+  std::stack<glm::mat4> modelview;
+  modelview.push(glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0, 1, 0)));
+  std::map<std::string, util::ObjectInstance *> objects;
+  sgraph::RaycastScenegraphRenderer renderer(modelview, objects, size, size);
+  renderer.setMeshes(scenegraph->getMeshes());
+  renderer.setThreadCount(THREADS);
+  DiscardSink sink;
+
+  long before = allocations;
+  renderer.render(scenegraph->getRoot(), sink);
+  return allocations - before;
+}
+
+int main(int argc, char *argv[]) {
+  std::string sceneFile =
+      (argc > 1) ? argv[1] : "scenegraphmodels/full-scene.txt";
+  int small = (argc > 2) ? atoi(argv[2]) : 100;
+  int large = (argc > 3) ? atoi(argv[3]) : 400;
+
+  std::ifstream in(sceneFile.c_str());
+  if (!in.is_open()) {
+    std::cerr << "Cannot open " << sceneFile << std::endl;
+    return EXIT_FAILURE;
+  }
+  sgraph::ScenegraphImporter importer;
+  sgraph::IScenegraph *scenegraph = importer.parse(in);
+
+  long smallCount = countRender(scenegraph, small);
+  long largeCount = countRender(scenegraph, large);
+  long extraPixels = static_cast<long>(large) * large -
+                     static_cast<long>(small) * small;
+  printf("%s\n", sceneFile.c_str());
+  printf("  %dx%d: %ld allocations\n", small, small, smallCount);
+  printf("  %dx%d: %ld allocations\n", large, large, largeCount);
+  printf("  %.4f allocations per extra pixel\n",
+         static_cast<double>(largeCount - smallCount) / extraPixels);
+  delete scenegraph;
+  return (largeCount == smallCount) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file ObjImportBenchmark.cpp
+ * @brief Times util::ObjImporter on OBJ files.
+ *
+ * Each file is memory mapped once and parsed from memory several times,
+ * first on one thread and then with the default thread count; the best time
+ * of each is reported. Files smaller than the importer's parallel threshold
+ * are always parsed on one thread.
+ *
+ * Usage: ObjImportBenchmark [file.obj...], by default every file in models/
+ */
+#include <glad/glad.h>
+
+#include "PolygonMesh.h"
+#include "VertexAttrib.h"
+#include "ObjImporter.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <string>
+#include <vector>
+
+static const int RUNS = 5;
+
+/**
+ * @brief List the OBJ files in a directory, sorted by name.
+ */
+static std::vector<std::string> objFiles(const std::string &directory) {
+  std::vector<std::string> files;
+  DIR *dir = opendir(directory.c_str());
+  if (dir == NULL)
+    return files;
+  while (dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".obj") == 0)
+      files.push_back(directory + "/" + name);
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+/**
+ * @brief Import a buffer RUNS times.
+ *
+ * @return The best time in milliseconds.
+ */
+static double importTime(const util::MappedFile &file, unsigned threads,
+                         util::PolygonMesh<VertexAttrib> &mesh) {
+  double best = 1e30;
+  for (int i = 0; i < RUNS; i++) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    mesh = util::ObjImporter<VertexAttrib>::importBuffer(
+        file.getData(), file.getSize(), true, threads);
+    best = std::min(best, std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> files(argv + 1, argv + argc);
+  if (files.empty())
+    files = objFiles("models");
+  if (files.empty()) {
+    fprintf(stderr, "No OBJ files given or found in models/\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%-34s %9s %9s %11s %11s\n", "file", "vertices", "triangles",
+         "1 thread", "threads");
+  for (size_t f = 0; f < files.size(); f++) {
+    util::MappedFile file(files[f]);
+    if (!file.isOpen()) {
+      fprintf(stderr, "Cannot open %s\n", files[f].c_str());
+      return EXIT_FAILURE;
+    }
+    util::PolygonMesh<VertexAttrib> mesh;
+    try {
+      double serial = importTime(file, 1, mesh);
+      double parallel = importTime(file, 0, mesh);
+      printf("%-34s %9d %9d %8.2f ms %8.2f ms\n", files[f].c_str(),
+             mesh.getVertexCount(), mesh.getPrimitiveCount() / 3, serial,
+             parallel);
+    } catch (const std::string &error) {
+      fprintf(stderr, "%s: %s\n", files[f].c_str(), error.c_str());
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
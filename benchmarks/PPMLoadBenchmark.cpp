@@ -0,0 +1,136 @@
+/**
+ * @file PPMLoadBenchmark.cpp
+ * @brief Times PPMImageLoader against the loader it replaced.
+ *
+ * The baseline below is the previous PPMImageLoader::load, which read the
+ * file line by line into a stringstream and extracted every channel with
+ * operator>>; it only handled ASCII P3 files. Both loaders read each file
+ * several times, the best times are reported and their pixels compared.
+ *
+ * Usage: PPMLoadBenchmark [file.ppm...], by default every PPM in textures/
+ */
+#include <glad/glad.h>
+
+#include "PPMImageLoader.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const int RUNS = 10;
+
+/**
+ * @brief The stringstream based P3 loader, kept as the baseline.
+ */
+class BaselinePPMLoader : public ImageLoader {
+public:
+  void load(string filename) {
+    ifstream fp(filename.c_str());
+    if (!fp.is_open())
+      throw std::invalid_argument("File not found!");
+
+    // read line by line and ignore comments
+    stringstream input;
+    string line;
+    while (getline(fp, line)) {
+      if ((line.length() > 0) && (line[0] != '#'))
+        input << line << endl;
+    }
+
+    string magic;
+    int factor, r, g, b;
+    input >> magic >> width >> height >> factor;
+    image.assign(3 * width * height, 0);
+    for (int i = 0; i < height; i++) {
+      for (int j = 0; j < width; j++) {
+        input >> r >> g >> b;
+        image[3 * ((height - 1 - i) * width + j)] = r;
+        image[3 * ((height - 1 - i) * width + j) + 1] = g;
+        image[3 * ((height - 1 - i) * width + j) + 2] = b;
+      }
+    }
+  }
+};
+
+/**
+ * @brief List the PPM files in a directory, sorted by name.
+ */
+static vector<string> ppmFiles(const string &directory) {
+  vector<string> files;
+  DIR *dir = opendir(directory.c_str());
+  if (dir == NULL)
+    return files;
+  while (dirent *entry = readdir(dir)) {
+    string name = entry->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ppm") == 0)
+      files.push_back(directory + "/" + name);
+  }
+  closedir(dir);
+  sort(files.begin(), files.end());
+  return files;
+}
+
+/**
+ * @brief Load a file RUNS times with a fresh loader each time.
+ *
+ * @param pixels Set to the decoded pixels.
+ * @return The best time in milliseconds.
+ */
+template <class Loader>
+static double loadTime(const string &filename, vector<GLubyte> &pixels) {
+  double best = 1e30;
+  for (int i = 0; i < RUNS; i++) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Loader loader;
+    loader.load(filename);
+    best = min(best, chrono::duration<double, milli>(
+                         chrono::steady_clock::now() - start)
+                         .count());
+    GLubyte *p = loader.getPixels();
+    pixels.assign(p, p + 3 * loader.getWidth() * loader.getHeight());
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  vector<string> files(argv + 1, argv + argc);
+  if (files.empty())
+    files = ppmFiles("textures");
+  if (files.empty()) {
+    fprintf(stderr, "No PPM files given or found in textures/\n");
+    return EXIT_FAILURE;
+  }
+
+  // PPMImageLoader announces every file it opens
+  streambuf *out = cout.rdbuf();
+  stringstream log;
+  bool identical = true;
+  printf("%-26s %11s %11s %8s %s\n", "file", "baseline", "current",
+         "speedup", "pixels");
+  for (size_t f = 0; f < files.size(); f++) {
+    vector<GLubyte> baselinePixels, currentPixels;
+    double baseline, current;
+    try {
+      cout.rdbuf(log.rdbuf());
+      baseline = loadTime<BaselinePPMLoader>(files[f], baselinePixels);
+      current = loadTime<PPMImageLoader>(files[f], currentPixels);
+      cout.rdbuf(out);
+    } catch (const exception &e) {
+      cout.rdbuf(out);
+      fprintf(stderr, "%s: %s\n", files[f].c_str(), e.what());
+      return EXIT_FAILURE;
+    }
+    bool same = baselinePixels == currentPixels;
+    identical = identical && same;
+    printf("%-26s %8.2f ms %8.2f ms %7.1fx %s\n", files[f].c_str(), baseline,
+           current, baseline / current, same ? "identical" : "DIFFERENT");
+  }
+  return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
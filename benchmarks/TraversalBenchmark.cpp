@@ -0,0 +1,121 @@
+/**
+ * @file TraversalBenchmark.cpp
+ * @brief Measures how fast visitors walk a scene graph.
+ *
+ * Two visitors count the nodes of a scene many times over. One reads the
+ * children through the const reference getChildren() returns; the other
+ * copies the child vector on every loop test and subscript, the way visitors
+ * did when getChildren() returned it by value.
+ *
+ * Usage: TraversalBenchmark [scene.txt] [walks]
+ */
+#include <glad/glad.h>
+
+#include "PolygonMesh.h"
+#include "VertexAttrib.h"
+#include "ObjImporter.h"
+#include "sgraph/SGNodeVisitor.h"
+#include "sgraph/ScenegraphImporter.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+/**
+ * @brief Counts nodes, reading each node's children once by reference.
+ */
+class ReferenceCounter : public sgraph::SGNodeVisitor {
+public:
+  ReferenceCounter() : count(0) {}
+
+  void visitGroupNode(sgraph::GroupNode *node) { visitParent(node); }
+  void visitLeafNode(sgraph::LeafNode *) { count++; }
+  void visitTransformNode(sgraph::TransformNode *node) { visitParent(node); }
+  void visitScaleTransform(sgraph::ScaleTransform *node) { visitParent(node); }
+  void visitTranslateTransform(sgraph::TranslateTransform *node) {
+    visitParent(node);
+  }
+  void visitRotateTransform(sgraph::RotateTransform *node) {
+    visitParent(node);
+  }
+
+  long count;
+
+private:
+  void visitParent(sgraph::ParentSGNode *node) {
+    count++;
+    const std::vector<sgraph::SGNode *> &children = node->getChildren();
+    for (size_t i = 0; i < children.size(); i++)
+      children[i]->accept(this);
+  }
+};
+
+/**
+ * @brief Counts nodes, copying the child vector whenever it is read.
+ */
+class CopyCounter : public sgraph::SGNodeVisitor {
+public:
+  CopyCounter() : count(0) {}
+
+  void visitGroupNode(sgraph::GroupNode *node) { visitParent(node); }
+  void visitLeafNode(sgraph::LeafNode *) { count++; }
+  void visitTransformNode(sgraph::TransformNode *node) { visitParent(node); }
+  void visitScaleTransform(sgraph::ScaleTransform *node) { visitParent(node); }
+  void visitTranslateTransform(sgraph::TranslateTransform *node) {
+    visitParent(node);
+  }
+  void visitRotateTransform(sgraph::RotateTransform *node) {
+    visitParent(node);
+  }
+
+  long count;
+
+private:
+  static std::vector<sgraph::SGNode *> children(sgraph::ParentSGNode *node) {
+    return node->getChildren();
+  }
+
+  void visitParent(sgraph::ParentSGNode *node) {
+    count++;
+    for (size_t i = 0; i < children(node).size(); i++)
+      children(node)[i]->accept(this);
+  }
+};
+
+/**
+ * @brief Walk the scene the given number of times and report the rate.
+ */
+template <class Counter>
+static void walk(const char *label, sgraph::SGNode *root, int walks) {
+  Counter counter;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int i = 0; i < walks; i++)
+    root->accept(&counter);
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  printf("  %-10s %ld node visits in %.3f s: %.1fM nodes/s\n", label,
+         counter.count, seconds, counter.count / seconds / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+  std::string sceneFile =
+      (argc > 1) ? argv[1] : "scenegraphmodels/humanoid-commands.txt";
+  int walks = (argc > 2) ? atoi(argv[2]) : 100000;
+
+  std::ifstream in(sceneFile.c_str());
+  if (!in.is_open()) {
+    std::cerr << "Cannot open " << sceneFile << std::endl;
+    return EXIT_FAILURE;
+  }
+  sgraph::ScenegraphImporter importer;
+  sgraph::IScenegraph *scenegraph = importer.parse(in);
+
+  printf("%s, %d walks\n", sceneFile.c_str(), walks);
+  walk<CopyCounter>("copying", scenegraph->getRoot(), walks);
+  walk<ReferenceCounter>("reference", scenegraph->getRoot(), walks);
+  delete scenegraph;
+  return EXIT_SUCCESS;
+}
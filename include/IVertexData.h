@@ -1,6 +1,7 @@
 #ifndef IVERTEXDATA_H_
 #define IVERTEXDATA_H_
 
+#include <glm/glm.hpp>
 #include <string>
 #include <vector>
 #include <stdexcept>
@@ -48,6 +49,99 @@ public:
      */
     virtual vector<string> getAllAttributes()=0;
 };
+
+/*
+ * Tags that name the standard vertex attributes at compile time. Each knows
+ * its attribute name and the value of any components a vertex leaves out.
+ */
+struct PositionAttribute
+{
+    static const char *name() { return "position"; }
+    static glm::vec4 defaultValue() { return glm::vec4(0,0,0,1); }
+};
+
+struct NormalAttribute
+{
+    static const char *name() { return "normal"; }
+    static glm::vec4 defaultValue() { return glm::vec4(0,0,0,0); }
+};
+
+struct TexcoordAttribute
+{
+    static const char *name() { return "texcoord"; }
+    static glm::vec4 defaultValue() { return glm::vec4(0,0,0,1); }
+};
+
+/*
+ * Describes how to read and write the attributes of a vertex type K, so that
+ * mesh code can process every vertex without naming attributes per vertex.
+ *
+ * This generic version works with any IVertexData by going through its
+ * attribute names. A vertex class whose layout is fixed should specialize it
+ * to access its members directly, with no string compares or allocation.
+ */
+template <class K>
+struct VertexTraits
+{
+    /*
+     * Query if a vertex has the attribute named by a tag
+     */
+    template <class Attribute>
+    static bool has(const K& v)
+    {
+        return const_cast<K&>(v).hasData(Attribute::name());
+    }
+
+    /*
+     * Get the attribute named by a tag as 4 floats
+     */
+    template <class Attribute>
+    static glm::vec4 get(const K& v)
+    {
+        vector<float> data = const_cast<K&>(v).getData(Attribute::name());
+        glm::vec4 value = Attribute::defaultValue();
+        for (size_t i=0;(i<data.size()) && (i<4);i++)
+            value[i] = data[i];
+        return value;
+    }
+
+    /*
+     * Set the attribute named by a tag from 4 floats
+     */
+    template <class Attribute>
+    static void set(K& v, const glm::vec4& value)
+    {
+        vector<float> data(4);
+        for (int i=0;i<4;i++)
+            data[i] = value[i];
+        v.setData(Attribute::name(),data);
+    }
+
+    /*
+     * Get the number of floats stored for an attribute, by name
+     */
+    static int getSize(const K& v, const string& attribName)
+    {
+        return const_cast<K&>(v).getData(attribName).size();
+    }
+
+    /*
+     * Pack the named attributes of every vertex into one interleaved array of
+     * floats, in the order the names are given
+     */
+    static void interleave(const vector<K>& vertices, const vector<string>& attribNames, vector<float>& out)
+    {
+        out.clear();
+        for (size_t i=0;i<vertices.size();i++)
+        {
+            for (size_t a=0;a<attribNames.size();a++)
+            {
+                vector<float> data = const_cast<K&>(vertices[i]).getData(attribNames[a]);
+                out.insert(out.end(),data.begin(),data.end());
+            }
+        }
+    }
+};
 }
 
 #endif
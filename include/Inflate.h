@@ -0,0 +1,359 @@
+#ifndef _INFLATE_H_
+#define _INFLATE_H_
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+using namespace std;
+
+namespace util
+{
+
+/*
+ * A decompressor for zlib streams (RFC 1950) holding DEFLATE data
+ * (RFC 1951), as found in PNG images.
+ *
+ * The caller knows how large the decompressed data is, so it is written
+ * straight into a buffer of that size. Huffman codes of up to FAST_BITS bits
+ * are decoded with a single table lookup; longer codes fall back to a
+ * search over code lengths. Corrupt or truncated streams, and streams that
+ * do not decompress to exactly the expected size, throw runtime_error. The
+ * Adler-32 checksum is not verified.
+ */
+class Inflater
+{
+public:
+    /*
+     * Decompresses a zlib stream.
+     *
+     * data and size are the compressed stream, out and outSize the buffer
+     * that it must exactly fill
+     */
+    static void inflate(const unsigned char *data,size_t size,
+                        unsigned char *out,size_t outSize)
+    {
+        if ((size<2) || ((data[0] & 0x0f)!=8) || ((data[0]>>4)>7)
+            || (((data[0]<<8) | data[1])%31!=0))
+            throw runtime_error("Invalid zlib header");
+        if (data[1] & 0x20)
+            throw runtime_error("Preset zlib dictionaries are not supported");
+        Inflater inflater(data+2,size-2,out,outSize);
+        inflater.run();
+    }
+
+private:
+    static const int FAST_BITS = 9;
+
+    /*
+     * A canonical Huffman code, as a table for short codes and per-length
+     * limits for the rest
+     */
+    struct Huffman
+    {
+        //(length<<9)|index into symbols for codes of up to FAST_BITS bits,
+        //indexed by the next FAST_BITS bits of input; 0 if the code is longer
+        unsigned short fast[1<<FAST_BITS];
+        //first code of each length, and its index into symbols
+        unsigned short firstCode[16];
+        unsigned short firstSymbol[16];
+        //one past the last code of each length, left aligned in 16 bits
+        unsigned int maxCode[17];
+        //symbols in code order, and the length of each code
+        unsigned short symbols[288];
+        unsigned char lengths[288];
+
+        void build(const unsigned char *codeLengths,int count)
+        {
+            int counts[16] = {0};
+            int nextCode[16];
+            memset(fast,0,sizeof(fast));
+            for (int i=0;i<count;i++)
+                counts[codeLengths[i]]++;
+            counts[0] = 0;
+            int code = 0;
+            int k = 0;
+            for (int i=1;i<16;i++)
+            {
+                nextCode[i] = code;
+                firstCode[i] = static_cast<unsigned short>(code);
+                firstSymbol[i] = static_cast<unsigned short>(k);
+                code += counts[i];
+                if (counts[i] && (code-1>=(1<<i)))
+                    throw runtime_error("Invalid Huffman code lengths");
+                maxCode[i] = static_cast<unsigned int>(code<<(16-i));
+                code <<= 1;
+                k += counts[i];
+            }
+            maxCode[16] = 0x10000;
+            for (int i=0;i<count;i++)
+            {
+                int length = codeLengths[i];
+                if (length==0)
+                    continue;
+                int c = nextCode[length]-firstCode[length]+firstSymbol[length];
+                lengths[c] = static_cast<unsigned char>(length);
+                symbols[c] = static_cast<unsigned short>(i);
+                if (length<=FAST_BITS)
+                {
+                    //input bits arrive least significant first, so the
+                    //table is indexed by the reversed code
+                    int j = reverse(nextCode[length],length);
+                    while (j<(1<<FAST_BITS))
+                    {
+                        fast[j] = static_cast<unsigned short>((length<<9) | c);
+                        j += 1<<length;
+                    }
+                }
+                nextCode[length]++;
+            }
+        }
+    };
+
+    Inflater(const unsigned char *data,size_t size,
+             unsigned char *out,size_t outSize)
+        :in(data),inEnd(data+size),bits(0),bitCount(0),padding(0),
+         out(out),outPos(0),outSize(outSize)
+    {
+    }
+
+    const unsigned char *in;
+    const unsigned char *inEnd;
+    unsigned long long bits;
+    int bitCount;
+    //bytes of zeros fed in past the end of the input
+    int padding;
+    unsigned char *out;
+    size_t outPos;
+    size_t outSize;
+
+    static int reverse(int code,int length)
+    {
+        int r = 0;
+        for (int i=0;i<length;i++)
+        {
+            r = (r<<1) | (code & 1);
+            code >>= 1;
+        }
+        return r;
+    }
+
+    void refill()
+    {
+        while (bitCount<=56)
+        {
+            if (in<inEnd)
+                bits |= static_cast<unsigned long long>(*in++)<<bitCount;
+            else if (++padding>8)
+                throw runtime_error("Truncated zlib stream");
+            bitCount += 8;
+        }
+    }
+
+    int getBits(int n)
+    {
+        if (bitCount<n)
+            refill();
+        int value = static_cast<int>(bits & ((1ull<<n)-1));
+        bits >>= n;
+        bitCount -= n;
+        return value;
+    }
+
+    int decode(const Huffman& h)
+    {
+        if (bitCount<16)
+            refill();
+        int entry = h.fast[bits & ((1<<FAST_BITS)-1)];
+        int length;
+        int c;
+        if (entry)
+        {
+            length = entry>>9;
+            c = entry & 511;
+        }
+        else
+        {
+            int k = reverse(static_cast<int>(bits & 0xffff),16);
+            for (length=FAST_BITS+1;k>=static_cast<int>(h.maxCode[length]);
+                 length++)
+                ;
+            if (length>=16)
+                throw runtime_error("Invalid Huffman code");
+            c = (k>>(16-length))-h.firstCode[length]+h.firstSymbol[length];
+        }
+        bits >>= length;
+        bitCount -= length;
+        return h.symbols[c];
+    }
+
+    void run()
+    {
+        Huffman literals;
+        Huffman distances;
+        bool last;
+        do
+        {
+            last = getBits(1)!=0;
+            int type = getBits(2);
+            if (type==0)
+            {
+                copyStored();
+                continue;
+            }
+            if (type==1)
+                buildFixed(literals,distances);
+            else if (type==2)
+                buildDynamic(literals,distances);
+            else
+                throw runtime_error("Invalid deflate block type");
+            inflateBlock(literals,distances);
+        } while (!last);
+        if (outPos!=outSize)
+            throw runtime_error("Truncated zlib stream");
+    }
+
+    void copyStored()
+    {
+        //skip to a byte boundary; whole bytes still buffered come first
+        getBits(bitCount & 7);
+        int length = getBits(16);
+        int check = getBits(16);
+        if ((length ^ 0xffff)!=check)
+            throw runtime_error("Corrupt stored deflate block");
+        //whole bytes already buffered, less any zeros padded past the end
+        long buffered = (bitCount>>3)-padding;
+        if ((buffered<0) || ((inEnd-in)+buffered<length))
+            throw runtime_error("Truncated zlib stream");
+        while ((length>0) && (bitCount>0))
+        {
+            put(static_cast<unsigned char>(getBits(8)));
+            length--;
+        }
+        if (outSize-outPos<static_cast<size_t>(length))
+            throw runtime_error("Too much zlib data");
+        memcpy(out+outPos,in,length);
+        outPos += length;
+        in += length;
+    }
+
+    void put(unsigned char c)
+    {
+        if (outPos>=outSize)
+            throw runtime_error("Too much zlib data");
+        out[outPos++] = c;
+    }
+
+    static void buildFixed(Huffman& literals,Huffman& distances)
+    {
+        unsigned char lengths[288];
+        memset(lengths,8,144);
+        memset(lengths+144,9,112);
+        memset(lengths+256,7,24);
+        memset(lengths+280,8,8);
+        literals.build(lengths,288);
+        memset(lengths,5,30);
+        distances.build(lengths,30);
+    }
+
+    void buildDynamic(Huffman& literals,Huffman& distances)
+    {
+        static const unsigned char order[19] =
+            {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+        int literalCount = getBits(5)+257;
+        int distanceCount = getBits(5)+1;
+        int codeLengthCount = getBits(4)+4;
+        if ((literalCount>286) || (distanceCount>30))
+            throw runtime_error("Invalid deflate code counts");
+        unsigned char codeLengthLengths[19] = {0};
+        for (int i=0;i<codeLengthCount;i++)
+            codeLengthLengths[order[i]] = static_cast<unsigned char>(getBits(3));
+        Huffman codeLengths;
+        codeLengths.build(codeLengthLengths,19);
+
+        unsigned char lengths[286+30];
+        int total = literalCount+distanceCount;
+        int n = 0;
+        while (n<total)
+        {
+            int symbol = decode(codeLengths);
+            if (symbol<16)
+            {
+                lengths[n++] = static_cast<unsigned char>(symbol);
+                continue;
+            }
+            unsigned char value = 0;
+            int repeat;
+            if (symbol==16)
+            {
+                if (n==0)
+                    throw runtime_error("Invalid deflate code lengths");
+                value = lengths[n-1];
+                repeat = getBits(2)+3;
+            }
+            else if (symbol==17)
+                repeat = getBits(3)+3;
+            else
+                repeat = getBits(7)+11;
+            if (total-n<repeat)
+                throw runtime_error("Invalid deflate code lengths");
+            memset(lengths+n,value,repeat);
+            n += repeat;
+        }
+        if (lengths[256]==0)
+            throw runtime_error("Invalid deflate code lengths");
+        literals.build(lengths,literalCount);
+        distances.build(lengths+literalCount,distanceCount);
+    }
+
+    void inflateBlock(const Huffman& literals,const Huffman& distances)
+    {
+        static const unsigned short lengthBase[29] =
+            {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,
+             67,83,99,115,131,163,195,227,258};
+        static const unsigned char lengthExtra[29] =
+            {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+        static const unsigned short distanceBase[30] =
+            {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,
+             1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+        static const unsigned char distanceExtra[30] =
+            {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,
+             12,12,13,13};
+        for (;;)
+        {
+            int symbol = decode(literals);
+            if (symbol<256)
+            {
+                put(static_cast<unsigned char>(symbol));
+                continue;
+            }
+            if (symbol==256)
+                return;
+            symbol -= 257;
+            if (symbol>=29)
+                throw runtime_error("Invalid deflate length");
+            size_t length = lengthBase[symbol]+getBits(lengthExtra[symbol]);
+            int d = decode(distances);
+            if (d>=30)
+                throw runtime_error("Invalid deflate distance");
+            size_t distance = distanceBase[d]+getBits(distanceExtra[d]);
+            if (distance>outPos)
+                throw runtime_error("Invalid deflate distance");
+            if (outSize-outPos<length)
+                throw runtime_error("Too much zlib data");
+            unsigned char *dst = out+outPos;
+            const unsigned char *src = dst-distance;
+            if (distance>=length)
+                memcpy(dst,src,length);
+            else
+            {
+                //the match overlaps the bytes it produces
+                for (size_t i=0;i<length;i++)
+                    dst[i] = src[i];
+            }
+            outPos += length;
+        }
+    }
+};
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef _MAPPEDFILE_H_
+#define _MAPPEDFILE_H_
+
+#include <fstream>
+#include <string>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPEDFILE_HAS_MMAP
+#endif
+using namespace std;
+
+namespace util
+{
+
+/*
+ * A read-only view of the whole contents of a file.
+ *
+ * The file is memory mapped where the platform supports it, so that parsers
+ * can walk its bytes directly without copying them through a stream. If
+ * mapping is not available or fails, the file is read into memory instead.
+ * Either way the contents are not null terminated; use getSize().
+ */
+class MappedFile
+{
+public:
+    MappedFile(const string& filename)
+        :contents(NULL),size(0),mapped(false),opened(false)
+    {
+#ifdef MAPPEDFILE_HAS_MMAP
+        int fd = ::open(filename.c_str(),O_RDONLY);
+        if (fd>=0)
+        {
+            struct stat info;
+            if ((fstat(fd,&info)==0) && S_ISREG(info.st_mode))
+            {
+                size = static_cast<size_t>(info.st_size);
+                if (size==0)
+                {
+                    opened = true;
+                }
+                else
+                {
+                    void *address = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+                    if (address!=MAP_FAILED)
+                    {
+                        madvise(address,size,MADV_SEQUENTIAL);
+                        contents = static_cast<const char *>(address);
+                        mapped = true;
+                        opened = true;
+                    }
+                }
+            }
+            ::close(fd);
+        }
+        if (opened)
+            return;
+        size = 0;
+#endif
+        //fall back to reading the whole file
+        ifstream in(filename.c_str(),ios::in | ios::binary);
+        if (!in.is_open())
+            return;
+        in.seekg(0,ios::end);
+        streamoff length = in.tellg();
+        in.seekg(0,ios::beg);
+        if (length>0)
+        {
+            buffer.resize(static_cast<size_t>(length));
+            in.read(&buffer[0],length);
+            buffer.resize(static_cast<size_t>(in.gcount()));
+        }
+        contents = buffer.empty()?NULL:&buffer[0];
+        size = buffer.size();
+        opened = true;
+    }
+
+    ~MappedFile()
+    {
+#ifdef MAPPEDFILE_HAS_MMAP
+        if (mapped)
+            munmap(const_cast<char *>(contents),size);
+#endif
+    }
+
+    /*
+     * Returns true if the file could be opened
+     */
+    bool isOpen() const
+    {
+        return opened;
+    }
+
+    /*
+     * Returns a pointer to the first byte of the file
+     */
+    const char *getData() const
+    {
+        return contents;
+    }
+
+    /*
+     * Returns the number of bytes in the file
+     */
+    size_t getSize() const
+    {
+        return size;
+    }
+
+private:
+    //a mapping cannot be shared, so neither can this object
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char *contents;
+    size_t size;
+    bool mapped;
+    bool opened;
+    vector<char> buffer;
+};
+}
+
+#endif
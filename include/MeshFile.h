@@ -0,0 +1,282 @@
+#ifndef _MESHFILE_H_
+#define _MESHFILE_H_
+
+#include "IVertexData.h"
+#include "MappedFile.h"
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+namespace util
+{
+
+/*
+ * Reads and writes meshes in a compiled binary form, so that a mesh imported
+ * once from an OBJ file can be loaded again without parsing any text.
+ *
+ * A .mesh file is a fixed header followed by the vertex attributes,
+ * interleaved as 4 floats per attribute per vertex, and then the indices as
+ * 32-bit unsigned integers. Everything is stored in the byte order of the
+ * machine that wrote it. The header records the size and modification time
+ * of the OBJ file the mesh came from and whether it was scaled and centered;
+ * a file whose version, byte order or source does not match is not read, so
+ * the caller imports the OBJ again and writes a new one.
+ */
+template <class K>
+class MeshFile
+{
+public:
+    static const unsigned int VERSION = 3;
+
+    /*
+     * The OBJ file a mesh was compiled from, and how it was imported
+     */
+    struct Source
+    {
+        Source(unsigned long long size,long long modified,bool scaleAndCenter)
+            :size(size),modified(modified),scaleAndCenter(scaleAndCenter)
+        {
+        }
+
+        unsigned long long size;
+        long long modified;
+        bool scaleAndCenter;
+    };
+
+    /*
+     * Returns the name of the compiled file kept next to an OBJ file: its
+     * .obj extension, in any case, is replaced by .mesh
+     */
+    static string pathFor(const string& objFilename)
+    {
+        size_t dot = objFilename.find_last_of('.');
+        if ((dot!=string::npos) && (objFilename.size()-dot==4)
+            && (objFilename.find_first_of("/\\",dot)==string::npos))
+        {
+            string extension = objFilename.substr(dot+1);
+            for (size_t i=0;i<extension.size();i++)
+                extension[i] = static_cast<char>(tolower(static_cast<unsigned char>(extension[i])));
+            if (extension=="obj")
+                return objFilename.substr(0,dot)+".mesh";
+        }
+        return objFilename+".mesh";
+    }
+
+    /*
+     * Loads a compiled mesh, memory mapping the file if possible.
+     * \param filename the .mesh file
+     * \param source the OBJ file the mesh must have been compiled from
+     * \param mesh set to the stored mesh if the file is read
+     * \return false if the file is missing, out of date, of another version
+     * or damaged, in which case mesh is unchanged
+     */
+    static bool read(const string& filename,const Source& source,PolygonMesh<K>& mesh)
+    {
+        MappedFile file(filename);
+        if (!file.isOpen() || (file.getSize()<sizeof(Header)))
+            return false;
+        Header header;
+        memcpy(&header,file.getData(),sizeof(Header));
+        if ((memcmp(header.magic,magic(),sizeof(header.magic))!=0)
+            || (header.version!=VERSION) || (header.byteOrder!=BYTE_ORDER_MARK)
+            || (header.sourceSize!=source.size)
+            || (header.sourceModified!=source.modified)
+            || ((header.flags & SCALED_AND_CENTERED)!=(source.scaleAndCenter?static_cast<unsigned int>(SCALED_AND_CENTERED):0u))
+            || (header.attributes>ALL_ATTRIBUTES) || (header.primitiveSize<=0))
+            return false;
+
+        //check the size before touching the data, so a truncated file is
+        //rejected rather than read past its end
+        size_t floatsPerVertex = 4*attributeCount(header.attributes);
+        unsigned long long expected = sizeof(Header)
+            +static_cast<unsigned long long>(header.vertexCount)*floatsPerVertex*sizeof(float)
+            +static_cast<unsigned long long>(header.indexCount)*sizeof(unsigned int);
+        if (file.getSize()!=expected)
+            return false;
+
+        const char *data = file.getData()+sizeof(Header);
+        size_t vertexBytes = header.vertexCount*floatsPerVertex*sizeof(float);
+        vector<unsigned int> indices(header.indexCount);
+        if (!indices.empty())
+            memcpy(&indices[0],data+vertexBytes,indices.size()*sizeof(unsigned int));
+        for (size_t i=0;i<indices.size();i++)
+        {
+            if (indices[i]>=header.vertexCount)
+                return false;
+        }
+
+        typedef VertexTraits<K> Traits;
+        vector<K> vertexData(header.vertexCount);
+        for (size_t i=0;i<vertexData.size();i++)
+        {
+            K& v = vertexData[i];
+            if (header.attributes & POSITION)
+                Traits::template set<PositionAttribute>(v,readVec4(data));
+            if (header.attributes & NORMAL)
+                Traits::template set<NormalAttribute>(v,readVec4(data));
+            if (header.attributes & TEXCOORD)
+                Traits::template set<TexcoordAttribute>(v,readVec4(data));
+        }
+
+        mesh.setVertexData(std::move(vertexData));
+        mesh.setPrimitives(std::move(indices));
+        mesh.setPrimitiveType(header.primitiveType);
+        mesh.setPrimitiveSize(header.primitiveSize);
+        return true;
+    }
+
+    /*
+     * Saves a mesh so that read() can load it. The file is written under a
+     * temporary name and then renamed, so readers never see it half written.
+     * \return false if the file could not be written
+     */
+    static bool write(const string& filename,const Source& source,const PolygonMesh<K>& mesh)
+    {
+        typedef VertexTraits<K> Traits;
+        vector<K> vertexData = mesh.getVertexAttributes();
+        vector<unsigned int> indices = mesh.getPrimitives();
+
+        Header header;
+        memset(&header,0,sizeof(Header));
+        memcpy(header.magic,magic(),sizeof(header.magic));
+        header.version = VERSION;
+        header.byteOrder = BYTE_ORDER_MARK;
+        header.sourceSize = source.size;
+        header.sourceModified = source.modified;
+        header.flags = source.scaleAndCenter?static_cast<unsigned int>(SCALED_AND_CENTERED):0u;
+        vector<string> names;
+        if (!vertexData.empty())
+        {
+            if (Traits::template has<PositionAttribute>(vertexData[0]))
+            {
+                header.attributes |= POSITION;
+                names.push_back(PositionAttribute::name());
+            }
+            if (Traits::template has<NormalAttribute>(vertexData[0]))
+            {
+                header.attributes |= NORMAL;
+                names.push_back(NormalAttribute::name());
+            }
+            if (Traits::template has<TexcoordAttribute>(vertexData[0]))
+            {
+                header.attributes |= TEXCOORD;
+                names.push_back(TexcoordAttribute::name());
+            }
+        }
+        header.vertexCount = static_cast<unsigned int>(vertexData.size());
+        header.indexCount = static_cast<unsigned int>(indices.size());
+        header.primitiveType = mesh.getPrimitiveType();
+        header.primitiveSize = mesh.getPrimitiveSize();
+        glm::vec4 minimum = mesh.getMinimumBounds();
+        glm::vec4 maximum = mesh.getMaximumBounds();
+        for (int i=0;i<4;i++)
+        {
+            header.minBounds[i] = minimum[i];
+            header.maxBounds[i] = maximum[i];
+        }
+
+        vector<float> floats;
+        Traits::interleave(vertexData,names,floats);
+        if (floats.size()!=vertexData.size()*4*names.size())
+            return false;
+
+        string temporary = filename+".tmp";
+        {
+            ofstream out(temporary.c_str(),ios::out | ios::binary | ios::trunc);
+            if (!out.is_open())
+                return false;
+            out.write(reinterpret_cast<const char *>(&header),sizeof(Header));
+            if (!floats.empty())
+                out.write(reinterpret_cast<const char *>(&floats[0]),floats.size()*sizeof(float));
+            if (!indices.empty())
+                out.write(reinterpret_cast<const char *>(&indices[0]),indices.size()*sizeof(unsigned int));
+            out.close();
+            if (out.fail())
+            {
+                std::remove(temporary.c_str());
+                return false;
+            }
+        }
+        if (std::rename(temporary.c_str(),filename.c_str())!=0)
+        {
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    //bits of Header::attributes, in the order attributes are interleaved
+    enum Attributes
+    {
+        POSITION = 1,
+        NORMAL = 2,
+        TEXCOORD = 4,
+        ALL_ATTRIBUTES = 7
+    };
+
+    //bits of Header::flags
+    enum Flags
+    {
+        SCALED_AND_CENTERED = 1
+    };
+
+    //reads back differently if the file was written with another byte order
+    enum
+    {
+        BYTE_ORDER_MARK = 0x01020304
+    };
+
+    /*
+     * The start of a .mesh file. Every field has a fixed size, and the
+     * fields are ordered so that the struct has no padding.
+     */
+    struct Header
+    {
+        char magic[8];
+        unsigned int version;
+        unsigned int byteOrder;
+        unsigned long long sourceSize;
+        long long sourceModified;
+        unsigned int flags;
+        unsigned int attributes;
+        unsigned int vertexCount;
+        unsigned int indexCount;
+        int primitiveType;
+        int primitiveSize;
+        //the extent of the positions, for tools that only need the size of a
+        //mesh; PolygonMesh works it out again as the vertices are set
+        float minBounds[4];
+        float maxBounds[4];
+    };
+
+    static const char *magic()
+    {
+        return "SGMESH\r\n";
+    }
+
+    /*
+     * Reads 4 floats, which need not be aligned, and moves past them
+     */
+    static glm::vec4 readVec4(const char *&data)
+    {
+        float f[4];
+        memcpy(f,data,sizeof(f));
+        data += sizeof(f);
+        return glm::vec4(f[0],f[1],f[2],f[3]);
+    }
+
+    static size_t attributeCount(unsigned int attributes)
+    {
+        return ((attributes & POSITION)?1:0)+((attributes & NORMAL)?1:0)
+            +((attributes & TEXCOORD)?1:0);
+    }
+};
+}
+
+#endif
@@ -1,9 +1,18 @@
 #ifndef _OBJIMPORTER_H_
 #define _OBJIMPORTER_H_
 
+#include "IVertexData.h"
+#include "MappedFile.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 using namespace std;
 
@@ -15,6 +24,18 @@ namespace util
 /*
  * A helper class to import a PolygonMesh object from an OBJ file.
  * It imports only position, normal and texture coordinate data (if present)
+ *
+ * Each corner of a face names a position and, optionally, a texture
+ * coordinate and a normal. Corners that name the same three are welded into
+ * one vertex, so the mesh holds each distinct combination once and shares it
+ * between faces. A corner that leaves out its texture coordinate or normal
+ * uses the one with its position's index if the file has exactly as many of
+ * them as positions, as older exporters assume; otherwise it has none.
+ *
+ * The file is parsed in place: lines and tokens are found by scanning the
+ * bytes directly, without building a string or stream per line. Large files
+ * are split at line boundaries into chunks that are parsed in parallel and
+ * then joined in order, so the result does not depend on the thread count.
  */
 template <class K>
 class ObjImporter
@@ -22,230 +43,122 @@ class ObjImporter
 public:
     static PolygonMesh<K> importFile(ifstream& in, bool scaleAndCenter)
     {
-        vector<glm::vec4> vertices,normals,texcoords;
-        vector<unsigned int> triangles, triangle_texture_indices, triangle_normal_indices;
-        int i,j;
-        int lineno;
-        PolygonMesh<K> mesh;
-
-
-        lineno = 0;
-
-        string line;
+        stringstream contents;
+        contents << in.rdbuf();
+        string buffer = contents.str();
+        return importBuffer(buffer.data(),buffer.size(),scaleAndCenter);
+    }
 
+    /*
+     * Import the OBJ file with the given name, memory mapping it if possible
+     */
+    static PolygonMesh<K> importFile(const string& filename, bool scaleAndCenter)
+    {
+        MappedFile file(filename);
+        if (!file.isOpen())
+        {
+            throw "Cannot open file: " + filename;
+        }
+        return importBuffer(file.getData(),file.getSize(),scaleAndCenter);
+    }
 
+    /*
+     * Import OBJ data held in memory
+     * \param text the first byte of the OBJ text, which need not be null
+     * terminated
+     * \param size the number of bytes of OBJ text
+     * \param scaleAndCenter whether to fit the mesh in a unit cube at the
+     * origin
+     * \param threadCount the most threads to parse with, 0 for one per
+     * hardware thread
+     */
+    static PolygonMesh<K> importBuffer(const char *text, size_t size, bool scaleAndCenter, unsigned threadCount = 0)
+    {
+        vector<glm::vec4> vertices,normals,texcoords;
+        vector<Corner> corners;
+        PolygonMesh<K> mesh;
 
-        while (getline(in,line))
+        if (threadCount==0)
+            threadCount = thread::hardware_concurrency();
+        size_t chunkCount = 1;
+        if (size>=PARALLEL_THRESHOLD)
+            chunkCount = std::max(1u,std::min(threadCount,static_cast<unsigned>(size/(PARALLEL_THRESHOLD/2))));
+
+        //split the buffer into chunks that each end with a complete line
+        vector<Chunk> chunks(chunkCount);
+        const char *end = text+size;
+        const char *chunkBegin = text;
+        for (size_t c=0;c<chunkCount;c++)
         {
-            lineno++;
-            if ((line.length()<=0) || (line[0] == '#'))
+            const char *chunkEnd = end;
+            if (c+1<chunkCount)
             {
-                //line is a comment, ignore
-                continue;
+                chunkEnd = std::max(chunkBegin,text+(size*(c+1))/chunkCount);
+                const char *newline = static_cast<const char *>(memchr(chunkEnd,'\n',end-chunkEnd));
+                chunkEnd = (newline!=NULL)?newline+1:end;
             }
+            chunks[c].begin = chunkBegin;
+            chunks[c].end = chunkEnd;
+            chunkBegin = chunkEnd;
+        }
 
-            stringstream str;
-
-            str << line;
-
-            vector<string> tokens;
-            string symbol;
-
-            while (str>>symbol)
-                tokens.push_back(symbol);
-
-            if (tokens[0]=="v")
-            {
-                if ((tokens.size()<4) || (tokens.size()>7))
-                {
-                    str.str("");
-                    str.clear();
-                    str << "Line " << lineno << ": Vertex coordinate has an invalid number of values";
-                    throw str.str();
-                }
-
-                float num;
-                glm::vec4 v;
-
-                str.str("");
-                str.clear();
-
-                str << tokens[1] << " " << tokens[2] << " " << tokens[3];
-
-                str >> v.x >> v.y >> v.z;
-                v.w = 1.0f;
-
-                if (tokens.size()==5)
-                {
-                    str.str("");
-                    str.clear();
-                    str << tokens[4];
-                    str >> num;
-                    if (num!=0)
-                    {
-                        v.x/=num;
-                        v.y/=num;
-                        v.z/=num;
-                    }
-                }
-
-                vertices.push_back(v);
-            }
-            else if (tokens[0]=="vt")
-            {
-                if ((tokens.size()<3) || (tokens.size()>4))
-                {
-                    str.str("");
-                    str.clear();
-                    str << "Line " << lineno << ": Texture coordinate has an invalid number of values";
-                    throw str.str();
-                }
-
-                glm::vec4 v;
-
-                float n;
-
-                str.str("");
-                str.clear();
-                str << tokens[1] << " " << tokens[2];
-
-                str >> v.x >> v.y;
-                v.z = 0.0f;
-                v.w = 1.0f;
-
-
-                if (tokens.size()>3)
-                {
-                    str.str("");
-                    str.clear();
-                    str << tokens[3];
-                    str >> v.z;
-                }
+        if (chunkCount==1)
+        {
+            parseChunk(chunks[0]);
+        }
+        else
+        {
+            vector<thread> workers;
+            for (size_t c=1;c<chunkCount;c++)
+                workers.push_back(thread(parseChunk,std::ref(chunks[c])));
+            parseChunk(chunks[0]);
+            for (size_t c=0;c<workers.size();c++)
+                workers[c].join();
+        }
 
-                texcoords.push_back(v);
-            }
-            else if (tokens[0]=="vn")
+        //report the first error in the file, counting lines across chunks
+        int lineno = 0;
+        for (size_t c=0;c<chunkCount;c++)
+        {
+            if (!chunks[c].error.empty())
             {
-                if (tokens.size()!=4)
-                {
-                    str.str("");
-                    str.clear();
-                    str << "Line " << lineno << ": Normal has an invalid number of values";
-                    throw str.str();
-                }
-
-
-                float num;
-                glm::vec3 v;
-
-                str.str("");
-                str.clear();
-                str << tokens[1] << " " << tokens[2] << " " << tokens[3];
-                str >> v.x >> v.y >> v.z;
-
-                v = glm::normalize(v);
-                normals.push_back(glm::vec4(v,0.0f));
+                stringstream str;
+                str << "Line " << lineno+chunks[c].errorLine << ": " << chunks[c].error;
+                throw str.str();
             }
-            else if (tokens[0]=="f")
-            {
-                if (tokens.size()<4)
-                {
-                    str.str("");
-                    str.clear();
-                    str << "Line " << lineno << ": Face has too few vertices, must be at least 3";
-                }
-
-
-                vector <unsigned int> t_triangles,t_tex,t_normal;
-
-
-                for (i=1;i<tokens.size();i++)
-                {
-                    str.str("");
-                    str.clear();
-                    str << tokens[i];
-
-                    vector<string> data;
-                    string temp;
-
-                    while (getline(str,temp,'/'))
-                        data.push_back(temp);
-
-
-                    if ((data.size() < 1) && (data.size() > 3))
-                    {
-                        str.str("");
-                        str.clear();
-                        str << "Line " << lineno << ": Face specification has an incorrect number of values";
-                        throw str.str();
-                    }
-
-
-                    //in OBJ file format all indices begin at 1, so must subtract 1 here
-                    int vi;
-                    str.str("");
-                    str.clear();
-                    str << data[0];
-                    str >> vi;
-                    t_triangles.push_back(vi-1); //vertex index
-                    if (data.size() > 1) {
-                        if (data[1].length() > 0) //a vertex texture index exists
-                        {
-                            str.str("");
-                            str.clear();
-                            str << data[1];
-                            str >> vi;
-                            t_tex.push_back(vi-1);
-                        }
-
-
-                        if (data.size() > 2) //a vertex normal index exists
-                        {
-                            str.str("");
-                            str.clear();
-                            str << data[2];
-                            str >> vi;
-                            t_normal.push_back(vi-1);
-                        }
-
-                    }
-                }
-
-                if (t_triangles.size()<3)
-                {
-                    str.str("");
-                    str.clear();
-                    str << "Line " << lineno << ": Fewer than 3 vertices for a polygon";
-                    throw str.str();
-                }
-
-                //if face has more than 3 vertices, break down into a triangle fan
-                for (i=2;i<t_triangles.size();i++)
-                {
-                    triangles.push_back(t_triangles[0]);
-                    triangles.push_back(t_triangles[i-1]);
-                    triangles.push_back(t_triangles[i]);
-
-                    if (t_tex.size()>0)
-                    {
-                        triangle_texture_indices.push_back(t_tex[0]);
-                        triangle_texture_indices.push_back(t_tex[i-1]);
-                        triangle_texture_indices.push_back(t_tex[i]);
-                    }
-
-                    if (t_normal.size()>0)
-                    {
-                        triangle_normal_indices.push_back(t_normal[0]);
-                        triangle_normal_indices.push_back(t_normal[i-1]);
-                        triangle_normal_indices.push_back(t_normal[i]);
-                    }
-
-                }
-
+            lineno += chunks[c].lines;
+        }
 
-            }
+        //join the chunks in file order; face indices are already global
+        size_t vertexCount = 0,texcoordCount = 0,normalCount = 0,indexCount = 0;
+        for (size_t c=0;c<chunkCount;c++)
+        {
+            vertexCount += chunks[c].vertices.size();
+            texcoordCount += chunks[c].texcoords.size();
+            normalCount += chunks[c].normals.size();
+            indexCount += chunks[c].corners.size();
+        }
+        vertices.reserve(vertexCount);
+        texcoords.reserve(texcoordCount);
+        normals.reserve(normalCount);
+        corners.reserve(indexCount);
+        for (size_t c=0;c<chunkCount;c++)
+        {
+            vertices.insert(vertices.end(),chunks[c].vertices.begin(),chunks[c].vertices.end());
+            texcoords.insert(texcoords.end(),chunks[c].texcoords.begin(),chunks[c].texcoords.end());
+            normals.insert(normals.end(),chunks[c].normals.begin(),chunks[c].normals.end());
+            corners.insert(corners.end(),chunks[c].corners.begin(),chunks[c].corners.end());
+            vector<glm::vec4>().swap(chunks[c].vertices);
+            vector<glm::vec4>().swap(chunks[c].texcoords);
+            vector<glm::vec4>().swap(chunks[c].normals);
+            vector<Corner>().swap(chunks[c].corners);
         }
 
+        vector<unsigned int> triangles;
+        vector<Corner> unique;
+        weld(corners,vertices.size(),texcoords.size(),normals.size(),triangles,unique);
+        vector<Corner>().swap(corners);
+
         if (scaleAndCenter)
         {
             //center about the origin and within a cube of side 1 centered at the origin
@@ -255,7 +168,7 @@ public:
             glm::vec4 minimum = center;
             glm::vec4 maximum = center;
 
-            for (i=1;i<vertices.size();i++)
+            for (size_t i=1;i<vertices.size();i++)
             {
                 //center = center.add(vertices.get(i).x,vertices.get(i).y,vertices.get(i).z,0.0f);
                 minimum = glm::min(minimum,vertices[i]);
@@ -281,55 +194,326 @@ public:
                                                                  -center.z));
 
             //scale down each other
-            for (i=0;i<vertices.size();i++)
+            for (size_t i=0;i<vertices.size();i++)
             {
                 vertices[i] = transformMatrix * vertices[i];
             }
         }
 
-        vector<K> vertexData;
-        vector<float> data;
-        for (i=0;i<vertices.size();i++) {
-            K v;
-			
-			data.clear();
-			data.push_back(vertices[i].x);
-			data.push_back(vertices[i].y);
-			data.push_back(vertices[i].z);
-			data.push_back(vertices[i].w);
-			
-            v.setData("position",data);
-            if (texcoords.size()==vertices.size())
-            {
-				data.clear();
-				data.push_back(texcoords[i].x);
-				data.push_back(texcoords[i].y);
-				data.push_back(texcoords[i].z);
-				data.push_back(texcoords[i].w);
-				v.setData("texcoord",data);
-			}    
-            if (normals.size()==vertices.size())
-			{
-				data.clear();
-				data.push_back(normals[i].x);
-				data.push_back(normals[i].y);
-				data.push_back(normals[i].z);
-				data.push_back(normals[i].w);
-				v.setData("normal",data);
-			}
-
-            vertexData.push_back(v);
+        //store the attributes of each vertex directly, without naming them
+        typedef VertexTraits<K> Traits;
+        vector<K> vertexData(unique.size());
+        size_t missingNormals = 0;
+        for (size_t i=0;i<unique.size();i++) {
+            K& v = vertexData[i];
+
+            Traits::template set<PositionAttribute>(v,vertices[unique[i].position]);
+            if (unique[i].texcoord!=NONE)
+                Traits::template set<TexcoordAttribute>(v,texcoords[unique[i].texcoord]);
+            if (unique[i].normal!=NONE)
+                Traits::template set<NormalAttribute>(v,normals[unique[i].normal]);
+            else
+                missingNormals++;
         }
 
-        if ((normals.size()==0) || (normals.size()!=vertices.size()))
-            mesh.computeNormals();
-
-        mesh.setVertexData(vertexData);
-        mesh.setPrimitives(triangles);
+        mesh.setVertexData(std::move(vertexData));
+        mesh.setPrimitives(std::move(triangles));
         mesh.setPrimitiveType(GL_TRIANGLES);
         mesh.setPrimitiveSize(3);
+
+        //vertices the file gives no normal get the average of the faces
+        //around them; the normals the file does give are kept
+        if (missingNormals>0)
+        {
+            mesh.computeNormals();
+            if (missingNormals<unique.size())
+            {
+                vector<K> smoothed = mesh.getVertexAttributes();
+                for (size_t i=0;i<unique.size();i++)
+                {
+                    if (unique[i].normal!=NONE)
+                        Traits::template set<NormalAttribute>(smoothed[i],normals[unique[i].normal]);
+                }
+                mesh.setVertexData(std::move(smoothed));
+            }
+        }
         return mesh;
     }
+
+private:
+    //files smaller than this are always parsed on the calling thread
+    static const size_t PARALLEL_THRESHOLD = 1<<20;
+
+    //marks a corner without a texture coordinate or normal
+    enum
+    {
+        NONE = ~0u
+    };
+
+    /*
+     * One corner of a face: 0-based indices into the positions, texture
+     * coordinates and normals of the file, NONE where a corner leaves one out
+     */
+    struct Corner
+    {
+        unsigned int position;
+        unsigned int texcoord;
+        unsigned int normal;
+    };
+
+    /*
+     * A range of whole lines of the file, and what was parsed from it
+     */
+    struct Chunk
+    {
+        const char *begin;
+        const char *end;
+        vector<glm::vec4> vertices,normals,texcoords;
+        vector<Corner> corners;     //three per triangle
+        int lines;          //lines parsed, up to the error if any
+        string error;       //first error in this chunk, empty if none
+        int errorLine;      //line of the error, counted within the chunk
+
+        Chunk():begin(NULL),end(NULL),lines(0),errorLine(0) {}
+    };
+
+    static bool isSpace(char c)
+    {
+        return (c==' ') || (c=='\t') || (c=='\r') || (c=='\v') || (c=='\f');
+    }
+
+    static const char *skipSpace(const char *p, const char *end)
+    {
+        while ((p<end) && isSpace(*p))
+            p++;
+        return p;
+    }
+
+    static const char *skipToken(const char *p, const char *end)
+    {
+        while ((p<end) && !isSpace(*p))
+            p++;
+        return p;
+    }
+
+    /*
+     * Read a float the same way a stream would, from a token that need not
+     * be null terminated
+     */
+    static float parseFloat(const char *begin, const char *end)
+    {
+        char text[64];
+        size_t length = std::min(static_cast<size_t>(end-begin),sizeof(text)-1);
+        memcpy(text,begin,length);
+        text[length] = '\0';
+        return strtof(text,NULL);
+    }
+
+    /*
+     * Read a leading integer from a piece of a face token, 0 if there is none
+     */
+    static int parseInt(const char *p, const char *end)
+    {
+        bool negative = false;
+        if ((p<end) && ((*p=='-') || (*p=='+')))
+        {
+            negative = (*p=='-');
+            p++;
+        }
+        int value = 0;
+        while ((p<end) && (*p>='0') && (*p<='9'))
+        {
+            value = 10*value + (*p-'0');
+            p++;
+        }
+        return negative?-value:value;
+    }
+
+    /*
+     * Parse up to max whitespace-separated floats into values
+     * \return the number of tokens present, which may exceed max
+     */
+    static int parseFloats(const char *p, const char *end, float *values, int max)
+    {
+        int count = 0;
+        p = skipSpace(p,end);
+        while (p<end)
+        {
+            const char *tokenEnd = skipToken(p,end);
+            if (count<max)
+                values[count] = parseFloat(p,tokenEnd);
+            count++;
+            p = skipSpace(tokenEnd,end);
+        }
+        return count;
+    }
+
+    /*
+     * Read a face token of the form v, v/vt, v//vn or v/vt/vn
+     */
+    static Corner parseCorner(const char *p, const char *end)
+    {
+        //in OBJ file format all indices begin at 1, so must subtract 1 here
+        Corner corner;
+        corner.position = parseInt(p,end)-1;
+        corner.texcoord = NONE;
+        corner.normal = NONE;
+        const char *slash = static_cast<const char *>(memchr(p,'/',end-p));
+        if (slash==NULL)
+            return corner;
+        p = slash+1;
+        if ((p<end) && (*p!='/'))
+            corner.texcoord = parseInt(p,end)-1;
+        slash = static_cast<const char *>(memchr(p,'/',end-p));
+        if (slash!=NULL)
+            corner.normal = parseInt(slash+1,end)-1;
+        return corner;
+    }
+
+    /*
+     * Give each distinct combination of position, texture coordinate and
+     * normal used by the corners one vertex, numbered in order of first use.
+     * Combinations are found through a hash table keyed on the position, as
+     * the other two indices rarely differ for one position: first holds the
+     * last vertex made for each position and next chains to the one before.
+     * \param triangles set to the vertex of each corner
+     * \param unique set to the indices each vertex was made from
+     */
+    static void weld(const vector<Corner>& corners,size_t positionCount,size_t texcoordCount,size_t normalCount,
+                     vector<unsigned int>& triangles,vector<Corner>& unique)
+    {
+        vector<unsigned int> first(positionCount,NONE);
+        vector<unsigned int> next;
+        triangles.resize(corners.size());
+        unique.clear();
+        for (size_t i=0;i<corners.size();i++)
+        {
+            Corner corner = corners[i];
+            if (corner.position>=positionCount)
+                throw string("Face refers to a vertex coordinate that is not in the file");
+            if ((corner.texcoord==NONE) && (texcoordCount==positionCount))
+                corner.texcoord = corner.position;
+            if ((corner.normal==NONE) && (normalCount==positionCount))
+                corner.normal = corner.position;
+            if ((corner.texcoord!=NONE) && (corner.texcoord>=texcoordCount))
+                throw string("Face refers to a texture coordinate that is not in the file");
+            if ((corner.normal!=NONE) && (corner.normal>=normalCount))
+                throw string("Face refers to a normal that is not in the file");
+
+            unsigned int vertex = first[corner.position];
+            while ((vertex!=NONE)
+                   && ((unique[vertex].texcoord!=corner.texcoord) || (unique[vertex].normal!=corner.normal)))
+                vertex = next[vertex];
+            if (vertex==NONE)
+            {
+                vertex = static_cast<unsigned int>(unique.size());
+                unique.push_back(corner);
+                next.push_back(first[corner.position]);
+                first[corner.position] = vertex;
+            }
+            triangles[i] = vertex;
+        }
+    }
+
+    static void parseChunk(Chunk& chunk)
+    {
+        vector<Corner> t_corners;
+        const char *p = chunk.begin;
+        while (p<chunk.end)
+        {
+            const char *lineEnd = static_cast<const char *>(memchr(p,'\n',chunk.end-p));
+            if (lineEnd==NULL)
+                lineEnd = chunk.end;
+            const char *line = p;
+            p = (lineEnd<chunk.end)?lineEnd+1:chunk.end;
+            chunk.lines++;
+
+            if ((line==lineEnd) || (line[0] == '#'))
+            {
+                //line is a comment, ignore
+                continue;
+            }
+
+            const char *symbol = skipSpace(line,lineEnd);
+            const char *symbolEnd = skipToken(symbol,lineEnd);
+            size_t symbolLength = symbolEnd-symbol;
+            float values[4];
+
+            if ((symbolLength==1) && (symbol[0]=='v'))
+            {
+                int count = parseFloats(symbolEnd,lineEnd,values,4);
+                if ((count<3) || (count>6))
+                {
+                    chunk.error = "Vertex coordinate has an invalid number of values";
+                    chunk.errorLine = chunk.lines;
+                    return;
+                }
+
+                glm::vec4 v(values[0],values[1],values[2],1.0f);
+                if ((count==4) && (values[3]!=0))
+                {
+                    v.x/=values[3];
+                    v.y/=values[3];
+                    v.z/=values[3];
+                }
+                chunk.vertices.push_back(v);
+            }
+            else if ((symbolLength==2) && (symbol[0]=='v') && (symbol[1]=='t'))
+            {
+                int count = parseFloats(symbolEnd,lineEnd,values,3);
+                if ((count<2) || (count>3))
+                {
+                    chunk.error = "Texture coordinate has an invalid number of values";
+                    chunk.errorLine = chunk.lines;
+                    return;
+                }
+
+                glm::vec4 v(values[0],values[1],0.0f,1.0f);
+                if (count>2)
+                    v.z = values[2];
+                chunk.texcoords.push_back(v);
+            }
+            else if ((symbolLength==2) && (symbol[0]=='v') && (symbol[1]=='n'))
+            {
+                int count = parseFloats(symbolEnd,lineEnd,values,3);
+                if (count!=3)
+                {
+                    chunk.error = "Normal has an invalid number of values";
+                    chunk.errorLine = chunk.lines;
+                    return;
+                }
+
+                glm::vec3 v = glm::normalize(glm::vec3(values[0],values[1],values[2]));
+                chunk.normals.push_back(glm::vec4(v,0.0f));
+            }
+            else if ((symbolLength==1) && (symbol[0]=='f'))
+            {
+                t_corners.clear();
+                const char *q = skipSpace(symbolEnd,lineEnd);
+                while (q<lineEnd)
+                {
+                    const char *tokenEnd = skipToken(q,lineEnd);
+                    t_corners.push_back(parseCorner(q,tokenEnd));
+                    q = skipSpace(tokenEnd,lineEnd);
+                }
+
+                if (t_corners.size()<3)
+                {
+                    chunk.error = "Fewer than 3 vertices for a polygon";
+                    chunk.errorLine = chunk.lines;
+                    return;
+                }
+
+                //if face has more than 3 vertices, break down into a triangle fan
+                for (size_t i=2;i<t_corners.size();i++)
+                {
+                    chunk.corners.push_back(t_corners[0]);
+                    chunk.corners.push_back(t_corners[i-1]);
+                    chunk.corners.push_back(t_corners[i]);
+                }
+            }
+        }
+    }
 };
 }
 
@@ -1,6 +1,7 @@
 #ifndef _OBJECTINSTANCE_H_
 #define _OBJECTINSTANCE_H_
 
+#include "IVertexData.h"
 #include "PolygonMesh.h"
 #include <string>
 using namespace std;
@@ -95,8 +96,6 @@ namespace util
                                        const map<string,string>& shaderVarsToAttributeNames,
                                        const PolygonMesh<K>& mesh)
   {
-    unsigned int i,j;
-
     initVertexObjects();
 
 
@@ -111,11 +110,15 @@ namespace util
 
     int sizeOfOneVertex=0;
     map<string,int> offsets;
+    map<string,int> sizes;
+    vector<string> attribNames;
 
     for (map<string,string>::const_iterator it=shaderVarsToAttributeNames.cbegin();it!=shaderVarsToAttributeNames.cend();it++)
       {
         offsets[it->second] = sizeOfOneVertex;
-        sizeOfOneVertex += vertexDataList[0].getData(it->second).size();
+        sizes[it->second] = VertexTraits<K>::getSize(vertexDataList[0],it->second);
+        sizeOfOneVertex += sizes[it->second];
+        attribNames.push_back(it->second);
       }
 
     int stride;
@@ -126,21 +129,9 @@ namespace util
       stride = 0;
 
 
+    //pack the attributes of all vertices into one interleaved array
     vector<float> vertexDataAsFloats;
-    vector<float> data;
-
-    for (i=0;i<vertexDataList.size();i++)
-      {
-        for (map<string,string>::const_iterator e = shaderVarsToAttributeNames.cbegin();e!=shaderVarsToAttributeNames.cend();e++)
-          {
-            data.clear();
-            data = vertexDataList[i].getData(e->second);
-            for (j=0;j<data.size();j++)
-              {
-                vertexDataAsFloats.push_back(data[j]);
-              }
-          }
-      }
+    VertexTraits<K>::interleave(vertexDataList,attribNames,vertexDataAsFloats);
 
 
 
@@ -185,7 +176,7 @@ namespace util
           {
             //tell opengl how to interpret the above data
             glVertexAttribPointer(shaderLocation,
-                                     vertexDataList[0].getData(it->second).size(),
+                                     sizes[it->second],
                 GL_FLOAT,
                 GL_FALSE,
                 sizeof(float) * stride,
@@ -234,8 +225,6 @@ namespace util
                                        const map<string,string>& shaderVarsToAttributeNames,
                                        const PolygonMesh<K>& mesh)
   {
-    unsigned int i,j;
-
     initVertexObjects();
 
     primitiveType = mesh.getPrimitiveType();
@@ -249,11 +238,15 @@ namespace util
 
     int sizeOfOneVertex=0;
     map<string,int> offsets;
+    map<string,int> sizes;
+    vector<string> attribNames;
 
     for (map<string,string>::const_iterator it=shaderVarsToAttributeNames.cbegin();it!=shaderVarsToAttributeNames.cend();it++)
       {
         offsets[it->second] = sizeOfOneVertex;
-        sizeOfOneVertex += vertexDataList[0].getData(it->second).size();
+        sizes[it->second] = VertexTraits<K>::getSize(vertexDataList[0],it->second);
+        sizeOfOneVertex += sizes[it->second];
+        attribNames.push_back(it->second);
       }
 
     int stride;
@@ -264,21 +257,9 @@ namespace util
       stride = 0;
 
 
+    //pack the attributes of all vertices into one interleaved array
     vector<float> vertexDataAsFloats;
-    vector<float> data;
-
-    for (i=0;i<vertexDataList.size();i++)
-      {
-        for (map<string,string>::const_iterator e = shaderVarsToAttributeNames.cbegin();e!=shaderVarsToAttributeNames.cend();e++)
-          {
-            data.clear();
-            data = vertexDataList[i].getData(e->second);
-            for (j=0;j<data.size();j++)
-              {
-                vertexDataAsFloats.push_back(data[j]);
-              }
-          }
-      }
+    VertexTraits<K>::interleave(vertexDataList,attribNames,vertexDataAsFloats);
 
 
 
@@ -321,7 +302,7 @@ namespace util
           {
             //tell opengl how to interpret the above data
             glVertexAttribPointer(shaderLocation,
-                                     vertexDataList[0].getData(it->second).size(),
+                                     sizes[it->second],
                 GL_FLOAT,
                 GL_FALSE,
                 sizeof(float) * stride,
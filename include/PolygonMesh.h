@@ -2,6 +2,7 @@
 #define _POLYGONMESH_H_
 
 #define GLM_FORCE_SWIZZLE
+#include "IVertexData.h"
 #include <glm/glm.hpp>
 #include <vector>
 using namespace std;
@@ -62,6 +63,11 @@ public:
     vector<unsigned int> getPrimitives() const;
     void setVertexData(const vector<VertexType>& vp);
     void setPrimitives(const vector<unsigned int>& t);
+    /*
+     * Take over the given vertices or indices instead of copying them
+     */
+    void setVertexData(vector<VertexType>&& vp);
+    void setPrimitives(vector<unsigned int>&& t);
     /*
      * Compute vertex normals in this polygon mesh using Newell's method, if
      * position data exists
@@ -168,41 +174,41 @@ void PolygonMesh<VertexType>::setPrimitives(const vector<unsigned int>& t)
     primitives = vector<unsigned int>(t);
 }
 
+template <class VertexType>
+void PolygonMesh<VertexType>::setVertexData(vector<VertexType>&& vp)
+{
+    vertexData.swap(vp);
+    vp.clear();
+    computeBoundingBox();
+}
+
+template<class VertexType>
+void PolygonMesh<VertexType>::setPrimitives(vector<unsigned int>&& t)
+{
+    primitives.swap(t);
+    t.clear();
+}
+
 
 template<class VertexType>
 void PolygonMesh<VertexType>::computeBoundingBox()
 {
-    unsigned int i,j;
+    typedef VertexTraits<VertexType> Traits;
 
     if (vertexData.size()<=0)
         return;
 
-    if (!vertexData[0].hasData("position"))
+    if (!Traits::template has<PositionAttribute>(vertexData[0]))
     {
         return;
     }
 
-    vector<glm::vec4> positions;
-
-    for (i=0;i<vertexData.size();i++)
-    {
-        vector<float> data = vertexData[i].getData("position");
-        glm::vec4 pos = glm::vec4(0,0,0,1);
-        switch (data.size()) {
-        case 4: pos.w = data[3];
-        case 3: pos.z = data[2];
-        case 2: pos.y = data[1];
-        case 1: pos.x = data[0];
-        }
-        positions.push_back(pos);
-    }
-
-    minBounds = glm::vec4(positions[0]);
-    maxBounds = glm::vec4(positions[0]);
+    minBounds = Traits::template get<PositionAttribute>(vertexData[0]);
+    maxBounds = minBounds;
 
-    for (j=0;j<positions.size();j++)
+    for (size_t j=0;j<vertexData.size();j++)
     {
-        glm::vec4 p = positions[j];
+        glm::vec4 p = Traits::template get<PositionAttribute>(vertexData[j]);
 
         if (p.x<minBounds.x)
         {
@@ -244,88 +250,65 @@ void PolygonMesh<VertexType>::computeBoundingBox()
 template<class VertexType>
 void PolygonMesh<VertexType>::computeNormals()
 {
-    int i,j,k;
+    typedef VertexTraits<VertexType> Traits;
 
-    if (vertexData.size()<=0)
+    if (vertexData.empty())
         return;
 
-    if (!vertexData[0].hasData("position"))
+    if (!Traits::template has<PositionAttribute>(vertexData[0]))
     {
         return;
     }
 
-    if (!vertexData[0].hasData("normal"))
+    if (!Traits::template has<NormalAttribute>(vertexData[0]))
         return;
 
-    vector<glm::vec4> positions;
+    vector<glm::vec4> positions(vertexData.size());
 
-    for (i=0;i<positions.size();i++) {
-        vector<float> data = vertexData[i].getData("position");
-        glm::vec4 pos;
-        switch (data.size()) {
-        case 4: pos.w = data[3];
-        case 3: pos.z = data[2];
-        case 2: pos.y = data[1];
-        case 1: pos.x = data[0];
-        }
-        positions.push_back(pos);
-    }
-    vector<glm::vec4> normals;
-
-    for (i=0;i<positions.size();i++)
+    for (size_t i=0;i<vertexData.size();i++)
     {
-        normals.push_back(glm::vec4(0.0f,0.0f,0.0f,0.0f));
+        positions[i] = Traits::template get<PositionAttribute>(vertexData[i]);
     }
+    vector<glm::vec4> normals(positions.size(),glm::vec4(0.0f,0.0f,0.0f,0.0f));
 
-    for (i=0;i<primitives.size();i+=primitiveSize)
+    for (size_t i=0;i<primitives.size();i+=primitiveSize)
     {
         glm::vec4 norm = glm::vec4(0.0f,0.0f,0.0f,0.0f);
 
-
-
-        //compute the normal of this triangle
-        vector<unsigned int>v;
-
-        for (k=0;k<primitiveSize;k++)
-        {
-            v.push_back(primitives[i+k]);
-        }
+        //the vertices of this primitive
+        const unsigned int *v = &primitives[i];
 
         //the newell's method to calculate normal
 
-        for (k=0;k<primitiveSize;k++)
+        for (int k=0;k<primitiveSize;k++)
         {
-            norm.x += (positions[v[k]].y-positions[v[(k+1)%primitiveSize]].y)*
-                      (positions[v[k]].z+positions[v[(k+1)%primitiveSize]].z);
-            norm.y += (positions[v[k]].z-positions[v[(k+1)%primitiveSize]].z)*
-                      (positions[v[k]].x+positions[v[(k+1)%primitiveSize]].x);
-            norm.z += (positions[v[k]].x-positions[v[(k+1)%primitiveSize]].x)*
-                      (positions[v[k]].y+positions[v[(k+1)%primitiveSize]].y);
+            unsigned int next = v[(k+1)%primitiveSize];
+            norm.x += (positions[v[k]].y-positions[next].y)*
+                      (positions[v[k]].z+positions[next].z);
+            norm.y += (positions[v[k]].z-positions[next].z)*
+                      (positions[v[k]].x+positions[next].x);
+            norm.z += (positions[v[k]].x-positions[next].x)*
+                      (positions[v[k]].y+positions[next].y);
         }
+        //degenerate primitives have no direction to contribute
+        if (glm::length(norm)==0.0f)
+            continue;
         norm = glm::normalize(norm);
 
-        for (k=0;k<primitiveSize;k++)
+        for (int k=0;k<primitiveSize;k++)
         {
             normals[v[k]] = normals[v[k]] + norm;
         }
     }
 
-    for (i=0;i<normals.size();i++)
+    for (size_t i=0;i<vertexData.size();i++)
     {
-
-        normals[i] = glm::normalize(normals[i]);
-    }
-    for (i=0;i<vertexData.size();i++) {
-        vector<float> n;
-
-        n.push_back(normals[i].x);
-        n.push_back(normals[i].y);
-        n.push_back(normals[i].z);
-        n.push_back(normals[i].w);
-        vertexData[i].setData("normal",n);
+        glm::vec4 n = normals[i];
+        if (glm::length(n)>0.0f)
+            n = glm::normalize(n);
+        Traits::template set<NormalAttribute>(vertexData[i],glm::vec4(n.x,n.y,n.z,0.0f));
     }
 }
 
-
 }
 #endif
@@ -0,0 +1,182 @@
+#ifndef _VERTEXCACHEOPTIMIZER_H_
+#define _VERTEXCACHEOPTIMIZER_H_
+
+#include <utility>
+#include <vector>
+using namespace std;
+
+namespace util
+{
+
+/*
+ * Reorders the triangles of a mesh so that the GPU finds more of their
+ * vertices already shaded in its post-transform cache, and then the vertices
+ * so that they are stored in the order they are first used.
+ *
+ * Triangles are ordered with Tipsify (Sander, Nehab and Barczak, "Fast
+ * Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007): it
+ * emits every remaining triangle around one vertex at a time, and moves on to
+ * a vertex of those triangles that is still likely to be in the cache. The
+ * mesh looks the same afterwards; only the order of its data changes.
+ */
+class VertexCacheOptimizer
+{
+public:
+    //a cache size that suits most hardware; results change little around it
+    enum
+    {
+        DEFAULT_CACHE_SIZE = 16
+    };
+
+    /*
+     * Reorder the triangles and vertices of a triangle mesh. Meshes of other
+     * primitives are left alone.
+     */
+    template <class K>
+    static void optimize(PolygonMesh<K>& mesh,int cacheSize = DEFAULT_CACHE_SIZE)
+    {
+        if ((mesh.getPrimitiveType()!=GL_TRIANGLES) || (mesh.getPrimitiveSize()!=3))
+            return;
+        vector<unsigned int> indices = mesh.getPrimitives();
+        vector<K> vertexData = mesh.getVertexAttributes();
+        indices = orderTriangles(indices,vertexData.size(),cacheSize);
+
+        //number the vertices in the order the new triangles use them; unused
+        //vertices are dropped
+        vector<unsigned int> remap(vertexData.size(),NONE);
+        vector<K> ordered;
+        ordered.reserve(vertexData.size());
+        for (size_t i=0;i<indices.size();i++)
+        {
+            unsigned int& to = remap[indices[i]];
+            if (to==NONE)
+            {
+                to = static_cast<unsigned int>(ordered.size());
+                ordered.push_back(vertexData[indices[i]]);
+            }
+            indices[i] = to;
+        }
+
+        mesh.setVertexData(std::move(ordered));
+        mesh.setPrimitives(std::move(indices));
+    }
+
+    /*
+     * Reorder a list of triangles with Tipsify
+     * \param indices three vertex indices per triangle, each below vertexCount
+     * \param vertexCount the number of vertices the indices refer to
+     * \param cacheSize the number of vertices the cache is assumed to hold
+     * \return the same triangles, each with its corners in the same order
+     */
+    static vector<unsigned int> orderTriangles(const vector<unsigned int>& indices,size_t vertexCount,int cacheSize)
+    {
+        size_t triangleCount = indices.size()/3;
+        vector<unsigned int> result;
+        result.reserve(3*triangleCount);
+        if (triangleCount==0)
+            return result;
+
+        //the triangles around each vertex, as ranges of one array
+        vector<unsigned int> live(vertexCount,0);
+        for (size_t i=0;i<3*triangleCount;i++)
+            live[indices[i]]++;
+        vector<unsigned int> offsets(vertexCount+1,0);
+        for (size_t v=0;v<vertexCount;v++)
+            offsets[v+1] = offsets[v]+live[v];
+        vector<unsigned int> adjacent(offsets[vertexCount]);
+        vector<unsigned int> filled(offsets.begin(),offsets.end()-1);
+        for (size_t i=0;i<3*triangleCount;i++)
+            adjacent[filled[indices[i]]++] = static_cast<unsigned int>(i/3);
+
+        //a vertex is in the cache while time-cacheTime[v] is at most cacheSize
+        vector<int> cacheTime(vertexCount,0);
+        vector<bool> emitted(triangleCount,false);
+        vector<unsigned int> deadEnds;
+        vector<unsigned int> candidates;
+        int time = cacheSize+1;
+        size_t cursor = 0;
+        long fan = nextUnfinished(live,cursor);
+
+        while (fan>=0)
+        {
+            candidates.clear();
+            for (unsigned int a=offsets[fan];a<offsets[fan+1];a++)
+            {
+                unsigned int t = adjacent[a];
+                if (emitted[t])
+                    continue;
+                emitted[t] = true;
+                for (int c=0;c<3;c++)
+                {
+                    unsigned int v = indices[3*t+c];
+                    result.push_back(v);
+                    deadEnds.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    if (time-cacheTime[v]>cacheSize)
+                    {
+                        cacheTime[v] = time;
+                        time++;
+                    }
+                }
+            }
+
+            //prefer the candidate that stays in the cache the longest while
+            //its remaining triangles are emitted
+            fan = -1;
+            int best = -1;
+            for (size_t i=0;i<candidates.size();i++)
+            {
+                unsigned int v = candidates[i];
+                if (live[v]==0)
+                    continue;
+                int priority = 0;
+                if (time-cacheTime[v]+2*static_cast<int>(live[v])<=cacheSize)
+                    priority = time-cacheTime[v];
+                if (priority>best)
+                {
+                    best = priority;
+                    fan = v;
+                }
+            }
+            if (fan<0)
+            {
+                //nothing nearby is left: go back to a recent vertex, or else
+                //to the first vertex that still has triangles
+                while (!deadEnds.empty() && (fan<0))
+                {
+                    unsigned int v = deadEnds.back();
+                    deadEnds.pop_back();
+                    if (live[v]>0)
+                        fan = v;
+                }
+                if (fan<0)
+                    fan = nextUnfinished(live,cursor);
+            }
+        }
+        return result;
+    }
+
+private:
+    enum
+    {
+        NONE = ~0u
+    };
+
+    /*
+     * Find the next vertex from cursor on that has triangles left, -1 if none
+     */
+    static long nextUnfinished(const vector<unsigned int>& live,size_t& cursor)
+    {
+        while (cursor<live.size())
+        {
+            if (live[cursor]>0)
+                return static_cast<long>(cursor);
+            cursor++;
+        }
+        return -1;
+    }
+};
+}
+
+#endif
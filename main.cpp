@@ -3,7 +3,9 @@
 #include "View.h"
 #include <glad/glad.h>
 
+#include <exception>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 using namespace std;
@@ -15,29 +17,92 @@ using namespace std;
 
 /// Represents configuration settings for the application.
 struct Config {
-  string fileInput;        ///< File input path for the scenegraph location.
-  bool textRender = false; ///< Flag to toggle text rendering mode.
+  string fileInput;          ///< File input path for the scenegraph location.
+  bool textRender = false;   ///< Flag to toggle text rendering mode.
+  string renderOutput;       ///< Headless ray-traced output file, if any.
+  int width = 800;           ///< Width of the headless render.
+  int height = 800;          ///< Height of the headless render.
+  float cameraPitch = 20.0f; ///< Camera pitch for the headless render.
+  float cameraYaw = -135.0f; ///< Camera yaw for the headless render.
+  int threads = 0;           ///< Ray tracer threads, 0 for one per core.
+  int bitDepth = 8;          ///< Bits per channel of headless PPM output.
+  bool packets = true;       ///< Trace rays in packets of four.
+  int minSamples = 1;        ///< Samples taken by every pixel.
+  int maxSamples = 1;        ///< Samples taken by pixels on edges.
+  float contrast = 0.1f;     ///< Color difference that marks an edge.
+  string heatmapOutput;      ///< Sample count map output file, if any.
+  string snapshotOutput;     ///< Binary scene snapshot output file, if any.
 };
 
+/// Parses a numeric option value, failing if it is missing or malformed.
+/// @param args The command-line arguments.
+/// @param i Index of the option; advanced past the consumed value.
+/// @param value Reference to the value that will be updated.
+/// @return true if a valid value was read, false otherwise.
+template <class T>
+bool parseValue(const vector<string> &args, size_t &i, T &value) {
+  if (i + 1 >= args.size()) {
+    cout << "Missing value for " << args[i] << ".\n";
+    return false;
+  }
+  istringstream in(args[++i]);
+  if (!(in >> value)) {
+    cout << "Invalid value for " << args[i - 1] << ": " << args[i] << "\n";
+    return false;
+  }
+  return true;
+}
+
 /// Parses command-line arguments and populates the configuration.
 /// @param argc Number of command-line arguments.
 /// @param argv Array of command-line arguments.
 /// @param config Reference to the Config object that will be updated.
 /// @return true if the arguments are valid, false otherwise.
 bool parseArguments(int argc, char *argv[], Config &config) {
-  if (argc > 2) {
-    cout << "Unknown arguments supplied. " << argc << " arguments provided.\n";
-    return false;
-  }
-
   vector<string> args(argv + 1, argv + argc);
 
-  // The remaining argument should be the scenegraph location.
-  if (args.size() > 1) {
-    cout << "Too many arguments provided.\n";
-    return false;
-  } else if (args.size() == 1) {
-    config.fileInput = args[0];
+  for (size_t i = 0; i < args.size(); i++) {
+    bool valid = true;
+    if (args[i] == "--render") {
+      valid = parseValue(args, i, config.renderOutput);
+    } else if (args[i] == "--width") {
+      valid = parseValue(args, i, config.width) && config.width > 1;
+    } else if (args[i] == "--height") {
+      valid = parseValue(args, i, config.height) && config.height > 1;
+    } else if (args[i] == "--camera") {
+      valid = parseValue(args, i, config.cameraPitch) &&
+              parseValue(args, i, config.cameraYaw);
+    } else if (args[i] == "--threads") {
+      valid = parseValue(args, i, config.threads) && config.threads >= 0;
+    } else if (args[i] == "--bits") {
+      valid = parseValue(args, i, config.bitDepth) &&
+              (config.bitDepth == 8 || config.bitDepth == 16);
+    } else if (args[i] == "--packets") {
+      string mode;
+      valid = parseValue(args, i, mode) && (mode == "on" || mode == "off");
+      config.packets = (mode == "on");
+    } else if (args[i] == "--samples") {
+      valid = parseValue(args, i, config.minSamples) &&
+              parseValue(args, i, config.maxSamples) &&
+              config.minSamples >= 1 && config.maxSamples >= 1;
+    } else if (args[i] == "--contrast") {
+      valid = parseValue(args, i, config.contrast) && config.contrast >= 0.0f;
+    } else if (args[i] == "--heatmap") {
+      valid = parseValue(args, i, config.heatmapOutput);
+    } else if (args[i] == "--snapshot") {
+      valid = parseValue(args, i, config.snapshotOutput);
+    } else if (args[i].compare(0, 2, "--") == 0) {
+      cout << "Unknown argument: " << args[i] << "\n";
+      return false;
+    } else if (config.fileInput.empty()) {
+      // A bare argument is the scenegraph location.
+      config.fileInput = args[i];
+    } else {
+      cout << "Too many arguments provided.\n";
+      return false;
+    }
+    if (!valid)
+      return false;
   }
 
   return true;
@@ -58,7 +123,13 @@ int main(int argc, char *argv[]) {
   // Parse command-line arguments.
   if (!parseArguments(argc, argv, config)) {
     cout << "Usage:\n"
-         << "  ./assignment7 [\"scenegraph-location\"]\n";
+         << "  ./assignment7 [\"scenegraph-location\"]\n"
+         << "  ./assignment7 [\"scenegraph-location\"] --render out.ppm\n"
+         << "      [--width W] [--height H] [--camera pitch yaw]"
+         << " [--threads N] [--bits 8|16]\n"
+         << "      [--packets on|off] [--samples min max] [--contrast C]"
+         << " [--heatmap map.ppm]\n"
+         << "  ./assignment7 [\"scenegraph-location\"] --snapshot out.sgs\n";
     return 1;
   }
 
@@ -66,6 +137,34 @@ int main(int argc, char *argv[]) {
   // settings.
   Controller controller(model, view, config.fileInput, config.textRender);
 
+  // Save the parsed scene as a binary snapshot and exit.
+  if (!config.snapshotOutput.empty()) {
+    try {
+      controller.saveSnapshot(config.snapshotOutput);
+    } catch (exception &e) {
+      cout << e.what() << "\n";
+      exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+  }
+
+  // In headless mode, ray trace the scene to a file without opening a window.
+  if (!config.renderOutput.empty()) {
+    try {
+      controller.renderToFile(config.renderOutput, config.width,
+                              config.height, config.cameraPitch,
+                              config.cameraYaw, config.threads,
+                              config.bitDepth, config.packets,
+                              config.minSamples, config.maxSamples,
+                              config.contrast, config.heatmapOutput);
+    } catch (exception &e) {
+      cout << e.what() << "\n";
+      exit(EXIT_FAILURE);
+    }
+    // Exit like Controller::run does, without tearing down the scenegraph.
+    exit(EXIT_SUCCESS);
+  }
+
   // Run the main application loop.
   controller.run();
 
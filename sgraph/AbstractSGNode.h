@@ -33,8 +33,38 @@ protected:
   // holds lights/node
   vector<util::Light> nodeLights;
 
+  /**
+   * The cached world transform and its inverse. They are valid only while
+   * worldDirty is false. A dirty node only has dirty nodes below it, because
+   * a node is always brought up to date after its ancestors
+   */
+  glm::mat4 worldTransform;
+  glm::mat4 inverseWorldTransform;
+  bool worldDirty;
+
+  /**
+   * Get the transform from this node's coordinate system to its parent's.
+   * Nodes that transform their subtree override this
+   * \return the local transform of this node
+   */
+  virtual glm::mat4 getLocalTransform() { return glm::mat4(1.0f); }
+
+  /**
+   * Recompute the cached world transform from the parent's, if it is dirty
+   */
+  void updateWorldTransform() {
+    if (!worldDirty)
+      return;
+    worldTransform = getLocalTransform();
+    if (parent != NULL)
+      worldTransform = parent->getWorldTransform() * worldTransform;
+    inverseWorldTransform = glm::inverse(worldTransform);
+    worldDirty = false;
+  }
+
 public:
-  AbstractSGNode(const string &name, sgraph::IScenegraph *graph) {
+  AbstractSGNode(const string &name, sgraph::IScenegraph *graph)
+      : worldTransform(1.0f), inverseWorldTransform(1.0f), worldDirty(true) {
     this->parent = NULL;
     scenegraph = graph;
     setName(name);
@@ -59,7 +89,26 @@ public:
    * \param parent the node that is to be the parent of this node
    */
 
-  void setParent(SGNode *parent) { this->parent = parent; }
+  void setParent(SGNode *parent) {
+    this->parent = parent;
+    markDirty();
+  }
+
+  const glm::mat4 &getWorldTransform() {
+    updateWorldTransform();
+    return worldTransform;
+  }
+
+  const glm::mat4 &getInverseWorldTransform() {
+    updateWorldTransform();
+    return inverseWorldTransform;
+  }
+
+  /**
+   * Marks this node's world transform as out of date. Nodes that have children
+   * override this to pass it on to them
+   */
+  void markDirty() { worldDirty = true; }
 
   /**
    * Sets the scene graph object whose part this node is and then adds itself
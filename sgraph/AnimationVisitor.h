@@ -33,7 +33,7 @@ public:
    * @param node Pointer to the GroupNode.
    */
   virtual void visitGroupNode(GroupNode *node) {
-    for (auto child : node->getChildren()) {
+    for (SGNode *child : node->getChildren()) {
       child->accept(this);
     }
   }
@@ -0,0 +1,165 @@
+#ifndef _ASSETLOADER_H_
+#define _ASSETLOADER_H_
+
+#include "MeshCache.h"
+#include "PolygonMesh.h"
+#include "VertexAttrib.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sgraph {
+
+/**
+ * @brief Loads the files a scene refers to on a pool of worker threads.
+ *
+ * The importer requests each mesh when it reads the command that names it
+ * and carries on parsing while the workers read the file. Meshes come from
+ * the process-wide MeshCache, so a mesh declared by several imported scene
+ * files, or by several scenes, is parsed once. Other work, such as decoding
+ * images, can be queued with run(). Nothing is usable until wait() returns.
+ */
+class AssetLoader {
+public:
+  AssetLoader() : pending(0), stopping(false) {}
+
+  /**
+   * @brief Finish any queued work and stop the workers.
+   */
+  ~AssetLoader() {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      jobsDone.wait(lock, [this]() { return pending == 0; });
+      stopping = true;
+    }
+    jobReady.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+      workers[i].join();
+  }
+
+  /**
+   * @brief Queue the import of an OBJ file, unless it is already queued.
+   *
+   * Files that cannot be opened are skipped, as if never requested.
+   *
+   * @param path The path of the OBJ file.
+   */
+  void requestMesh(const std::string &path) {
+    if (meshes.count(path) != 0)
+      return;
+    std::shared_ptr<MeshRequest> request(new MeshRequest());
+    meshes[path] = request;
+    run([request, path]() {
+      request->mesh = MeshCache::getInstance().get(path);
+    });
+  }
+
+  /**
+   * @brief Queue a job for the workers.
+   *
+   * The job must not touch anything the calling thread uses before wait()
+   * returns. If it throws, the exception is rethrown by wait().
+   */
+  void run(const std::function<void()> &job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(job);
+      pending++;
+      // Start workers as they are needed, up to one per hardware thread
+      unsigned limit = std::max(1u, std::thread::hardware_concurrency());
+      if (workers.size() < limit &&
+          workers.size() < static_cast<size_t>(pending))
+        workers.push_back(std::thread(&AssetLoader::work, this));
+    }
+    jobReady.notify_one();
+  }
+
+  /**
+   * @brief Wait for every job queued so far to finish.
+   *
+   * @throws The first exception thrown by a job since the last wait.
+   */
+  void wait() {
+    std::exception_ptr error;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      jobsDone.wait(lock, [this]() { return pending == 0; });
+      std::swap(error, firstError);
+    }
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+  /**
+   * @brief Get a mesh imported by an earlier request, after wait().
+   *
+   * @param path The path the mesh was requested with.
+   * @return The mesh, or null if it was not requested or its file could not
+   * be opened.
+   */
+  const util::PolygonMesh<VertexAttrib> *
+  getMesh(const std::string &path) const {
+    auto it = meshes.find(path);
+    return (it == meshes.end()) ? NULL : it->second->mesh.get();
+  }
+
+private:
+  /**
+   * @brief The result of importing one OBJ file, filled in by a worker.
+   */
+  struct MeshRequest {
+    // The mesh, shared with the cache; null if the file could not be opened
+    std::shared_ptr<const util::PolygonMesh<VertexAttrib>> mesh;
+  };
+
+  // Requested meshes by path; only touched by the requesting thread.
+  std::map<std::string, std::shared_ptr<MeshRequest>> meshes;
+
+  std::vector<std::thread> workers;
+  // Everything below is guarded by mutex.
+  std::mutex mutex;
+  std::condition_variable jobReady, jobsDone;
+  std::deque<std::function<void()>> jobs;
+  // Jobs queued or running.
+  int pending;
+  bool stopping;
+  std::exception_ptr firstError;
+
+  /**
+   * @brief Run queued jobs until the loader is destroyed.
+   */
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      jobReady.wait(lock, [this]() { return stopping || !jobs.empty(); });
+      if (jobs.empty())
+        return;
+      std::function<void()> job = jobs.front();
+      jobs.pop_front();
+      lock.unlock();
+      std::exception_ptr error;
+      try {
+        job();
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lock.lock();
+      if (error && !firstError)
+        firstError = error;
+      if (--pending == 0)
+        jobsDone.notify_all();
+    }
+  }
+};
+
+} // namespace sgraph
+
+#endif
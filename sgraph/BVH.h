@@ -0,0 +1,497 @@
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include "RayPacket.h"
+#include "Rays.h"
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+namespace sgraph {
+
+/**
+ * @brief An axis-aligned bounding box.
+ */
+struct AABB {
+  glm::vec3 min; ///< Minimum corner.
+  glm::vec3 max; ///< Maximum corner.
+
+  /**
+   * @brief Construct an empty box that any point will grow.
+   */
+  AABB()
+      : min(glm::vec3(std::numeric_limits<float>::max())),
+        max(glm::vec3(-std::numeric_limits<float>::max())) {}
+
+  /**
+   * @brief Grow the box to contain a point.
+   *
+   * @param p The point to include.
+   */
+  void grow(const glm::vec3 &p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+
+  /**
+   * @brief Grow the box to contain another box.
+   *
+   * @param b The box to include.
+   */
+  void grow(const AABB &b) {
+    min = glm::min(min, b.min);
+    max = glm::max(max, b.max);
+  }
+
+  /**
+   * @brief Get the center of the box.
+   *
+   * @return The midpoint of the minimum and maximum corners.
+   */
+  glm::vec3 centroid() const { return (min + max) * 0.5f; }
+
+  /**
+   * @brief Get the surface area of the box, as used by the SAH cost.
+   *
+   * @return The surface area, or 0 for an empty box.
+   */
+  float surfaceArea() const {
+    glm::vec3 e = max - min;
+    if (e.x < 0.0f || e.y < 0.0f || e.z < 0.0f)
+      return 0.0f;
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+  }
+};
+
+/**
+ * @brief A bounding volume hierarchy over a set of bounded primitives.
+ *
+ * The hierarchy is built top-down with a binned surface area heuristic and
+ * stored as a flat array of nodes. The BVH only knows the bounds of the
+ * primitives; intersecting the primitives themselves is delegated to a
+ * caller-supplied functor during traversal, so the same structure can be
+ * used for any kind of geometry.
+ */
+class BVH {
+public:
+  /**
+   * @brief A node of the flattened hierarchy.
+   *
+   * Interior nodes store the index of their left child; the right child
+   * always follows it. Leaves store a range into the primitive index array.
+   */
+  struct Node {
+    AABB bounds;     ///< Bounds of everything below this node.
+    int leftOrFirst; ///< Left child (interior) or first index (leaf).
+    int count;       ///< Number of primitives, 0 for interior nodes.
+  };
+
+  BVH() {}
+
+  /**
+   * @brief Build the hierarchy over the given primitive bounds.
+   *
+   * @param bounds Bounding box of each primitive, indexed by primitive.
+   */
+  void build(const std::vector<AABB> &bounds) {
+    nodes.clear();
+    indices.resize(bounds.size());
+    centroids.resize(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++) {
+      indices[i] = static_cast<int>(i);
+      centroids[i] = bounds[i].centroid();
+    }
+    if (bounds.empty())
+      return;
+    nodes.reserve(2 * bounds.size());
+    Node root;
+    root.leftOrFirst = 0;
+    root.count = static_cast<int>(bounds.size());
+    nodes.push_back(root);
+    updateBounds(0, bounds);
+    subdivide(0, bounds, 0);
+    for (size_t i = 0; i < nodes.size(); i++)
+      padBounds(nodes[i].bounds);
+    centroids.clear();
+  }
+
+  /**
+   * @brief Find the closest primitive along a ray.
+   *
+   * Visits the nodes front to back with an explicit stack, skipping any
+   * node whose box starts beyond the closest hit found so far. Nodes that
+   * start at the closest hit, give or take rounding, are still visited, so
+   * that a functor can break ties between equally distant hits regardless
+   * of the order.
+   *
+   * @param ray The ray, with a normalized direction.
+   * @param tMax The farthest distance of interest; shrinks as hits are found.
+   * @param intersect Functor called as intersect(primitiveIndex, tMax). It
+   * must return true and lower tMax when it finds a closer hit.
+   * @return True if any primitive was hit.
+   */
+  template <class Intersector>
+  bool traverse(const Ray &ray, float &tMax, Intersector &intersect) const {
+    if (nodes.empty())
+      return false;
+    glm::vec3 invDir = 1.0f / ray.direction;
+    bool hit = false;
+    int stack[MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const Node &node = nodes[stack[--top]];
+      float tEnter;
+      if (!intersectBounds(node.bounds, ray.origin, invDir, tMax, tEnter))
+        continue;
+      if (node.count > 0) {
+        for (int i = 0; i < node.count; i++) {
+          if (intersect(indices[node.leftOrFirst + i], tMax))
+            hit = true;
+        }
+        continue;
+      }
+      // Push the farther child first so the nearer one is visited next
+      int nearChild = node.leftOrFirst, farChild = node.leftOrFirst + 1;
+      float tNear, tFar;
+      bool nearHit = intersectBounds(nodes[nearChild].bounds, ray.origin,
+                                     invDir, tMax, tNear);
+      bool farHit = intersectBounds(nodes[farChild].bounds, ray.origin,
+                                    invDir, tMax, tFar);
+      if (farHit && (!nearHit || tFar < tNear)) {
+        std::swap(nearChild, farChild);
+        std::swap(nearHit, farHit);
+      }
+      if (farHit)
+        stack[top++] = farChild;
+      if (nearHit)
+        stack[top++] = nearChild;
+    }
+    return hit;
+  }
+
+  /**
+   * @brief Find whether any primitive blocks a ray.
+   *
+   * Stops at the first primitive that reports a hit, without looking for
+   * the closest one, so nodes are visited in no particular order.
+   *
+   * @param ray The ray.
+   * @param tMax The distance beyond which primitives do not block the ray.
+   * @param test Functor called as test(primitiveIndex). It must return true
+   * if the primitive blocks the ray before tMax.
+   * @return True if some primitive blocks the ray.
+   */
+  template <class Tester>
+  bool occluded(const Ray &ray, float tMax, Tester &test) const {
+    if (nodes.empty())
+      return false;
+    glm::vec3 invDir = 1.0f / ray.direction;
+    int stack[MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const Node &node = nodes[stack[--top]];
+      float tEnter;
+      if (!intersectBounds(node.bounds, ray.origin, invDir, tMax, tEnter))
+        continue;
+      if (node.count > 0) {
+        for (int i = 0; i < node.count; i++) {
+          if (test(indices[node.leftOrFirst + i]))
+            return true;
+        }
+        continue;
+      }
+      stack[top++] = node.leftOrFirst + 1;
+      stack[top++] = node.leftOrFirst;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Find the closest primitive along each ray of a packet.
+   *
+   * The packet descends the hierarchy together: a node is visited if any
+   * active ray reaches it, and only the rays that reach it are passed on.
+   * Children are visited nearest first for the closest of those rays.
+   *
+   * @param packet The rays, with normalized directions.
+   * @param mask Lanes of the packet that carry a ray, lane i in bit i.
+   * @param tMax The farthest distance of interest per lane; shrinks as hits
+   * are found.
+   * @param intersect Functor called as intersect(primitiveIndex, laneMask,
+   * tMax). It must lower tMax for the lanes in laneMask that find a closer
+   * hit.
+   */
+  template <class Intersector>
+  void traversePacket(const RayPacket &packet, int mask, Float4 &tMax,
+                      Intersector &intersect) const {
+    traversePacket(packet.getOrigins(), packet.getDirections(), mask, tMax,
+                   intersect);
+  }
+
+  /**
+   * @brief Find the closest primitive along each of four rays given as
+   * vectors, such as a packet transformed into another coordinate system.
+   *
+   * @param origin The ray origins.
+   * @param dir The ray directions.
+   * @param mask Lanes that carry a ray, lane i in bit i.
+   * @param tMax The farthest distance of interest per lane.
+   * @param intersect Functor called as intersect(primitiveIndex, laneMask,
+   * tMax), as for the packet version.
+   */
+  template <class Intersector>
+  void traversePacket(const Vec3x4 &origin, const Vec3x4 &dir, int mask,
+                      Float4 &tMax, Intersector &intersect) const {
+    if (nodes.empty() || mask == 0)
+      return;
+    Float4 one(1.0f);
+    Vec3x4 invDir(one / dir.x, one / dir.y, one / dir.z);
+    int stack[MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const Node &node = nodes[stack[--top]];
+      Float4 tEnter;
+      int lanes = intersectBounds(node.bounds, origin, invDir, tMax, tEnter)
+                      .bits() &
+                  mask;
+      if (lanes == 0)
+        continue;
+      if (node.count > 0) {
+        for (int i = 0; i < node.count; i++)
+          intersect(indices[node.leftOrFirst + i], lanes, tMax);
+        continue;
+      }
+      // Push the farther child first so the nearer one is visited next
+      Mask4 nodeLanes = Mask4::fromBits(lanes);
+      int nearChild = node.leftOrFirst, farChild = node.leftOrFirst + 1;
+      Float4 tNear, tFar;
+      Mask4 nearHit = intersectBounds(nodes[nearChild].bounds, origin,
+                                      invDir, tMax, tNear) &
+                      nodeLanes;
+      Mask4 farHit =
+          intersectBounds(nodes[farChild].bounds, origin, invDir, tMax, tFar) &
+          nodeLanes;
+      if (closestEntry(farHit, tFar) < closestEntry(nearHit, tNear)) {
+        std::swap(nearChild, farChild);
+        std::swap(nearHit, farHit);
+      }
+      if (farHit.bits() != 0)
+        stack[top++] = farChild;
+      if (nearHit.bits() != 0)
+        stack[top++] = nearChild;
+    }
+  }
+
+  /**
+   * @brief Get the number of nodes in the hierarchy.
+   *
+   * @return The node count.
+   */
+  size_t getNodeCount() const { return nodes.size(); }
+
+private:
+  // Number of centroid bins evaluated per axis when splitting a node.
+  static const int BIN_COUNT = 16;
+  // Upper bound on the traversal stack depth.
+  static const int MAX_DEPTH = 64;
+  // Relative tolerance of the slab tests. Node bounds are padded by this
+  // fraction of their coordinates, and tMax is stretched by it, so that
+  // rounding never culls a node whose primitive is hit at exactly tMax.
+  static constexpr float SLACK = 1e-5f;
+
+  // The flattened nodes; the root is at index 0.
+  std::vector<Node> nodes;
+  // Primitive indices, reordered so that each leaf covers a contiguous range.
+  std::vector<int> indices;
+  // Primitive centroids, only needed while building.
+  std::vector<glm::vec3> centroids;
+
+  /**
+   * @brief Slab test between a ray and a box.
+   *
+   * @param box The box to test.
+   * @param origin The ray origin.
+   * @param invDir Reciprocal of the ray direction.
+   * @param tMax The farthest distance of interest.
+   * @param tEnter Set to the distance at which the ray enters the box.
+   * @return True if the ray reaches the box within [0, tMax], allowing
+   * for rounding.
+   */
+  static bool intersectBounds(const AABB &box, const glm::vec3 &origin,
+                              const glm::vec3 &invDir, float tMax,
+                              float &tEnter) {
+    glm::vec3 t1 = (box.min - origin) * invDir;
+    glm::vec3 t2 = (box.max - origin) * invDir;
+    glm::vec3 tSmall = glm::min(t1, t2);
+    glm::vec3 tLarge = glm::max(t1, t2);
+    tEnter = std::max(std::max(tSmall.x, tSmall.y), tSmall.z);
+    float tExit = std::min(std::min(tLarge.x, tLarge.y), tLarge.z);
+    return !(tExit < std::max(tEnter, 0.0f) ||
+             tEnter > tMax * (1.0f + SLACK));
+  }
+
+  /**
+   * @brief Slab test between four rays and a box.
+   *
+   * Computes the same result as the single ray test in each lane.
+   *
+   * @param box The box to test.
+   * @param origin The ray origins.
+   * @param invDir Reciprocals of the ray directions.
+   * @param tMax The farthest distance of interest per lane.
+   * @param tEnter Set to the distance at which each ray enters the box.
+   * @return The lanes whose ray reaches the box within [0, tMax],
+   * allowing for rounding.
+   */
+  static Mask4 intersectBounds(const AABB &box, const Vec3x4 &origin,
+                               const Vec3x4 &invDir, const Float4 &tMax,
+                               Float4 &tEnter) {
+    Float4 tSmall[3], tLarge[3];
+    for (int i = 0; i < 3; i++) {
+      Float4 t1 = (Float4(box.min[i]) - origin[i]) * invDir[i];
+      Float4 t2 = (Float4(box.max[i]) - origin[i]) * invDir[i];
+      tSmall[i] = min(t1, t2);
+      tLarge[i] = max(t1, t2);
+    }
+    tEnter = max(max(tSmall[0], tSmall[1]), tSmall[2]);
+    Float4 tExit = min(min(tLarge[0], tLarge[1]), tLarge[2]);
+    Mask4 miss = (tExit < max(tEnter, Float4(0.0f))) |
+                 (tEnter > tMax * Float4(1.0f + SLACK));
+    return Mask4::fromBits(0xf).without(miss);
+  }
+
+  /**
+   * @brief Get the smallest entry distance among the lanes of a mask.
+   */
+  static float closestEntry(const Mask4 &lanes, const Float4 &tEnter) {
+    alignas(16) float t[4];
+    tEnter.store(t);
+    int bits = lanes.bits();
+    float closest = std::numeric_limits<float>::max();
+    for (int i = 0; i < 4; i++) {
+      if ((bits & (1 << i)) && t[i] < closest)
+        closest = t[i];
+    }
+    return closest;
+  }
+
+  /**
+   * @brief Grow a box by SLACK times the largest magnitude of its
+   * coordinates in every direction.
+   */
+  static void padBounds(AABB &box) {
+    glm::vec3 extent = glm::max(glm::abs(box.min), glm::abs(box.max));
+    glm::vec3 margin(SLACK * std::max(std::max(extent.x, extent.y), extent.z));
+    box.min -= margin;
+    box.max += margin;
+  }
+
+  /**
+   * @brief Recompute the bounds of a node from the primitives it covers.
+   */
+  void updateBounds(int nodeIndex, const std::vector<AABB> &bounds) {
+    Node &node = nodes[nodeIndex];
+    node.bounds = AABB();
+    for (int i = 0; i < node.count; i++)
+      node.bounds.grow(bounds[indices[node.leftOrFirst + i]]);
+  }
+
+  /**
+   * @brief Recursively split a node along the cheapest binned SAH plane.
+   *
+   * A node stays a leaf when no split is cheaper than intersecting all of
+   * its primitives directly, or when it is deep enough that its children
+   * could overflow the traversal stack.
+   */
+  void subdivide(int nodeIndex, const std::vector<AABB> &bounds, int depth) {
+    int first = nodes[nodeIndex].leftOrFirst;
+    int count = nodes[nodeIndex].count;
+    if (count <= 2 || depth >= MAX_DEPTH - 2)
+      return;
+
+    AABB centroidBounds;
+    for (int i = 0; i < count; i++)
+      centroidBounds.grow(centroids[indices[first + i]]);
+
+    int bestAxis = -1;
+    int bestSplit = 0;
+    float bestCost = std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; axis++) {
+      float lo = centroidBounds.min[axis], hi = centroidBounds.max[axis];
+      if (hi <= lo)
+        continue;
+      AABB binBounds[BIN_COUNT];
+      int binCount[BIN_COUNT] = {0};
+      float scale = BIN_COUNT / (hi - lo);
+      for (int i = 0; i < count; i++) {
+        int p = indices[first + i];
+        int b = std::min(BIN_COUNT - 1,
+                         static_cast<int>((centroids[p][axis] - lo) * scale));
+        binCount[b]++;
+        binBounds[b].grow(bounds[p]);
+      }
+      // Sweep from both ends to get the cost of every split plane
+      float leftArea[BIN_COUNT - 1], rightArea[BIN_COUNT - 1];
+      int leftCount[BIN_COUNT - 1], rightCount[BIN_COUNT - 1];
+      AABB leftBox, rightBox;
+      int leftSum = 0, rightSum = 0;
+      for (int i = 0; i < BIN_COUNT - 1; i++) {
+        leftSum += binCount[i];
+        leftCount[i] = leftSum;
+        leftBox.grow(binBounds[i]);
+        leftArea[i] = leftBox.surfaceArea();
+        rightSum += binCount[BIN_COUNT - 1 - i];
+        rightCount[BIN_COUNT - 2 - i] = rightSum;
+        rightBox.grow(binBounds[BIN_COUNT - 1 - i]);
+        rightArea[BIN_COUNT - 2 - i] = rightBox.surfaceArea();
+      }
+      for (int i = 0; i < BIN_COUNT - 1; i++) {
+        float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestAxis = axis;
+          bestSplit = i;
+        }
+      }
+    }
+
+    float leafCost = count * nodes[nodeIndex].bounds.surfaceArea();
+    if (bestAxis < 0 || bestCost >= leafCost)
+      return;
+
+    // Partition the primitive indices around the chosen plane
+    float lo = centroidBounds.min[bestAxis];
+    float scale = BIN_COUNT / (centroidBounds.max[bestAxis] - lo);
+    int *begin = &indices[first];
+    int *mid = std::partition(begin, begin + count, [&](int p) {
+      float offset = (centroids[p][bestAxis] - lo) * scale;
+      return std::min(BIN_COUNT - 1, static_cast<int>(offset)) <= bestSplit;
+    });
+    int leftCount = static_cast<int>(mid - begin);
+    if (leftCount == 0 || leftCount == count)
+      return;
+
+    int leftIndex = static_cast<int>(nodes.size());
+    Node left, right;
+    left.leftOrFirst = first;
+    left.count = leftCount;
+    right.leftOrFirst = first + leftCount;
+    right.count = count - leftCount;
+    nodes.push_back(left);
+    nodes.push_back(right);
+    nodes[nodeIndex].leftOrFirst = leftIndex;
+    nodes[nodeIndex].count = 0;
+    updateBounds(leftIndex, bounds);
+    updateBounds(leftIndex + 1, bounds);
+    subdivide(leftIndex, bounds, depth + 1);
+    subdivide(leftIndex + 1, bounds, depth + 1);
+  }
+};
+
+} // namespace sgraph
+
+#endif
@@ -23,8 +23,9 @@ namespace sgraph {
  * @brief Renderer for scene graphs using OpenGL.
  *
  * This class implements the SGNodeVisitor interface to traverse and render a
- * scene graph. It manages transformations via a modelview matrix stack and
- * renders objects with respect to lighting and materials.
+ * scene graph. The top of the modelview matrix stack holds the view
+ * transform, which is combined with the cached world transform of each leaf,
+ * and objects are rendered with respect to lighting and materials.
  */
 class GLScenegraphRenderer : public SGNodeVisitor {
 public:
@@ -41,31 +42,25 @@ public:
                        map<string, util::ObjectInstance *> &os,
                        util::ShaderLocationsVault &shaderLocations,
                        map<string, GLuint> &textureMap, GLuint defaultTex)
-      : modelview(mv), objects(os), textures(textureMap),
-        defaultTexture(defaultTex) {
+      : modelview(mv), view(1.0f), inverseView(1.0f), objects(os),
+        textures(textureMap), defaultTexture(defaultTex) {
     this->shaderLocations = shaderLocations;
   }
 
   /**
    * @brief Visits a GroupNode and renders its content.
    *
-   * Applies the group node's animation transform, recursively visits all
-   * children, and then restores the previous modelview matrix.
+   * The group's animation transform is already part of the world transforms
+   * of its descendants, so this just visits all children.
    *
    * @param groupNode Pointer to the GroupNode to be visited.
    */
   void visitGroupNode(GroupNode *groupNode) override {
-    // Push a copy of the current modelview matrix on the stack.
-    modelview.push(modelview.top());
-    // Multiply the top matrix by the group's animation transform.
-    modelview.top() = modelview.top() * groupNode->getAnimTransform();
     // Visit all child nodes.
-    vector<SGNode *> children = groupNode->getChildren();
+    const vector<SGNode *> &children = groupNode->getChildren();
     for (int i = 0; i < children.size(); i++) {
       children[i]->accept(this);
     }
-    // Restore the previous modelview matrix.
-    modelview.pop();
   }
 
   /**
@@ -78,15 +73,18 @@ public:
    * @param leafNode Pointer to the LeafNode to be visited.
    */
   void visitLeafNode(LeafNode *leafNode) override {
-    // Get the current modelview matrix.
-    glm::mat4 currentMV = modelview.top();
+    // Combine the view with the leaf's cached world transform.
+    updateView();
+    glm::mat4 currentMV = view * leafNode->getWorldTransform();
 
     // Set the modelview uniform.
     glUniformMatrix4fv(shaderLocations.getLocation("modelview"), 1, GL_FALSE,
                        glm::value_ptr(currentMV));
 
-    // Calculate and set the normal matrix.
-    glm::mat4 normalMatrix = glm::inverse(glm::transpose(currentMV));
+    // Set the normal matrix, the inverse transpose of the modelview, from the
+    // cached inverses.
+    glm::mat4 normalMatrix =
+        glm::transpose(leafNode->getInverseWorldTransform() * inverseView);
     glUniformMatrix4fv(shaderLocations.getLocation("normalmatrix"), 1, GL_FALSE,
                        glm::value_ptr(normalMatrix));
 
@@ -120,23 +118,17 @@ public:
   }
 
   /**
-   * @brief Visits a TransformNode and applies its transformation.
+   * @brief Visits a TransformNode.
    *
-   * Pushes the current modelview matrix, applies the node's transformation,
-   * visits its first child (if available), then restores the matrix.
+   * The node's transformation is already part of the world transforms of its
+   * descendants, so this just visits its first child (if available).
    *
    * @param transformNode Pointer to the TransformNode to be visited.
    */
   void visitTransformNode(TransformNode *transformNode) override {
-    // Save the current state.
-    modelview.push(modelview.top());
-    // Multiply current matrix by the node's transformation.
-    modelview.top() = modelview.top() * transformNode->getTransform();
     // Visit the first child if it exists.
     if (!transformNode->getChildren().empty())
       transformNode->getChildren()[0]->accept(this);
-    // Restore the previous modelview matrix.
-    modelview.pop();
   }
 
   /**
@@ -175,8 +167,11 @@ public:
   }
 
 private:
-  // Reference to the modelview matrix stack used for transformations.
+  // Reference to the modelview matrix stack; its top is the view transform.
   stack<glm::mat4> &modelview;
+  // The view transform last read from the stack, and its inverse.
+  glm::mat4 view;
+  glm::mat4 inverseView;
   // Shader uniform locations.
   util::ShaderLocationsVault shaderLocations;
   // Map of object instances used in the scene.
@@ -185,6 +180,16 @@ private:
   map<string, GLuint> textures;
   // Default texture to use if no texture is provided.
   GLuint defaultTexture;
+
+  /**
+   * @brief Refreshes the cached view transform when the camera has moved.
+   */
+  void updateView() {
+    if (modelview.top() != view) {
+      view = modelview.top();
+      inverseView = glm::inverse(view);
+    }
+  }
 };
 
 } // namespace sgraph
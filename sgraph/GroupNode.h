@@ -53,6 +53,8 @@ public:
     }
 
     GroupNode *newgroup = new GroupNode(name, scenegraph);
+    newgroup->nodeLights = nodeLights;
+    newgroup->setAnimTransform(animTransform);
 
     for (int i = 0; i < children.size(); i++) {
       try {
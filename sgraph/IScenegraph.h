@@ -86,6 +86,20 @@ public:
    * @return map<string,string>
    */
   virtual map<string, string> getMeshPaths() = 0;
+  /**
+   * Set the texture name -> image path for all images declared by this scene
+   * graph
+   *
+   * @param texturePaths
+   */
+  virtual void setTexturePaths(const map<string, string> &texturePaths) = 0;
+  /**
+   * Get a map of each texture name (as the leaves refer to it) and the path
+   * to its image file
+   *
+   * @return map<string,string>
+   */
+  virtual map<string, string> getTexturePaths() = 0;
 };
 } // namespace sgraph
 
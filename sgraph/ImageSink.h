@@ -0,0 +1,208 @@
+#ifndef _IMAGESINK_H_
+#define _IMAGESINK_H_
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <glm/glm.hpp>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sgraph {
+
+/**
+ * @brief Destination for a rendered image that accepts scanlines as they
+ * become available.
+ *
+ * A renderer calls begin() once, then writeRows() for consecutive bands of
+ * rows from top to bottom, then end(). Sinks never need the whole image in
+ * memory at once.
+ */
+class ImageSink {
+public:
+  virtual ~ImageSink() {}
+
+  /**
+   * @brief Prepare to receive an image of the given size.
+   *
+   * @param width Image width in pixels.
+   * @param height Image height in pixels.
+   * @return True if the sink is ready, false if it could not be opened.
+   */
+  virtual bool begin(int width, int height) = 0;
+
+  /**
+   * @brief Write a band of consecutive rows.
+   *
+   * @param firstRow Index of the first row, counted from the top.
+   * @param rowCount Number of rows in the band.
+   * @param pixels Linear RGB colors of the band, row by row.
+   */
+  virtual void writeRows(int firstRow, int rowCount,
+                         const glm::vec3 *pixels) = 0;
+
+  /**
+   * @brief Finish the image once every row has been written.
+   */
+  virtual void end() = 0;
+};
+
+/**
+ * @brief Writes binary PPM (P6) images with 8 or 16 bits per channel.
+ *
+ * Each band of rows is converted into one byte buffer and written with a
+ * single call, instead of formatting every channel as text.
+ */
+class PPMImageSink : public ImageSink {
+public:
+  /**
+   * @brief Create a sink for the given file.
+   *
+   * @param filename The file to write.
+   * @param bitDepth Bits per channel, either 8 or 16.
+   */
+  PPMImageSink(const std::string &filename, int bitDepth = 8)
+      : filename(filename), bitDepth(bitDepth == 16 ? 16 : 8), width(0) {}
+
+  bool begin(int width, int height) {
+    this->width = width;
+    out.open(filename.c_str(), std::ios::binary);
+    if (!out) {
+      std::cerr << "Cannot open file: " << filename << std::endl;
+      return false;
+    }
+    int maxValue = (bitDepth == 16) ? 65535 : 255;
+    out << "P6\n" << width << " " << height << "\n" << maxValue << "\n";
+    return true;
+  }
+
+  void writeRows(int, int rowCount, const glm::vec3 *pixels) {
+    int bytesPerChannel = bitDepth / 8;
+    size_t channels = static_cast<size_t>(width) * rowCount * 3;
+    buffer.resize(channels * bytesPerChannel);
+    const float *values = &pixels[0].x;
+    for (size_t i = 0; i < channels; i++) {
+      float c = std::min(std::max(values[i], 0.0f), 1.0f);
+      if (bitDepth == 16) {
+        // PPM stores 16-bit samples most significant byte first
+        uint16_t v = static_cast<uint16_t>(65535 * c);
+        buffer[2 * i] = static_cast<char>(v >> 8);
+        buffer[2 * i + 1] = static_cast<char>(v & 0xff);
+      } else {
+        buffer[i] = static_cast<char>(static_cast<unsigned char>(255 * c));
+      }
+    }
+    out.write(&buffer[0], buffer.size());
+  }
+
+  void end() {
+    out.close();
+    std::cout << "PPM image written to " << filename << std::endl;
+  }
+
+private:
+  std::string filename;
+  int bitDepth;
+  int width;
+  std::ofstream out;
+  // Staging buffer reused for every band.
+  std::vector<char> buffer;
+};
+
+/**
+ * @brief Writes Portable Float Map (PFM) images, preserving the unclamped
+ * floating point colors for HDR compositing.
+ *
+ * PFM stores rows bottom to top, so each band is written straight to its
+ * final position in the file.
+ */
+class PFMImageSink : public ImageSink {
+public:
+  /**
+   * @brief Create a sink for the given file.
+   *
+   * @param filename The file to write.
+   */
+  PFMImageSink(const std::string &filename)
+      : filename(filename), width(0), height(0), headerSize(0) {}
+
+  bool begin(int width, int height) {
+    this->width = width;
+    this->height = height;
+    out.open(filename.c_str(), std::ios::binary);
+    if (!out) {
+      std::cerr << "Cannot open file: " << filename << std::endl;
+      return false;
+    }
+    // A negative scale marks the data as little-endian
+    out << "PF\n" << width << " " << height << "\n-1.0\n";
+    headerSize = out.tellp();
+    return true;
+  }
+
+  void writeRows(int firstRow, int rowCount, const glm::vec3 *pixels) {
+    std::streamoff rowBytes = static_cast<std::streamoff>(width) * 3 * 4;
+    for (int r = 0; r < rowCount; r++) {
+      int fileRow = height - 1 - (firstRow + r);
+      out.seekp(headerSize + fileRow * rowBytes);
+      writeFloats(&pixels[static_cast<size_t>(r) * width].x, width * 3);
+    }
+  }
+
+  void end() {
+    out.close();
+    std::cout << "PFM image written to " << filename << std::endl;
+  }
+
+private:
+  std::string filename;
+  int width, height;
+  std::streamoff headerSize;
+  std::ofstream out;
+  std::vector<char> buffer;
+
+  /**
+   * @brief Write floats in little-endian order regardless of the host.
+   */
+  void writeFloats(const float *values, int count) {
+    buffer.resize(static_cast<size_t>(count) * 4);
+    for (int i = 0; i < count; i++) {
+      uint32_t bits;
+      std::copy(reinterpret_cast<const char *>(&values[i]),
+                reinterpret_cast<const char *>(&values[i]) + 4,
+                reinterpret_cast<char *>(&bits));
+      for (int b = 0; b < 4; b++)
+        buffer[4 * i + b] = static_cast<char>((bits >> (8 * b)) & 0xff);
+    }
+    out.write(&buffer[0], buffer.size());
+  }
+};
+
+/**
+ * @brief Create a sink for a file, choosing the format from its extension.
+ *
+ * Files ending in .pfm get floating point output; anything else is written
+ * as binary PPM.
+ *
+ * @param filename The file to write.
+ * @param bitDepth Bits per channel for PPM output, either 8 or 16.
+ * @return The new sink.
+ */
+inline std::unique_ptr<ImageSink> createImageSink(const std::string &filename,
+                                                  int bitDepth = 8) {
+  size_t dot = filename.find_last_of('.');
+  std::string extension =
+      (dot == std::string::npos) ? "" : filename.substr(dot + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 ::tolower);
+  if (extension == "pfm")
+    return std::unique_ptr<ImageSink>(new PFMImageSink(filename));
+  return std::unique_ptr<ImageSink>(new PPMImageSink(filename, bitDepth));
+}
+
+} // namespace sgraph
+
+#endif
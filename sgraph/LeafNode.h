@@ -75,6 +75,8 @@ public:
   SGNode *clone() {
     LeafNode *newclone =
         new LeafNode(this->objInstanceName, material, name, scenegraph);
+    newclone->textureName = textureName;
+    newclone->nodeLights = nodeLights;
     return newclone;
   }
 
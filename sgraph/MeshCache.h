@@ -0,0 +1,178 @@
+#ifndef _MESHCACHE_H_
+#define _MESHCACHE_H_
+
+#include "MeshFile.h"
+#include "PolygonMesh.h"
+#include "VertexAttrib.h"
+#include "VertexCacheOptimizer.h"
+#include <climits>
+#include <cstdlib>
+#include <exception>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define SGRAPH_MESHCACHE_REALPATH
+#endif
+
+namespace sgraph {
+
+/**
+ * @brief The meshes imported from OBJ files, shared by the whole process.
+ *
+ * Meshes are keyed by the canonical path of their file, so different
+ * spellings of one path share an entry, and are imported again only when
+ * the file's modification time or size changes. A file requested by several
+ * threads at once is imported by the first of them while the others wait
+ * for its result.
+ *
+ * Each OBJ file is compiled into a .mesh file beside it the first time it is
+ * imported (see util::MeshFile). Later runs map that file instead of parsing
+ * the OBJ, for as long as the OBJ keeps the size and modification time the
+ * .mesh file recorded. A .mesh file that cannot be written, for example in a
+ * read-only directory, is simply not used.
+ *
+ * Imported meshes have their triangles and vertices reordered for the GPU's
+ * vertex cache (see util::VertexCacheOptimizer) before they are compiled, so
+ * the work is done once per file rather than once per run.
+ */
+class MeshCache {
+public:
+  typedef util::PolygonMesh<VertexAttrib> Mesh;
+
+  /**
+   * @brief Get the cache shared by every importer.
+   */
+  static MeshCache &getInstance() {
+    static MeshCache cache;
+    return cache;
+  }
+
+  /**
+   * @brief Get the mesh in an OBJ file, loading it unless an up to date copy
+   * is cached.
+   *
+   * Meshes are scaled and centered as they are imported.
+   *
+   * @param path The path of the file.
+   * @return The mesh, or null if the file cannot be opened.
+   * @throws Whatever importing the file throws.
+   */
+  std::shared_ptr<const Mesh> get(const std::string &path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+      return std::shared_ptr<const Mesh>();
+    std::string key = canonicalPath(path);
+
+    std::promise<std::shared_ptr<const Mesh>> promise;
+    std::shared_future<std::shared_ptr<const Mesh>> result;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Entry &entry = entries[key];
+      if (entry.result.valid() && entry.modified == info.st_mtime &&
+          entry.size == info.st_size)
+        result = entry.result;
+      else {
+        entry.modified = info.st_mtime;
+        entry.size = info.st_size;
+        entry.result = promise.get_future().share();
+      }
+    }
+    if (result.valid())
+      return result.get();
+
+    try {
+      std::shared_ptr<const Mesh> mesh(load(path, info));
+      promise.set_value(mesh);
+      return mesh;
+    } catch (...) {
+      // Waiting threads see the error too; a later request tries again
+      promise.set_exception(std::current_exception());
+      forget(key, info);
+      throw;
+    }
+  }
+
+  /**
+   * @brief Get the number of files in the cache.
+   */
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+  }
+
+  /**
+   * @brief Drop every cached mesh. Meshes still in use stay alive until
+   * their last user releases them.
+   */
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+  }
+
+private:
+  /**
+   * @brief A cached file: the state it was imported in and the mesh, which
+   * may still be being imported.
+   */
+  struct Entry {
+    Entry() : modified(0), size(0) {}
+    time_t modified;
+    off_t size;
+    std::shared_future<std::shared_ptr<const Mesh>> result;
+  };
+
+  MeshCache() {}
+  MeshCache(const MeshCache &);
+  MeshCache &operator=(const MeshCache &);
+
+  std::mutex mutex;
+  // Cached files by canonical path, guarded by mutex.
+  std::map<std::string, Entry> entries;
+
+  /**
+   * @brief Remove the entry for a file that failed to import, unless the
+   * file has been requested again in a newer state since.
+   */
+  void forget(const std::string &key, const struct stat &info) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end() && it->second.modified == info.st_mtime &&
+        it->second.size == info.st_size)
+      entries.erase(it);
+  }
+
+  /**
+   * @brief Read a mesh from its compiled file if that is up to date, or else
+   * import and optimize the OBJ file and compile it for next time.
+   */
+  static Mesh *load(const std::string &path, const struct stat &info) {
+    typedef util::MeshFile<VertexAttrib> MeshFile;
+    MeshFile::Source source(info.st_size, info.st_mtime, true);
+    std::string compiled = MeshFile::pathFor(path);
+    std::unique_ptr<Mesh> mesh(new Mesh());
+    if (MeshFile::read(compiled, source, *mesh))
+      return mesh.release();
+    *mesh = util::ObjImporter<VertexAttrib>::importFile(path, true);
+    util::VertexCacheOptimizer::optimize(*mesh);
+    MeshFile::write(compiled, source, *mesh);
+    return mesh.release();
+  }
+
+  static std::string canonicalPath(const std::string &path) {
+#ifdef SGRAPH_MESHCACHE_REALPATH
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved) != NULL)
+      return resolved;
+#endif
+    return path;
+  }
+};
+
+} // namespace sgraph
+
+#endif
@@ -10,6 +10,7 @@
 
 #include "AbstractSGNode.h" // Base class definition for scene graph nodes
 #include <glm/glm.hpp>      // GLM library for matrix operations
+#include <set>              // Standard set container
 #include <string>           // Standard string class
 #include <vector>           // Standard vector container
 
@@ -66,9 +67,12 @@ public:
   /**
    * @brief Retrieve the list of child nodes.
    *
-   * @return A vector of pointers to the child nodes.
+   * The list is returned by reference so that visitors can iterate over it
+   * without copying; it stays valid until children are added or replaced.
+   *
+   * @return A read-only reference to the pointers to the child nodes.
    */
-  vector<SGNode *> getChildren() { return children; }
+  const vector<SGNode *> &getChildren() const { return children; }
 
   /**
    * @brief Retrieve a node by its name.
@@ -103,6 +107,8 @@ public:
   SGNode *clone() {
     // Create a copy of the current node without its children.
     ParentSGNode *newtransform = copyNode();
+    newtransform->nodeLights = nodeLights;
+    newtransform->setAnimTransform(animTransform);
     // Clone each child and add it to the new node.
     for (int i = 0; i < children.size(); i++) {
       newtransform->addChild(children[i]->clone());
@@ -115,7 +121,10 @@ public:
    *
    * @param m The new animation transformation matrix.
    */
-  void setAnimTransform(const glm::mat4 &m) { animTransform = m; }
+  void setAnimTransform(const glm::mat4 &m) {
+    animTransform = m;
+    markDirty();
+  }
 
   /**
    * @brief Retrieves the current animation transformation matrix.
@@ -124,6 +133,45 @@ public:
    */
   glm::mat4 getAnimTransform() const { return animTransform; }
 
+  /**
+   * @brief Marks this node and its subtree as needing new world transforms.
+   *
+   * Stops early at a node that is already dirty, since everything below it
+   * must be dirty too.
+   */
+  void markDirty() {
+    if (worldDirty)
+      return;
+    worldDirty = true;
+    for (size_t i = 0; i < children.size(); i++) {
+      children[i]->markDirty();
+    }
+  }
+
+  /**
+   * @brief Ensures that every node below this one has exactly one parent.
+   *
+   * A node added as a child of several parents would be drawn once per path
+   * to it, but could only cache one world transform (and would be deleted
+   * once per parent). Every occurrence of such a node after the first is
+   * replaced by a deep copy.
+   *
+   * @param visited Nodes already reached from the root; updated as the
+   * subtree is walked.
+   */
+  void unshareChildren(set<SGNode *> &visited) {
+    for (size_t i = 0; i < children.size(); i++) {
+      if (!visited.insert(children[i]).second) {
+        children[i] = children[i]->clone();
+      }
+      children[i]->setParent(this);
+      ParentSGNode *parentChild = dynamic_cast<ParentSGNode *>(children[i]);
+      if (parentChild != NULL) {
+        parentChild->unshareChildren(visited);
+      }
+    }
+  }
+
 protected:
   vector<SGNode *> children; ///< Container for child nodes.
   glm::mat4 animTransform;   ///< Animation transformation matrix for this node.
@@ -137,6 +185,11 @@ protected:
    * @return Pointer to the copied ParentSGNode.
    */
   virtual ParentSGNode *copyNode() = 0;
+
+  /**
+   * @brief The local transform of a parent node is its animation transform.
+   */
+  glm::mat4 getLocalTransform() { return animTransform; }
 };
 } // namespace sgraph
 
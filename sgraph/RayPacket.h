@@ -0,0 +1,335 @@
+#ifndef _RAYPACKET_H_
+#define _RAYPACKET_H_
+
+#include "Rays.h"
+#include <cmath>
+#include <glm/glm.hpp>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SGRAPH_PACKET_SSE
+#endif
+
+namespace sgraph {
+
+/**
+ * @brief Per-lane boolean results of comparing two Float4 values.
+ *
+ * With SSE each lane is all ones or all zeros; the scalar fallback keeps one
+ * bool per lane.
+ */
+class Mask4 {
+public:
+#ifdef SGRAPH_PACKET_SSE
+  Mask4() : m(_mm_setzero_ps()) {}
+  explicit Mask4(__m128 m) : m(m) {}
+
+  /**
+   * @brief Build a mask from the low four bits of an integer.
+   */
+  static Mask4 fromBits(int bits) {
+    return Mask4(_mm_castsi128_ps(_mm_set_epi32(
+        (bits & 8) ? -1 : 0, (bits & 4) ? -1 : 0, (bits & 2) ? -1 : 0,
+        (bits & 1) ? -1 : 0)));
+  }
+
+  /**
+   * @brief Get the mask as bits, lane i in bit i.
+   */
+  int bits() const { return _mm_movemask_ps(m); }
+
+  Mask4 operator&(const Mask4 &o) const { return Mask4(_mm_and_ps(m, o.m)); }
+  Mask4 operator|(const Mask4 &o) const { return Mask4(_mm_or_ps(m, o.m)); }
+
+  /**
+   * @brief Lanes set in this mask but not in another.
+   */
+  Mask4 without(const Mask4 &o) const { return Mask4(_mm_andnot_ps(o.m, m)); }
+
+  __m128 m;
+#else
+  Mask4() { lanes[0] = lanes[1] = lanes[2] = lanes[3] = false; }
+
+  static Mask4 fromBits(int bits) {
+    Mask4 r;
+    for (int i = 0; i < 4; i++)
+      r.lanes[i] = (bits >> i) & 1;
+    return r;
+  }
+
+  int bits() const {
+    return lanes[0] | (lanes[1] << 1) | (lanes[2] << 2) | (lanes[3] << 3);
+  }
+
+  Mask4 operator&(const Mask4 &o) const {
+    Mask4 r;
+    for (int i = 0; i < 4; i++)
+      r.lanes[i] = lanes[i] && o.lanes[i];
+    return r;
+  }
+
+  Mask4 operator|(const Mask4 &o) const {
+    Mask4 r;
+    for (int i = 0; i < 4; i++)
+      r.lanes[i] = lanes[i] || o.lanes[i];
+    return r;
+  }
+
+  Mask4 without(const Mask4 &o) const {
+    Mask4 r;
+    for (int i = 0; i < 4; i++)
+      r.lanes[i] = lanes[i] && !o.lanes[i];
+    return r;
+  }
+
+  bool lanes[4];
+#endif
+};
+
+/**
+ * @brief Four floats operated on together, one per ray of a packet.
+ *
+ * Every operation rounds exactly like the equivalent scalar float code, and
+ * min() and max() return their first operand when the other is NaN, like
+ * std::min and std::max, so a packet computes bit-for-bit the same values
+ * as tracing its rays one at a time.
+ */
+class Float4 {
+public:
+#ifdef SGRAPH_PACKET_SSE
+  Float4() {}
+  explicit Float4(__m128 v) : v(v) {}
+  explicit Float4(float s) : v(_mm_set1_ps(s)) {}
+
+  static Float4 load(const float *p) { return Float4(_mm_load_ps(p)); }
+  void store(float *p) const { _mm_store_ps(p, v); }
+
+  Float4 operator+(const Float4 &o) const { return Float4(_mm_add_ps(v, o.v)); }
+  Float4 operator-(const Float4 &o) const { return Float4(_mm_sub_ps(v, o.v)); }
+  Float4 operator*(const Float4 &o) const { return Float4(_mm_mul_ps(v, o.v)); }
+  Float4 operator/(const Float4 &o) const { return Float4(_mm_div_ps(v, o.v)); }
+  Float4 operator-() const { return Float4(_mm_xor_ps(v, _mm_set1_ps(-0.0f))); }
+
+  Mask4 operator<(const Float4 &o) const { return Mask4(_mm_cmplt_ps(v, o.v)); }
+  Mask4 operator>(const Float4 &o) const { return Mask4(_mm_cmpgt_ps(v, o.v)); }
+  Mask4 operator<=(const Float4 &o) const {
+    return Mask4(_mm_cmple_ps(v, o.v));
+  }
+  Mask4 operator>=(const Float4 &o) const {
+    return Mask4(_mm_cmpge_ps(v, o.v));
+  }
+
+  friend Float4 min(const Float4 &a, const Float4 &b) {
+    return Float4(_mm_min_ps(b.v, a.v));
+  }
+  friend Float4 max(const Float4 &a, const Float4 &b) {
+    return Float4(_mm_max_ps(b.v, a.v));
+  }
+  friend Float4 abs(const Float4 &a) {
+    return Float4(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v));
+  }
+  friend Float4 sqrt(const Float4 &a) { return Float4(_mm_sqrt_ps(a.v)); }
+
+  /**
+   * @brief Pick a where the mask is set and b elsewhere.
+   */
+  friend Float4 select(const Mask4 &mask, const Float4 &a, const Float4 &b) {
+    return Float4(
+        _mm_or_ps(_mm_and_ps(mask.m, a.v), _mm_andnot_ps(mask.m, b.v)));
+  }
+
+  __m128 v;
+#else
+  Float4() {}
+  explicit Float4(float s) { v[0] = v[1] = v[2] = v[3] = s; }
+
+  static Float4 load(const float *p) {
+    Float4 r;
+    for (int i = 0; i < 4; i++)
+      r.v[i] = p[i];
+    return r;
+  }
+  void store(float *p) const {
+    for (int i = 0; i < 4; i++)
+      p[i] = v[i];
+  }
+
+#define SGRAPH_FLOAT4_OP(op, result, expr)                                     \
+  result operator op(const Float4 &o) const {                                  \
+    result r;                                                                  \
+    for (int i = 0; i < 4; i++)                                                \
+      expr;                                                                    \
+    return r;                                                                  \
+  }
+  SGRAPH_FLOAT4_OP(+, Float4, r.v[i] = v[i] + o.v[i])
+  SGRAPH_FLOAT4_OP(-, Float4, r.v[i] = v[i] - o.v[i])
+  SGRAPH_FLOAT4_OP(*, Float4, r.v[i] = v[i] * o.v[i])
+  SGRAPH_FLOAT4_OP(/, Float4, r.v[i] = v[i] / o.v[i])
+  SGRAPH_FLOAT4_OP(<, Mask4, r.lanes[i] = v[i] < o.v[i])
+  SGRAPH_FLOAT4_OP(>, Mask4, r.lanes[i] = v[i] > o.v[i])
+  SGRAPH_FLOAT4_OP(<=, Mask4, r.lanes[i] = v[i] <= o.v[i])
+  SGRAPH_FLOAT4_OP(>=, Mask4, r.lanes[i] = v[i] >= o.v[i])
+#undef SGRAPH_FLOAT4_OP
+
+  Float4 operator-() const {
+    Float4 r;
+    for (int i = 0; i < 4; i++)
+      r.v[i] = -v[i];
+    return r;
+  }
+
+  friend Float4 min(const Float4 &a, const Float4 &b) {
+    Float4 r;
+    for (int i = 0; i < 4; i++)
+      r.v[i] = (b.v[i] < a.v[i]) ? b.v[i] : a.v[i];
+    return r;
+  }
+  friend Float4 max(const Float4 &a, const Float4 &b) {
+    Float4 r;
+    for (int i = 0; i < 4; i++)
+      r.v[i] = (a.v[i] < b.v[i]) ? b.v[i] : a.v[i];
+    return r;
+  }
+  friend Float4 abs(const Float4 &a) {
+    Float4 r;
+    for (int i = 0; i < 4; i++)
+      r.v[i] = std::fabs(a.v[i]);
+    return r;
+  }
+  friend Float4 sqrt(const Float4 &a) {
+    Float4 r;
+    for (int i = 0; i < 4; i++)
+      r.v[i] = std::sqrt(a.v[i]);
+    return r;
+  }
+  friend Float4 select(const Mask4 &mask, const Float4 &a, const Float4 &b) {
+    Float4 r;
+    for (int i = 0; i < 4; i++)
+      r.v[i] = mask.lanes[i] ? a.v[i] : b.v[i];
+    return r;
+  }
+
+  float v[4];
+#endif
+};
+
+/**
+ * @brief Three Float4 values, one vector per ray of a packet.
+ */
+struct Vec3x4 {
+  Float4 x, y, z;
+
+  Vec3x4() {}
+  Vec3x4(const Float4 &x, const Float4 &y, const Float4 &z)
+      : x(x), y(y), z(z) {}
+
+  /**
+   * @brief Component-wise dot product, summed in the same order as glm::dot.
+   */
+  friend Float4 dot(const Vec3x4 &a, const Vec3x4 &b) {
+    return (a.x * b.x + a.y * b.y) + a.z * b.z;
+  }
+
+  /**
+   * @brief Component-wise cross product, evaluated like glm::cross.
+   */
+  friend Vec3x4 cross(const Vec3x4 &a, const Vec3x4 &b) {
+    return Vec3x4(a.y * b.z - b.y * a.z, a.z * b.x - b.z * a.x,
+                  a.x * b.y - b.x * a.y);
+  }
+
+  Float4 &operator[](int i) { return (i == 0) ? x : ((i == 1) ? y : z); }
+  const Float4 &operator[](int i) const {
+    return (i == 0) ? x : ((i == 1) ? y : z);
+  }
+};
+
+/**
+ * @brief The packet version of isCloserHit().
+ *
+ * @param valid Lanes that hit the item at all.
+ * @param t Distance of each lane's hit on the item.
+ * @param tMax Distance of each lane's closest hit so far.
+ * @param index Index of the item.
+ * @param closest Index of each lane's closest item so far, or -1.
+ * @return The lanes whose hit on the item replaces their closest hit.
+ */
+inline int closerLanes(const Mask4 &valid, const Float4 &t, const Float4 &tMax,
+                       int index, const int *closest) {
+  int closer = (valid & (t < tMax)).bits();
+  int tied = (valid & (t <= tMax)).without(t < tMax).bits();
+  for (int lane = 0; tied != 0; lane++, tied >>= 1) {
+    if ((tied & 1) && (closest[lane] < 0 || index < closest[lane]))
+      closer |= 1 << lane;
+  }
+  return closer;
+}
+
+/**
+ * @brief Transform four points or directions by a matrix.
+ *
+ * Evaluates the columns in the same order as glm's mat4 * vec4, so each
+ * lane matches the scalar product exactly.
+ *
+ * @param m The transformation matrix.
+ * @param p The vectors to transform.
+ * @param w 1 for points, 0 for directions.
+ * @return The transformed vectors.
+ */
+inline Vec3x4 transform(const glm::mat4 &m, const Vec3x4 &p, float w) {
+  Float4 pw(w);
+  Vec3x4 r;
+  for (int i = 0; i < 3; i++)
+    r[i] = (Float4(m[0][i]) * p.x + Float4(m[1][i]) * p.y) +
+           (Float4(m[2][i]) * p.z + Float4(m[3][i]) * pw);
+  return r;
+}
+
+/**
+ * @brief Four rays traced together through the scene.
+ *
+ * Rays are stored as structures of arrays so that each component of all
+ * four rays loads into one register. Lanes that do not carry a ray are
+ * excluded by the mask passed alongside the packet rather than by the
+ * packet itself.
+ */
+struct RayPacket {
+  static const int SIZE = 4;
+
+  alignas(16) float origin[3][SIZE];    // Origins, component-major
+  alignas(16) float direction[3][SIZE]; // Directions, component-major
+
+  /**
+   * @brief Store a ray in one lane.
+   */
+  void setRay(int lane, const Ray &ray) {
+    for (int c = 0; c < 3; c++) {
+      origin[c][lane] = ray.origin[c];
+      direction[c][lane] = ray.direction[c];
+    }
+  }
+
+  /**
+   * @brief Get the ray stored in one lane, with its direction unchanged.
+   */
+  Ray getRay(int lane) const {
+    glm::vec3 o(origin[0][lane], origin[1][lane], origin[2][lane]);
+    glm::vec3 d(direction[0][lane], direction[1][lane], direction[2][lane]);
+    Ray ray(o, d);
+    ray.direction = d;
+    return ray;
+  }
+
+  Vec3x4 getOrigins() const {
+    return Vec3x4(Float4::load(origin[0]), Float4::load(origin[1]),
+                  Float4::load(origin[2]));
+  }
+
+  Vec3x4 getDirections() const {
+    return Vec3x4(Float4::load(direction[0]), Float4::load(direction[1]),
+                  Float4::load(direction[2]));
+  }
+};
+
+} // namespace sgraph
+
+#endif
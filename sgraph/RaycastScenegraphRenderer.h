@@ -2,17 +2,27 @@
 #define _RAYCASTSCENEGRAPHRENDERER_H_
 
 // Standard and third-party includes
+#include "BVH.h"
 #include "GroupNode.h"
+#include "ImageSink.h"
 #include "LeafNode.h"
+#include "Light.h"
 #include "Material.h"
+#include "RayPacket.h"
 #include "Rays.h"
 #include "RotateTransform.h"
 #include "SGNodeVisitor.h"
 #include "ScaleTransform.h"
 #include "TransformNode.h"
+#include "TextureCache.h"
 #include "TranslateTransform.h"
+#include "TriangleMesh.h"
+#include "VertexAttrib.h"
 #include <ObjectInstance.h>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <fstream>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
@@ -20,7 +30,9 @@
 #include <iostream>
 #include <limits>
 #include <map>
+#include <mutex>
 #include <stack>
+#include <thread>
 #include <vector>
 
 namespace sgraph {
@@ -30,10 +42,34 @@ namespace sgraph {
  *
  * This class traverses a scene graph and casts rays through each pixel,
  * computes intersections with objects, shades the hit points, and writes
- * the final image as a PPM file.
+ * the final image as a PPM file. Boxes and spheres are intersected as exact
+ * unit shapes; any other instance is intersected as a triangle mesh, once
+ * its meshes have been given with setMeshes().
  */
 class RaycastScenegraphRenderer : public SGNodeVisitor {
 public:
+  /**
+   * @brief Statistics of the last call to render().
+   */
+  struct RenderStats {
+    size_t primitives = 0;             // Primitives compiled from the scene.
+    size_t bvhNodes = 0;               // Nodes of the BVH over them.
+    double buildMs = 0.0;              // Time taken to build the BVH.
+    unsigned long long raysCast = 0;   // Rays intersected with the scene.
+    unsigned long long shadowRays = 0; // Rays tested for occlusion.
+    double traceSeconds = 0.0;         // Time taken to trace the image.
+    bool adaptive = false;             // Whether edges were sampled again.
+    size_t refinedPixels = 0;          // Pixels sampled again on edges.
+    double samplesPerPixel = 0.0;      // Average samples taken per pixel.
+
+    /**
+     * @brief Rays of either kind traced per second.
+     */
+    double raysPerSecond() const {
+      return (raysCast + shadowRays) / std::max(traceSeconds, 1e-9);
+    }
+  };
+
   /**
    * @brief Constructor for the renderer.
    *
@@ -51,56 +87,245 @@ public:
     viewPlaneZ = -1.0f;
   }
 
+  ~RaycastScenegraphRenderer() { stopProgressive(); }
+
+  /**
+   * @brief Render the scene graph and output the resulting image to a file.
+   *
+   * The image format is chosen from the file extension, see
+   * createImageSink().
+   *
+   * @param root Pointer to the root node of the scene graph.
+   * @param outputFile The file name to write the image.
+   * @return False if the file could not be opened, in which case nothing is
+   * rendered.
+   */
+  bool render(SGNode *root, const std::string &outputFile) {
+    std::unique_ptr<ImageSink> sink = createImageSink(outputFile);
+    return render(root, *sink);
+  }
+
   /**
-   * @brief Render the scene graph and output the resulting image to a PPM file.
+   * @brief Render the scene graph and stream the resulting image to a sink.
    *
-   * Traverses the scene graph, casts rays for each pixel, computes shading,
-   * and writes the final image to the specified output file.
+   * Compiles the scene graph into a flat list of world-space primitives, casts
+   * rays for each pixel against that list and computes shading. Rows are
+   * handed to the sink, in order, as soon as every tile covering them has
+   * finished. With adaptive sampling, see setSampling(), every pixel is
+   * sampled first and then the pixels that differ from a neighbour are
+   * sampled again more finely. The timings and ray counts of the render are
+   * kept for getStats().
    *
    * @param root Pointer to the root node of the scene graph.
-   * @param outputFile The file name to write the PPM image.
+   * @param sink The destination of the image.
+   * @return False if the sink could not begin the image, in which case
+   * nothing is rendered.
+   */
+  bool render(SGNode *root, ImageSink &sink) {
+    stopProgressive();
+    if (!sink.begin(imageWidth, imageHeight))
+      return false;
+    // Walk the scene graph once for the whole frame
+    stats = RenderStats();
+    stats.buildMs = beginFrame(root);
+    stats.primitives = primitives.size();
+    stats.bvhNodes = bvh.getNodeCount();
+    std::chrono::steady_clock::time_point traceStart =
+        std::chrono::steady_clock::now();
+    TraceContext traced;
+    passGrid = minSampleGrid;
+    if (maxSampleGrid > minSampleGrid) {
+      traced = renderAdaptive(sink);
+    } else {
+      traced = renderTiles(sink, [this](int x, int y, TraceContext &c) {
+        renderTile(x, y, c);
+      });
+      sampleCounts.assign(imageBuffer.size(),
+                          static_cast<unsigned short>(passGrid * passGrid));
+    }
+    passGrid = 1;
+    stats.traceSeconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - traceStart)
+                             .count();
+    stats.raysCast = traced.raysCast;
+    stats.shadowRays = traced.shadowRays;
+    sink.end();
+    countSamples();
+    if (!heatmapFile.empty())
+      writeHeatmap();
+    return true;
+  }
+
+  /**
+   * @brief Set how many samples each pixel of a render takes.
+   *
+   * Every pixel takes minSamples samples. When maxSamples is larger, pixels
+   * whose first sample hit a different object than a neighbour's, or whose
+   * color differs from a neighbour's by more than the contrast threshold in
+   * any channel, are sampled again with maxSamples samples, which replace
+   * the first ones. Sample counts are rounded up to square numbers, as the
+   * samples of a pixel are spread over a grid of cells with one jittered
+   * sample each. A single sample goes through the pixel center. Progressive
+   * renders ignore this setting.
+   *
+   * @param minSamples Samples taken by every pixel.
+   * @param maxSamples Samples taken by pixels on edges.
+   * @param contrast Largest difference in any color channel between
+   * neighbouring pixels that is not an edge.
    */
-  void render(SGNode *root, const std::string &outputFile) {
-    this->root = root;
-    glm::mat4 viewTransform = modelview.top();
-    glm::mat4 invView = glm::inverse(viewTransform);
-    glm::vec3 eye = glm::vec3(invView * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+  void setSampling(int minSamples, int maxSamples, float contrast = 0.1f) {
+    minSampleGrid = sampleGrid(minSamples);
+    maxSampleGrid = std::max(sampleGrid(maxSamples), minSampleGrid);
+    contrastThreshold = contrast;
+  }
 
-    // Loop over each pixel in the image
+  /**
+   * @brief Write a map of the samples taken by each pixel after each render.
+   *
+   * Pixels are shaded from black, for no samples, to white, for the maximum
+   * set with setSampling().
+   *
+   * @param outputFile The file name to write the map, empty for none. The
+   * format is chosen from the extension, see createImageSink().
+   */
+  void setSampleHeatmap(const std::string &outputFile) {
+    heatmapFile = outputFile;
+  }
+
+  /**
+   * @brief Start rendering the scene graph progressively in the background.
+   *
+   * The scene graph is compiled on the calling thread, which may change it
+   * again as soon as this returns. Worker threads then render the image at
+   * 1/16 of its resolution, doubling the resolution with each pass, and once
+   * at full resolution keep adding jittered samples of every pixel to an
+   * accumulated image until PROGRESSIVE_SAMPLES have been taken. A
+   * progressive render that is already running is stopped first.
+   *
+   * @param root Pointer to the root node of the scene graph.
+   */
+  void startProgressive(SGNode *root) {
+    stopProgressive();
+    beginFrame(root);
+    {
+      std::lock_guard<std::mutex> lock(progressiveMutex);
+      accumulation.assign(imageBuffer.size(), glm::vec3(0.0f));
+      rowSamples.assign(imageHeight, 0);
+      progressiveChanged = true;
+    }
+    progressiveThread =
+        std::thread(&RaycastScenegraphRenderer::renderProgressive, this);
+  }
+
+  /**
+   * @brief Stop a progressive render, waiting for its workers to finish the
+   * tiles they are tracing. The accumulated image is kept.
+   */
+  void stopProgressive() {
+    if (!progressiveThread.joinable())
+      return;
+    cancelRender = true;
+    progressiveThread.join();
+    cancelRender = false;
+    passStride = 1;
+    passSample = 0;
+  }
+
+  /**
+   * @brief Get the image of the progressive render so far.
+   *
+   * @param pixels Set to the linear RGB colors of the image, row by row from
+   * the top, if it changed since the last call. Rows not rendered yet are
+   * black.
+   * @return True if the image changed since the last call.
+   */
+  bool getProgressiveImage(std::vector<glm::vec3> &pixels) {
+    std::lock_guard<std::mutex> lock(progressiveMutex);
+    if (!progressiveChanged)
+      return false;
+    progressiveChanged = false;
+    pixels.resize(accumulation.size());
     for (int j = 0; j < imageHeight; j++) {
-      for (int i = 0; i < imageWidth; i++) {
-        // Convert pixel coordinates to normalized device coordinates (NDC)
-        float ndcX = (2.0f * i) / (imageWidth - 1) - 1.0f;
-        float ndcY = 1.0f - (2.0f * j) / (imageHeight - 1);
-        glm::vec3 pixelPoint(ndcX, ndcY, viewPlaneZ);
-        // Transform pixel to world coordinates
-        glm::vec3 worldPixel = glm::vec3(invView * glm::vec4(pixelPoint, 1.0f));
-        // Compute ray direction from eye to pixel point
-        glm::vec3 rayDir = glm::normalize(worldPixel - eye);
-        currentRay = Ray(eye, rayDir);
-
-        // Reset hit record before casting a new ray
-        currentHit.t = std::numeric_limits<float>::max();
-        currentHit.material = nullptr;
-
-        // Initialize the modelview for this ray
-        modelview.push(glm::mat4(1.0f));
-        // Traverse the scene graph
-        root->accept(this);
-        modelview.pop();
-
-        // Determine the pixel color based on ray hit
-        glm::vec3 pixelColor = backgroundColor;
-        if (currentHit.t < std::numeric_limits<float>::max() &&
-            currentHit.material)
-          pixelColor = shade(currentHit, currentRay, maxBounce);
-        imageBuffer[j * imageWidth + i] = pixelColor;
-      }
+      float scale = (rowSamples[j] > 0) ? 1.0f / rowSamples[j] : 0.0f;
+      for (int i = 0; i < imageWidth; i++)
+        pixels[j * imageWidth + i] = accumulation[j * imageWidth + i] * scale;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Write the image of the progressive render so far to a file.
+   *
+   * @param outputFile The file name to write the image.
+   */
+  void writeProgressiveImage(const std::string &outputFile) {
+    std::vector<glm::vec3> pixels;
+    {
+      std::lock_guard<std::mutex> lock(progressiveMutex);
+      progressiveChanged = true;
+    }
+    getProgressiveImage(pixels);
+    std::unique_ptr<ImageSink> sink = createImageSink(outputFile);
+    if (!sink->begin(imageWidth, imageHeight))
+      return;
+    sink->writeRows(0, imageHeight, &pixels[0]);
+    sink->end();
+  }
+
+  /**
+   * @brief Get the statistics of the last render.
+   */
+  const RenderStats &getStats() const { return stats; }
+
+  /**
+   * @brief Set the number of threads used to render.
+   *
+   * @param count Number of worker threads; 0 uses one per hardware thread.
+   */
+  void setThreadCount(int count) { threadCount = std::max(count, 0); }
+
+  /**
+   * @brief Choose between tracing rays in packets or one at a time.
+   *
+   * Packets trace the primary rays of 2x2 pixel blocks, and the rays they
+   * reflect and refract, four at a time. Both modes produce the same image.
+   *
+   * @param enabled True to trace packets, false to trace single rays.
+   */
+  void setPacketTracing(bool enabled) { packetTracing = enabled; }
+
+  /**
+   * @brief Prepare the meshes that leaves instance for ray intersection.
+   *
+   * Builds one triangle BVH per mesh, which every leaf instancing that mesh
+   * then shares. Instances of "box" and "sphere" are intersected exactly as
+   * unit shapes instead, so their meshes are skipped.
+   *
+   * @param meshes Map of instance names to their meshes.
+   */
+  void setMeshes(
+      const std::map<std::string, util::PolygonMesh<VertexAttrib>> &meshes) {
+    triangleMeshes.clear();
+    meshIndices.clear();
+    for (auto it = meshes.begin(); it != meshes.end(); ++it) {
+      PrimitiveKind kind;
+      if (getShapeKind(it->first, kind))
+        continue;
+      meshIndices[it->first] = static_cast<int>(triangleMeshes.size());
+      triangleMeshes.push_back(TriangleMesh(it->second));
     }
-    // Write the computed image to the output file
-    writePPM(outputFile);
   }
 
+  /**
+   * @brief Set the textures that leaves refer to by name.
+   *
+   * Leaves whose texture is not in the cache are not textured. The cache is
+   * read while rendering, so it must outlive any render using it.
+   *
+   * @param textures The textures, or null for none.
+   */
+  void setTextures(const TextureCache *textures) { textureCache = textures; }
+
   /**
    * @brief Visit a group node in the scene graph.
    *
@@ -109,64 +334,60 @@ public:
    * @param groupNode Pointer to the group node.
    */
   virtual void visitGroupNode(GroupNode *groupNode) {
-    for (size_t i = 0; i < groupNode->getChildren().size(); i++) {
-      groupNode->getChildren()[i]->accept(this);
+    gatherLights(groupNode);
+    const std::vector<SGNode *> &children = groupNode->getChildren();
+    for (size_t i = 0; i < children.size(); i++) {
+      children[i]->accept(this);
     }
   }
 
   /**
    * @brief Visit a leaf node in the scene graph.
    *
-   * Tests for intersections with the object instance contained in the leaf
-   * node.
+   * Records the object instance contained in the leaf node as a world-space
+   * primitive, taking the matrices needed to intersect it from the leaf's
+   * cached world transform.
    *
    * @param leafNode Pointer to the leaf node.
    */
   virtual void visitLeafNode(LeafNode *leafNode) {
+    gatherLights(leafNode);
     std::string instanceName = leafNode->getInstanceOf();
-    // Create a shared pointer for the material
-    std::shared_ptr<util::Material> material =
-        std::make_shared<util::Material>(leafNode->getMaterial());
-    glm::mat4 M = modelview.top();
-    glm::mat4 invM = glm::inverse(M);
-    // Transform the current ray to the local coordinate system
-    Ray localRay = transformRay(currentRay, invM);
-    HitRecord localHit;
-    localHit.t = std::numeric_limits<float>::max();
-    bool hit = false;
-    // Determine the type of object and test for intersection
-    if (instanceName.find("box") != std::string::npos) {
-      hit = intersectBox(localRay, localHit);
-    } else if (instanceName.find("sphere") != std::string::npos) {
-      hit = intersectSphere(localRay, localHit);
-    }
-    // If there is an intersection update the current hit record
-    if (hit && localHit.t < currentHit.t && localHit.t > 0.0f) {
-      glm::vec4 viewPoint = M * glm::vec4(localHit.point, 1.0f);
-      currentHit.point = glm::vec3(viewPoint) / viewPoint.w;
-      glm::mat4 invTrans = glm::transpose(invM);
-      glm::vec4 viewNormal = invTrans * glm::vec4(localHit.normal, 0.0f);
-      currentHit.normal = glm::normalize(glm::vec3(viewNormal));
-      currentHit.t = localHit.t;
-      currentHit.material = material;
+    Primitive primitive;
+    primitive.meshIndex = -1;
+    // Determine the type of object; anything else cannot be ray traced
+    if (!getShapeKind(instanceName, primitive.kind)) {
+      std::map<std::string, int>::const_iterator mesh =
+          meshIndices.find(instanceName);
+      if (mesh == meshIndices.end())
+        return;
+      primitive.kind = PRIMITIVE_MESH;
+      primitive.meshIndex = mesh->second;
     }
+    primitive.model = leafNode->getWorldTransform();
+    primitive.invModel = leafNode->getInverseWorldTransform();
+    primitive.normalMatrix = glm::mat3(glm::transpose(primitive.invModel));
+    primitive.materialIndex = static_cast<int>(materials.size());
+    materials.push_back(leafNode->getMaterial());
+    materialTextures.push_back(
+        textureCache ? textureCache->find(leafNode->getTexture()) : NULL);
+    primitives.push_back(primitive);
   }
 
   /**
    * @brief Visit a transform node in the scene graph.
    *
-   * Pushes the current modelview, applies the transform, visits children,
-   * and then restores the previous modelview.
+   * The transform is already part of the world transforms of the leaves
+   * below it, so this only visits its children.
    *
    * @param transformNode Pointer to the transform node.
    */
   virtual void visitTransformNode(TransformNode *transformNode) {
-    modelview.push(modelview.top());
-    modelview.top() = modelview.top() * transformNode->getTransform();
-    for (size_t i = 0; i < transformNode->getChildren().size(); i++) {
-      transformNode->getChildren()[i]->accept(this);
+    gatherLights(transformNode);
+    const std::vector<SGNode *> &children = transformNode->getChildren();
+    for (size_t i = 0; i < children.size(); i++) {
+      children[i]->accept(this);
     }
-    modelview.pop();
   }
 
   /**
@@ -203,6 +424,66 @@ public:
   }
 
 private:
+  /**
+   * @brief The lights of the current frame in world coordinates.
+   *
+   * Each property is kept in its own array, filled once per frame while
+   * compiling, so shading reads the lights without any per-call setup.
+   */
+  struct LightList {
+    // Position of each point light, or the unit vector towards each
+    // directional light.
+    std::vector<glm::vec3> position;
+    // 1 for point lights, 0 for directional lights.
+    std::vector<float> positional;
+    std::vector<glm::vec3> ambient, diffuse, specular;
+    // Unit vector along which each spotlight points.
+    std::vector<glm::vec3> spotDirection;
+    // Cosine of each spotlight's cutoff angle; -2 for lights that are not
+    // spotlights, so every direction passes.
+    std::vector<float> spotCosCutoff;
+
+    size_t size() const { return position.size(); }
+
+    void clear() {
+      position.clear();
+      positional.clear();
+      ambient.clear();
+      diffuse.clear();
+      specular.clear();
+      spotDirection.clear();
+      spotCosCutoff.clear();
+    }
+
+    /**
+     * @brief Add a light attached to a node with the given world transform.
+     */
+    void add(const util::Light &light, const glm::mat4 &world) {
+      glm::vec4 p = light.getPosition();
+      if (p.w != 0.0f) {
+        position.push_back(glm::vec3(world * p));
+        positional.push_back(1.0f);
+      } else {
+        // A directional light's position is the direction it shines in
+        position.push_back(
+            glm::normalize(-(glm::mat3(world) * glm::vec3(p))));
+        positional.push_back(0.0f);
+      }
+      ambient.push_back(light.getAmbient());
+      diffuse.push_back(light.getDiffuse());
+      specular.push_back(light.getSpecular());
+      float cutoff = light.getSpotCutoff();
+      if (cutoff > 0.0f && cutoff < 180.0f) {
+        spotDirection.push_back(glm::normalize(
+            glm::mat3(world) * glm::vec3(light.getSpotDirection())));
+        spotCosCutoff.push_back(std::cos(glm::radians(cutoff)));
+      } else {
+        spotDirection.push_back(glm::vec3(0.0f));
+        spotCosCutoff.push_back(-2.0f);
+      }
+    }
+  };
+
   // Reference to the current modelview matrix stack.
   std::stack<glm::mat4> &modelview;
   // Map of object instances for rendering.
@@ -215,41 +496,1018 @@ private:
   glm::vec3 backgroundColor;
   // Z-coordinate for the view plane.
   float viewPlaneZ;
-  // Maximum number of bounces for reflection rays.
+  // Maximum number of bounces for reflection and refraction rays.
   int maxBounce = 5;
-  // Pointer to the root of the scene graph.
-  SGNode *root;
-  // Current ray being cast.
-  Ray currentRay = Ray(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
-  // Record of the closest hit.
-  HitRecord currentHit;
+  // World-space primitives compiled from the scene graph for this frame.
+  std::vector<Primitive> primitives;
+  // Material table indexed by Primitive::materialIndex.
+  std::vector<util::Material> materials;
+  // Texture of each material, or null, indexed like materials.
+  std::vector<const Texture *> materialTextures;
+  // Textures that leaves refer to by name, if any.
+  const TextureCache *textureCache = NULL;
+  // Triangle meshes indexed by Primitive::meshIndex, built once per instance.
+  std::vector<TriangleMesh> triangleMeshes;
+  // Index into triangleMeshes of each instance name.
+  std::map<std::string, int> meshIndices;
+  // Lights of the current frame, gathered while compiling.
+  LightList lights;
+  // Bounding volume hierarchy over the world-space bounds of the primitives.
+  BVH bvh;
+  // Statistics of the last render.
+  RenderStats stats;
+  // Number of worker threads, 0 to match the hardware.
+  int threadCount = 0;
+  // Whether primary and reflection rays are traced in packets.
+  bool packetTracing = true;
+  // Inverse of the view transform for the current render.
+  glm::mat4 invView;
+  // Eye position in world coordinates for the current render.
+  glm::vec3 eye;
+
+  // Width of the grid of samples taken per pixel, with and without edges.
+  int minSampleGrid = 1, maxSampleGrid = 1;
+  // Largest color difference between neighbouring pixels that is not an edge.
+  float contrastThreshold = 0.1f;
+  // File to write the sample counts to after each render, if not empty.
+  std::string heatmapFile;
+  // Colors of the first pass of an adaptive render.
+  std::vector<glm::vec3> baseBuffer;
+  // Index of the primitive hit by the first sample of each pixel, or -1,
+  // recorded during the first pass of an adaptive render only. Every
+  // primitive has its own material, so material indices identify them.
+  std::vector<int> primaryHits;
+  // Number of samples taken by each pixel in the last render.
+  std::vector<unsigned short> sampleCounts;
+
+  // Pixel stride of the current pass; each traced pixel colors the block of
+  // pixels below and to the right of it.
+  int passStride = 1;
+  // Sample of each pixel traced by the current pass. Sample 0 goes through
+  // the pixel itself; later samples are jittered within the pixel.
+  int passSample = 0;
+  // Width of the grid of samples each pixel takes in the current pass.
+  int passGrid = 1;
+  // Thread running the passes of a progressive render.
+  std::thread progressiveThread;
+  // Set to make the workers of a render stop before their next tile.
+  std::atomic<bool> cancelRender{false};
+  // Guards the progressive image below.
+  std::mutex progressiveMutex;
+  // Sum of the samples of each pixel of the progressive image.
+  std::vector<glm::vec3> accumulation;
+  // Number of samples summed into each row of the progressive image.
+  std::vector<int> rowSamples;
+  // Whether the progressive image changed since it was last fetched.
+  bool progressiveChanged = false;
+
+  // Width and height of a square tile of pixels handed to a worker.
+  static const int TILE_SIZE = 32;
+  // Pixel stride of the first, coarsest pass of a progressive render.
+  static const int PROGRESSIVE_STRIDE = 16;
+  // Samples per pixel after which a progressive render stops.
+  static const int PROGRESSIVE_SAMPLES = 64;
+  // Most rays of one sample waiting to be traced at once. Each bounce adds
+  // at most one ray to those waiting, so this must be at least maxBounce + 1.
+  static const int PATH_STACK_SIZE = 16;
+  // Weight below which a ray is not traced, half a step of 8-bit output.
+  static constexpr float MIN_PATH_WEIGHT = 1.0f / 512;
+
+  /**
+   * @brief Per-thread state used while tracing.
+   *
+   * Each worker owns one of these, so tracing never writes to state shared
+   * between threads.
+   */
+  struct TraceContext {
+    unsigned long long raysCast = 0;   // Rays intersected with the scene.
+    unsigned long long shadowRays = 0; // Rays tested for occlusion.
+  };
+
+  /**
+   * @brief A ray waiting on a path stack to be traced.
+   */
+  struct PathRay {
+    Ray ray;
+    float weight; // Fraction of the ray's color that reaches the pixel.
+    int bounce;   // Remaining bounce count.
+
+    PathRay() {}
+    PathRay(const Ray &ray, float weight, int bounce)
+        : ray(ray), weight(weight), bounce(bounce) {}
+  };
+
+  /**
+   * @brief A packet of rays waiting on a path stack to be traced.
+   *
+   * Rays stay in the lane of the sample they belong to, so a lane's rays
+   * are traced in the same order as by the single ray path stack.
+   */
+  struct PacketPath {
+    RayPacket packet;
+    int mask;                      // Lanes that carry a ray.
+    float weight[RayPacket::SIZE]; // Weight of the ray in each lane.
+    int bounce;                    // Remaining bounce count.
+  };
+
+  /**
+   * @brief A contiguous range of tiles owned by one worker.
+   *
+   * The owner takes tiles from the front; once its own range is drained a
+   * worker steals from the front of the other workers' ranges.
+   */
+  struct TileQueue {
+    std::atomic<int> next; // Next unclaimed tile.
+    int end;               // One past the last tile of this range.
+  };
+
+  /**
+   * @brief Receives the rows of each progressive pass and adds them to the
+   * progressive image.
+   */
+  class AccumulationSink : public ImageSink {
+  public:
+    AccumulationSink(RaycastScenegraphRenderer &renderer)
+        : renderer(renderer) {}
+
+    bool begin(int, int) { return true; }
+
+    void writeRows(int firstRow, int rowCount, const glm::vec3 *pixels) {
+      std::lock_guard<std::mutex> lock(renderer.progressiveMutex);
+      int width = renderer.imageWidth;
+      int sample = renderer.passSample;
+      for (int j = firstRow; j < firstRow + rowCount; j++) {
+        glm::vec3 *row = &renderer.accumulation[j * width];
+        const glm::vec3 *passRow = &pixels[(j - firstRow) * width];
+        // Coarser passes are replaced rather than averaged in
+        for (int i = 0; i < width; i++)
+          row[i] = (sample == 0) ? passRow[i] : row[i] + passRow[i];
+        renderer.rowSamples[j] = sample + 1;
+      }
+      renderer.progressiveChanged = true;
+    }
+
+    void end() {}
+
+  private:
+    RaycastScenegraphRenderer &renderer;
+  };
+
+  /**
+   * @brief Drops the rows it is given, for passes whose result stays in the
+   * image buffer.
+   */
+  class NullSink : public ImageSink {
+  public:
+    bool begin(int, int) { return true; }
+    void writeRows(int, int, const glm::vec3 *) {}
+    void end() {}
+  };
+
+  /**
+   * @brief Run the passes of a progressive render, until they are done or
+   * the render is cancelled.
+   */
+  void renderProgressive() {
+    AccumulationSink sink(*this);
+    passSample = 0;
+    auto tile = [this](int x, int y, TraceContext &c) { renderTile(x, y, c); };
+    for (passStride = PROGRESSIVE_STRIDE; passStride >= 1 && !cancelRender;
+         passStride /= 2)
+      renderTiles(sink, tile);
+    passStride = 1;
+    for (passSample = 1; passSample < PROGRESSIVE_SAMPLES && !cancelRender;
+         passSample++)
+      renderTiles(sink, tile);
+    passSample = 0;
+  }
+
+  /**
+   * @brief Set up the camera from the top of the modelview stack and compile
+   * the scene graph for a new frame.
+   *
+   * @param root Pointer to the root node of the scene graph.
+   * @return Time taken to build the BVH, in milliseconds.
+   */
+  double beginFrame(SGNode *root) {
+    invView = glm::inverse(modelview.top());
+    eye = glm::vec3(invView * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    return compile(root);
+  }
+
+  /**
+   * @brief Compile the scene graph into the flat primitive list.
+   *
+   * Walks the scene graph once, reading each node's cached world transform,
+   * so that rays can be cast without any further traversal, and then builds
+   * a BVH over the resulting primitives. The lights attached to nodes are
+   * gathered on the same walk.
+   *
+   * @param root Pointer to the root node of the scene graph.
+   * @return Time taken to build the BVH, in milliseconds.
+   */
+  double compile(SGNode *root) {
+    primitives.clear();
+    materials.clear();
+    materialTextures.clear();
+    lights.clear();
+    root->accept(this);
+    if (lights.size() == 0)
+      addDefaultLights();
+
+    std::chrono::steady_clock::time_point buildStart =
+        std::chrono::steady_clock::now();
+    std::vector<AABB> bounds(primitives.size());
+    for (size_t i = 0; i < primitives.size(); i++)
+      bounds[i] = worldBounds(primitives[i]);
+    bvh.build(bounds);
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - buildStart)
+        .count();
+  }
+
+  /**
+   * @brief Add the lights of a node to the frame's light list.
+   *
+   * @param node The node whose lights to add.
+   */
+  void gatherLights(AbstractSGNode *node) {
+    const std::vector<util::Light> &nodeLights = node->getLights();
+    for (size_t i = 0; i < nodeLights.size(); i++)
+      lights.add(nodeLights[i], node->getWorldTransform());
+  }
+
+  /**
+   * @brief Light a scene that has no lights of its own.
+   *
+   * Two white point lights above and in front of the origin. Their ambient
+   * parts add up to 1, so surfaces show their full ambient color.
+   */
+  void addDefaultLights() {
+    const glm::vec3 positions[2] = {glm::vec3(0, 0, 30), glm::vec3(0, 10, 0)};
+    for (int i = 0; i < 2; i++) {
+      util::Light light;
+      light.setAmbient(0.5f, 0.5f, 0.5f);
+      light.setDiffuse(0.5f, 0.5f, 0.5f);
+      light.setSpecular(0.5f, 0.5f, 0.5f);
+      light.setPosition(positions[i].x, positions[i].y, positions[i].z);
+      lights.add(light, glm::mat4(1.0f));
+    }
+  }
+
+  /**
+   * @brief Find whether an instance is one of the unit shapes that are
+   * intersected exactly rather than as a mesh.
+   *
+   * @param instanceName The name of the instance.
+   * @param kind Set to the kind of shape, if it is one.
+   * @return True if the instance is a box or a sphere.
+   */
+  static bool getShapeKind(const std::string &instanceName,
+                           PrimitiveKind &kind) {
+    if (instanceName.find("box") != std::string::npos) {
+      kind = PRIMITIVE_BOX;
+    } else if (instanceName.find("sphere") != std::string::npos) {
+      kind = PRIMITIVE_SPHERE;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Compute the world-space bounding box of a primitive.
+   *
+   * Transforms the corners of the primitive's local bounds by its model
+   * matrix.
+   *
+   * @param primitive The primitive to bound.
+   * @return The world-space bounding box.
+   */
+  AABB worldBounds(const Primitive &primitive) const {
+    AABB local;
+    if (primitive.kind == PRIMITIVE_MESH) {
+      local = triangleMeshes[primitive.meshIndex].getBounds();
+    } else {
+      // The unit box spans [-0.5, 0.5], the unit sphere [-1, 1]
+      float extent = (primitive.kind == PRIMITIVE_BOX) ? 0.5f : 1.0f;
+      local.grow(glm::vec3(-extent));
+      local.grow(glm::vec3(extent));
+    }
+    AABB box;
+    for (int corner = 0; corner < 8; corner++) {
+      glm::vec4 p((corner & 1) ? local.max.x : local.min.x,
+                  (corner & 2) ? local.max.y : local.min.y,
+                  (corner & 4) ? local.max.z : local.min.z, 1.0f);
+      box.grow(glm::vec3(primitive.model * p));
+    }
+    return box;
+  }
+
+  /**
+   * @brief Render every pixel of the image in tiles across worker threads.
+   *
+   * Tiles are split into one contiguous range per worker. Each pixel only
+   * depends on its own ray, so the image is identical to a serial render
+   * regardless of the thread count or the order in which tiles finish.
+   * Whenever a band of tile rows completes, every completed band that is
+   * next in line is streamed to the sink. Once cancelRender is set the
+   * workers stop without claiming further tiles.
+   *
+   * @param sink The destination of the finished rows.
+   * @param renderTileFn Called as renderTileFn(tileX, tileY, context) to
+   * render each tile into the image buffer.
+   * @return The total numbers of rays traced by all workers.
+   */
+  template <class TileFunction>
+  TraceContext renderTiles(ImageSink &sink, TileFunction renderTileFn) {
+    int tilesX = (imageWidth + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (imageHeight + TILE_SIZE - 1) / TILE_SIZE;
+    int tileCount = tilesX * tilesY;
+    int workers = threadCount;
+    if (workers == 0)
+      workers = std::max(1u, std::thread::hardware_concurrency());
+    workers = std::max(1, std::min(workers, tileCount));
+
+    std::vector<TileQueue> queues(workers);
+    for (int w = 0; w < workers; w++) {
+      queues[w].next = tileCount * w / workers;
+      queues[w].end = tileCount * (w + 1) / workers;
+    }
+    std::vector<TraceContext> contexts(workers);
+
+    // Tiles still to finish in each band, and the next band to stream out
+    std::vector<std::atomic<int>> tilesLeft(tilesY);
+    for (int b = 0; b < tilesY; b++)
+      tilesLeft[b] = tilesX;
+    std::mutex sinkMutex;
+    int nextBand = 0;
+    auto flushBands = [&]() {
+      std::lock_guard<std::mutex> lock(sinkMutex);
+      while (nextBand < tilesY && tilesLeft[nextBand] == 0) {
+        int firstRow = nextBand * TILE_SIZE;
+        int rowCount = std::min(firstRow + TILE_SIZE, imageHeight) - firstRow;
+        sink.writeRows(firstRow, rowCount,
+                       &imageBuffer[firstRow * imageWidth]);
+        nextBand++;
+      }
+    };
+
+    auto work = [&](int self) {
+      for (int k = 0; k < workers; k++) {
+        TileQueue &queue = queues[(self + k) % workers];
+        int tile;
+        while (!cancelRender && (tile = queue.next++) < queue.end) {
+          renderTileFn(tile % tilesX, tile / tilesX, contexts[self]);
+          if (--tilesLeft[tile / tilesX] == 0)
+            flushBands();
+        }
+      }
+    };
+    if (workers == 1) {
+      work(0);
+    } else {
+      std::vector<std::thread> threads;
+      for (int w = 1; w < workers; w++)
+        threads.push_back(std::thread(work, w));
+      work(0);
+      for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    }
+
+    TraceContext total;
+    for (int w = 0; w < workers; w++) {
+      total.raysCast += contexts[w].raysCast;
+      total.shadowRays += contexts[w].shadowRays;
+    }
+    return total;
+  }
+
+  /**
+   * @brief Render one tile of the image into the image buffer.
+   *
+   * Only every passStride-th pixel in each direction is traced, and its
+   * color fills the block of pixels up to the next traced one. When
+   * primaryHits is in use, the primitive hit by each traced pixel is
+   * recorded in it.
+   *
+   * @param tileX Column of the tile.
+   * @param tileY Row of the tile.
+   * @param context The calling worker's trace context.
+   */
+  void renderTile(int tileX, int tileY, TraceContext &context) {
+    int xEnd = std::min((tileX + 1) * TILE_SIZE, imageWidth);
+    int yEnd = std::min((tileY + 1) * TILE_SIZE, imageHeight);
+    bool recordHits = !primaryHits.empty();
+    int hitId;
+    if (passGrid > 1) {
+      for (int j = tileY * TILE_SIZE; j < yEnd; j++) {
+        for (int i = tileX * TILE_SIZE; i < xEnd; i++) {
+          imageBuffer[j * imageWidth + i] =
+              samplePixel(i, j, passGrid, context, &hitId);
+          if (recordHits)
+            primaryHits[j * imageWidth + i] = hitId;
+        }
+      }
+      return;
+    }
+    int step = passStride;
+    if (packetTracing) {
+      // Trace 2x2 blocks of pixels together; blocks that hang over the edge
+      // of the image leave the missing lanes out of the mask
+      for (int j = tileY * TILE_SIZE; j < yEnd; j += 2 * step) {
+        for (int i = tileX * TILE_SIZE; i < xEnd; i += 2 * step) {
+          RayPacket packet;
+          int mask = 0;
+          for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+            int x = i + (lane & 1) * step, y = j + (lane >> 1) * step;
+            packet.setRay(lane, primaryRay(std::min(x, xEnd - 1),
+                                           std::min(y, yEnd - 1)));
+            if (x < xEnd && y < yEnd)
+              mask |= 1 << lane;
+          }
+          glm::vec3 colors[RayPacket::SIZE];
+          int hitIds[RayPacket::SIZE];
+          tracePacket(packet, mask, colors, context, hitIds);
+          for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+            if (!(mask & (1 << lane)))
+              continue;
+            int x = i + (lane & 1) * step, y = j + (lane >> 1) * step;
+            fillBlock(x, y, xEnd, yEnd, colors[lane]);
+            if (recordHits)
+              primaryHits[y * imageWidth + x] = hitIds[lane];
+          }
+        }
+      }
+      return;
+    }
+    for (int j = tileY * TILE_SIZE; j < yEnd; j += step) {
+      for (int i = tileX * TILE_SIZE; i < xEnd; i += step) {
+        fillBlock(i, j, xEnd, yEnd, renderPixel(i, j, context, &hitId));
+        if (recordHits)
+          primaryHits[j * imageWidth + i] = hitId;
+      }
+    }
+  }
+
+  /**
+   * @brief Color a traced pixel and the rest of its block in the current
+   * pass, clipped to the tile.
+   */
+  void fillBlock(int i, int j, int xEnd, int yEnd, const glm::vec3 &color) {
+    if (passStride == 1) {
+      imageBuffer[j * imageWidth + i] = color;
+      return;
+    }
+    int blockXEnd = std::min(i + passStride, xEnd);
+    int blockYEnd = std::min(j + passStride, yEnd);
+    for (int y = j; y < blockYEnd; y++) {
+      for (int x = i; x < blockXEnd; x++)
+        imageBuffer[y * imageWidth + x] = color;
+    }
+  }
+
+  /**
+   * @brief Build the primary ray for the current pass's sample of a pixel.
+   *
+   * Sample 0 passes exactly through the pixel; later samples are jittered
+   * within it, see sampleJitter().
+   *
+   * @param i Pixel column.
+   * @param j Pixel row.
+   * @return The ray from the eye through the sample, in world coordinates.
+   */
+  Ray primaryRay(int i, int j) const {
+    glm::vec2 p(i, j);
+    if (passSample > 0)
+      p += sampleJitter(i, j, passSample);
+    return primaryRay(p.x, p.y);
+  }
+
+  /**
+   * @brief Offset of a sample from the center of its pixel.
+   *
+   * The offset is a hash of the pixel and the sample, so it does not depend
+   * on which thread traces the sample.
+   *
+   * @param i Pixel column.
+   * @param j Pixel row.
+   * @param sample Index of the sample.
+   * @return The offset, up to half a pixel in each direction.
+   */
+  static glm::vec2 sampleJitter(int i, int j, int sample) {
+    uint32_t h = static_cast<uint32_t>(i) * 73856093u ^
+                 static_cast<uint32_t>(j) * 19349663u ^
+                 static_cast<uint32_t>(sample) * 83492791u;
+    // Finish mixing the bits like MurmurHash3
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return glm::vec2((h & 0xffff) / 65536.0f - 0.5f,
+                     (h >> 16) / 65536.0f - 0.5f);
+  }
+
+  /**
+   * @brief Build the primary ray through a point of the image.
+   *
+   * @param x Column, in pixels; whole numbers are pixel centers.
+   * @param y Row, in pixels; whole numbers are pixel centers.
+   * @return The ray from the eye through the point, in world coordinates.
+   */
+  Ray primaryRay(float x, float y) const {
+    // Convert pixel coordinates to normalized device coordinates (NDC)
+    float ndcX = (2.0f * x) / (imageWidth - 1) - 1.0f;
+    float ndcY = 1.0f - (2.0f * y) / (imageHeight - 1);
+    glm::vec3 pixelPoint(ndcX, ndcY, viewPlaneZ);
+    // Transform pixel to world coordinates
+    glm::vec3 worldPixel = glm::vec3(invView * glm::vec4(pixelPoint, 1.0f));
+    // Compute ray direction from eye to pixel point
+    glm::vec3 rayDir = glm::normalize(worldPixel - eye);
+    return Ray(eye, rayDir);
+  }
+
+  /**
+   * @brief Cast the primary ray through a pixel and shade it.
+   *
+   * @param i Pixel column.
+   * @param j Pixel row.
+   * @param context The calling worker's trace context.
+   * @param hitId Set to the index of the primitive hit, or -1, if not null.
+   * @return The color of the pixel.
+   */
+  glm::vec3 renderPixel(int i, int j, TraceContext &context,
+                        int *hitId = NULL) const {
+    return traceSample(primaryRay(i, j), context, hitId);
+  }
+
+  /**
+   * @brief Trace a primary ray and shade what it hits.
+   *
+   * The rays reflected and refracted along the way wait on a fixed-size
+   * stack rather than being traced recursively. Each carries the weight
+   * with which its color reaches the pixel, and rays whose weight drops
+   * below MIN_PATH_WEIGHT are never traced.
+   *
+   * @param ray The primary ray.
+   * @param context The calling worker's trace context.
+   * @param hitId Set to the index of the primitive hit, or -1, if not null.
+   * @return The color seen along the ray.
+   */
+  glm::vec3 traceSample(const Ray &ray, TraceContext &context,
+                        int *hitId) const {
+    PathRay stack[PATH_STACK_SIZE];
+    int size = 0;
+    stack[size++] = PathRay(ray, 1.0f, maxBounce);
+    glm::vec3 color(0.0f);
+    while (size > 0) {
+      PathRay path = stack[--size];
+      HitRecord hit;
+      bool isHit = path.bounce > 0 && intersectScene(path.ray, hit, context);
+      // The first ray off the stack is the primary ray
+      if (hitId != NULL) {
+        *hitId = isHit ? hit.materialIndex : -1;
+        hitId = NULL;
+      }
+      if (!isHit) {
+        color += backgroundColor * path.weight;
+        continue;
+      }
+      color += shadeSurface(hit, path.ray, path.weight, context);
+      Ray rays[2];
+      float weights[2];
+      int scattered = scatter(hit, path.ray, path.weight, rays, weights);
+      for (int k = 0; k < 2; k++) {
+        if ((scattered & (1 << k)) && size < PATH_STACK_SIZE)
+          stack[size++] = PathRay(rays[k], weights[k], path.bounce - 1);
+      }
+    }
+    return color;
+  }
+
+  /**
+   * @brief Take a grid of samples over a pixel and average them.
+   *
+   * Each cell of the grid holds one sample at a jittered point, so the
+   * samples are stratified over the pixel. Packet tracing traces the
+   * samples four at a time; either way the result is the same.
+   *
+   * @param i Pixel column.
+   * @param j Pixel row.
+   * @param grid Width of the grid of samples.
+   * @param context The calling worker's trace context.
+   * @param hitId Set to the index of the primitive hit by the first sample,
+   * or -1, if not null.
+   * @return The average color of the samples.
+   */
+  glm::vec3 samplePixel(int i, int j, int grid, TraceContext &context,
+                        int *hitId) const {
+    int count = grid * grid;
+    glm::vec3 sum(0.0f);
+    if (!packetTracing) {
+      for (int s = 0; s < count; s++)
+        sum += traceSample(subpixelRay(i, j, s, grid), context,
+                           (s == 0) ? hitId : NULL);
+      return sum / static_cast<float>(count);
+    }
+    for (int s = 0; s < count; s += RayPacket::SIZE) {
+      RayPacket packet;
+      int mask = 0;
+      for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+        packet.setRay(lane, subpixelRay(i, j, std::min(s + lane, count - 1),
+                                        grid));
+        if (s + lane < count)
+          mask |= 1 << lane;
+      }
+      glm::vec3 colors[RayPacket::SIZE];
+      int hitIds[RayPacket::SIZE];
+      tracePacket(packet, mask, colors, context, hitIds);
+      for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+        if (mask & (1 << lane))
+          sum += colors[lane];
+      }
+      if (s == 0 && hitId != NULL)
+        *hitId = hitIds[0];
+    }
+    return sum / static_cast<float>(count);
+  }
+
+  /**
+   * @brief Build the primary ray of one sample of a grid over a pixel.
+   *
+   * @param i Pixel column.
+   * @param j Pixel row.
+   * @param sample Index of the sample, which is also its cell in row-major
+   * order.
+   * @param grid Width of the grid of samples.
+   * @return The ray through a jittered point of the sample's cell.
+   */
+  Ray subpixelRay(int i, int j, int sample, int grid) const {
+    glm::vec2 jitter = sampleJitter(i, j, sample + 1) + glm::vec2(0.5f);
+    float x = i - 0.5f + (sample % grid + jitter.x) / grid;
+    float y = j - 0.5f + (sample / grid + jitter.y) / grid;
+    return primaryRay(x, y);
+  }
+
+  /**
+   * @brief Render the image in two passes, sampling edges more finely.
+   *
+   * The first pass takes minSampleGrid samples per pixel, keeping the
+   * colors in baseBuffer and the primitives hit in primaryHits. The second
+   * pass resamples the pixels that needsRefinement() picks with
+   * maxSampleGrid samples, and streams the rows to the sink.
+   *
+   * @param sink The destination of the finished rows.
+   * @return The total numbers of rays traced by both passes.
+   */
+  TraceContext renderAdaptive(ImageSink &sink) {
+    NullSink discard;
+    primaryHits.assign(imageBuffer.size(), -1);
+    TraceContext traced =
+        renderTiles(discard, [this](int x, int y, TraceContext &c) {
+          renderTile(x, y, c);
+        });
+    baseBuffer.swap(imageBuffer);
+    imageBuffer.resize(baseBuffer.size());
+    sampleCounts.resize(baseBuffer.size());
+    TraceContext refined =
+        renderTiles(sink, [this](int x, int y, TraceContext &c) {
+          refineTile(x, y, c);
+        });
+    primaryHits.clear();
+    traced.raysCast += refined.raysCast;
+    traced.shadowRays += refined.shadowRays;
+    return traced;
+  }
+
+  /**
+   * @brief Render one tile of the second pass of an adaptive render.
+   *
+   * @param tileX Column of the tile.
+   * @param tileY Row of the tile.
+   * @param context The calling worker's trace context.
+   */
+  void refineTile(int tileX, int tileY, TraceContext &context) {
+    int xEnd = std::min((tileX + 1) * TILE_SIZE, imageWidth);
+    int yEnd = std::min((tileY + 1) * TILE_SIZE, imageHeight);
+    for (int j = tileY * TILE_SIZE; j < yEnd; j++) {
+      for (int i = tileX * TILE_SIZE; i < xEnd; i++) {
+        int p = j * imageWidth + i;
+        int grid = minSampleGrid;
+        if (needsRefinement(i, j)) {
+          grid = maxSampleGrid;
+          imageBuffer[p] = samplePixel(i, j, grid, context, NULL);
+        } else {
+          imageBuffer[p] = baseBuffer[p];
+        }
+        sampleCounts[p] = static_cast<unsigned short>(grid * grid);
+      }
+    }
+  }
+
+  /**
+   * @brief Find whether a pixel of the first pass lies on an edge.
+   *
+   * @param i Pixel column.
+   * @param j Pixel row.
+   * @return True if a horizontal or vertical neighbour hit a different
+   * primitive, or differs in color by more than the contrast threshold.
+   */
+  bool needsRefinement(int i, int j) const {
+    static const int offsets[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    int p = j * imageWidth + i;
+    for (int n = 0; n < 4; n++) {
+      int x = i + offsets[n][0], y = j + offsets[n][1];
+      if (x < 0 || x >= imageWidth || y < 0 || y >= imageHeight)
+        continue;
+      int q = y * imageWidth + x;
+      if (primaryHits[q] != primaryHits[p])
+        return true;
+      glm::vec3 d = glm::abs(baseBuffer[q] - baseBuffer[p]);
+      if (std::max(d.x, std::max(d.y, d.z)) > contrastThreshold)
+        return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Width of the smallest square grid with at least the given
+   * number of cells.
+   */
+  static int sampleGrid(int samples) {
+    int grid = 1;
+    while (grid * grid < samples)
+      grid++;
+    return grid;
+  }
+
+  /**
+   * @brief Record in the statistics how many samples the last render took
+   * and how many pixels it refined.
+   */
+  void countSamples() {
+    unsigned long long samples = 0;
+    size_t refined = 0;
+    unsigned short most =
+        static_cast<unsigned short>(maxSampleGrid * maxSampleGrid);
+    for (size_t p = 0; p < sampleCounts.size(); p++) {
+      samples += sampleCounts[p];
+      if (sampleCounts[p] == most)
+        refined++;
+    }
+    stats.adaptive = maxSampleGrid > minSampleGrid;
+    stats.refinedPixels = stats.adaptive ? refined : 0;
+    stats.samplesPerPixel = static_cast<double>(samples) /
+                            std::max<size_t>(sampleCounts.size(), 1);
+  }
+
+  /**
+   * @brief Write the sample counts of the last render to the heatmap file.
+   */
+  void writeHeatmap() const {
+    std::unique_ptr<ImageSink> sink = createImageSink(heatmapFile);
+    if (!sink->begin(imageWidth, imageHeight))
+      return;
+    float scale = 1.0f / (maxSampleGrid * maxSampleGrid);
+    std::vector<glm::vec3> row(imageWidth);
+    for (int j = 0; j < imageHeight; j++) {
+      for (int i = 0; i < imageWidth; i++)
+        row[i] = glm::vec3(sampleCounts[j * imageWidth + i] * scale);
+      sink->writeRows(j, 1, &row[0]);
+    }
+    sink->end();
+  }
+
+  /**
+   * @brief Find the closest intersection of a world-space ray with the scene.
+   *
+   * @param ray The ray in world coordinates.
+   * @param hit Reference to the hit record to store the closest intersection.
+   * @param context The calling worker's trace context.
+   * @return True if the ray hits any primitive, false otherwise.
+   */
+  bool intersectScene(const Ray &ray, HitRecord &hit,
+                      TraceContext &context) const {
+    context.raysCast++;
+    int closest = -1;
+    int closestTriangle = -1;
+    // Intersect a single primitive in its local coordinate system, keeping
+    // the hit only if it is closer than everything found so far
+    auto intersectPrimitive = [&](int index, float &tMax) {
+      const Primitive &primitive = primitives[index];
+      Ray localRay = transformRay(ray, primitive.invModel);
+      float t = tMax;
+      int triangle = -1;
+      if (primitive.kind == PRIMITIVE_MESH) {
+        triangle = triangleMeshes[primitive.meshIndex].intersect(localRay, t);
+        if (triangle < 0)
+          return false;
+      } else {
+        bool hitPrimitive = (primitive.kind == PRIMITIVE_BOX)
+                                ? intersectBox(localRay, t)
+                                : intersectSphere(localRay, t);
+        if (!hitPrimitive || t <= 0.0f)
+          return false;
+      }
+      if (!isCloserHit(t, index, tMax, closest))
+        return false;
+      tMax = t;
+      closest = index;
+      closestTriangle = triangle;
+      return true;
+    };
+    float tMax = std::numeric_limits<float>::max();
+    hit.t = tMax;
+    if (!bvh.traverse(ray, tMax, intersectPrimitive))
+      return false;
+    getHit(primitives[closest], ray, closestTriangle, hit);
+    return true;
+  }
+
+  /**
+   * @brief Find the closest intersection of each ray of a packet with the
+   * scene.
+   *
+   * The packet is tested against each primitive four rays at a time. Only
+   * the lanes that hit something are then intersected once more with their
+   * closest primitive, one at a time, to fill in their hit records, exactly
+   * like intersectScene() does.
+   *
+   * @param packet The rays in world coordinates.
+   * @param mask Lanes of the packet that carry a ray, lane i in bit i.
+   * @param hits The hit record of each lane, filled in for the lanes hit.
+   * @param context The calling worker's trace context.
+   * @return The lanes whose ray hits any primitive.
+   */
+  int intersectPacket(const RayPacket &packet, int mask, HitRecord *hits,
+                      TraceContext &context) const {
+    for (int lane = 0; lane < RayPacket::SIZE; lane++)
+      context.raysCast += (mask >> lane) & 1;
+    Vec3x4 origin = packet.getOrigins();
+    Vec3x4 dir = packet.getDirections();
+    int closest[RayPacket::SIZE] = {-1, -1, -1, -1};
+    int closestTriangle[RayPacket::SIZE];
+    auto intersectPrimitive = [&](int index, int lanes, Float4 &tMax) {
+      const Primitive &primitive = primitives[index];
+      Vec3x4 localOrigin = transform(primitive.invModel, origin, 1.0f);
+      Vec3x4 localDir = transform(primitive.invModel, dir, 0.0f);
+      Float4 t = tMax;
+      Mask4 hit;
+      int triangles[RayPacket::SIZE];
+      if (primitive.kind == PRIMITIVE_MESH) {
+        const TriangleMesh &mesh = triangleMeshes[primitive.meshIndex];
+        hit = Mask4::fromBits(
+            mesh.intersectPacket(localOrigin, localDir, lanes, t, triangles));
+      } else {
+        hit = (primitive.kind == PRIMITIVE_BOX)
+                  ? intersectBox(localOrigin, localDir, t)
+                  : intersectSphere(localOrigin, localDir, t);
+        hit = (hit & Mask4::fromBits(lanes)).without(t <= Float4(0.0f));
+      }
+      int closer = closerLanes(hit, t, tMax, index, closest);
+      if (closer == 0)
+        return;
+      tMax = select(Mask4::fromBits(closer), t, tMax);
+      for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+        if (closer & (1 << lane)) {
+          closest[lane] = index;
+          if (primitive.kind == PRIMITIVE_MESH)
+            closestTriangle[lane] = triangles[lane];
+        }
+      }
+    };
+    Float4 tMax(std::numeric_limits<float>::max());
+    bvh.traversePacket(packet, mask, tMax, intersectPrimitive);
+
+    int hitMask = 0;
+    for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+      if (closest[lane] < 0)
+        continue;
+      getHit(primitives[closest[lane]], packet.getRay(lane),
+             closestTriangle[lane], hits[lane]);
+      hitMask |= 1 << lane;
+    }
+    return hitMask;
+  }
+
+  /**
+   * @brief Fill in the hit record of a ray known to hit a primitive.
+   *
+   * Only the closest hit of a ray gets here, so the normal and texture
+   * coordinates are computed once per ray rather than for every primitive
+   * tested.
+   *
+   * @param primitive The primitive hit.
+   * @param ray The ray in world coordinates.
+   * @param triangle Index of the triangle hit, for meshes.
+   * @param hit The hit record to fill, in world coordinates.
+   */
+  void getHit(const Primitive &primitive, const Ray &ray, int triangle,
+              HitRecord &hit) const {
+    Ray localRay = transformRay(ray, primitive.invModel);
+    HitRecord localHit;
+    if (primitive.kind == PRIMITIVE_MESH)
+      triangleMeshes[primitive.meshIndex].getHit(triangle, localRay, localHit);
+    else if (primitive.kind == PRIMITIVE_BOX)
+      intersectBox(localRay, localHit);
+    else
+      intersectSphere(localRay, localHit);
+    hit.t = localHit.t;
+    hit.point = glm::vec3(primitive.model * glm::vec4(localHit.point, 1.0f));
+    hit.normal = glm::normalize(primitive.normalMatrix * localHit.normal);
+    hit.texCoords = localHit.texCoords;
+    hit.materialIndex = primitive.materialIndex;
+  }
+
+  /**
+   * @brief Find whether anything in the scene blocks a world-space ray
+   * before a given distance.
+   *
+   * Unlike intersectScene(), this stops at the first primitive found in
+   * the way and computes neither hit points nor normals, which makes it
+   * much cheaper for shadow rays.
+   *
+   * @param ray The ray in world coordinates.
+   * @param maxDistance The distance beyond which nothing blocks the ray,
+   * such as the distance to a light.
+   * @param context The calling worker's trace context.
+   * @return True if some primitive is hit within (0, maxDistance).
+   */
+  bool occluded(const Ray &ray, float maxDistance,
+                TraceContext &context) const {
+    context.shadowRays++;
+    auto blocks = [&](int index) {
+      const Primitive &primitive = primitives[index];
+      Ray localRay = transformRay(ray, primitive.invModel);
+      if (primitive.kind == PRIMITIVE_MESH)
+        return triangleMeshes[primitive.meshIndex].occluded(localRay,
+                                                            maxDistance);
+      float t;
+      bool hitPrimitive = (primitive.kind == PRIMITIVE_BOX)
+                              ? intersectBox(localRay, t)
+                              : intersectSphere(localRay, t);
+      return hitPrimitive && t > 0.0f && t < maxDistance;
+    };
+    return bvh.occluded(ray, maxDistance, blocks);
+  }
 
   /**
    * @brief Transform a ray using a transformation matrix.
    *
-   * Applies the matrix transformation to the ray's origin and direction.
+   * Applies the matrix transformation to the ray's origin and direction. The
+   * direction is left unnormalized so that the ray parameter t is the same in
+   * both coordinate systems, which lets hits on different primitives be
+   * compared directly.
    *
    * @param ray The original ray.
    * @param mat The transformation matrix.
    * @return The transformed ray.
    */
-  Ray transformRay(const Ray &ray, const glm::mat4 &mat) {
-    glm::vec4 newOrigin = mat * glm::vec4(ray.origin, 1.0f);
-    glm::vec4 newDir = mat * glm::vec4(ray.direction, 0.0f);
-    return Ray(glm::vec3(newOrigin) / newOrigin.w,
-               glm::normalize(glm::vec3(newDir)));
+  Ray transformRay(const Ray &ray, const glm::mat4 &mat) const {
+    glm::vec3 newOrigin = glm::vec3(mat * glm::vec4(ray.origin, 1.0f));
+    glm::vec3 newDir = glm::vec3(mat * glm::vec4(ray.direction, 0.0f));
+    Ray localRay(newOrigin, newDir);
+    localRay.direction = newDir;
+    return localRay;
   }
 
   /**
    * @brief Check for intersection between the ray and a sphere.
    *
-   * Assumes a sphere of radius 1 centered at the origin.
+   * Assumes a sphere of radius 1 centered at the origin. Texture
+   * coordinates follow longitude and latitude, like those of the sphere
+   * mesh: u turns once around the y axis starting from +x, and v runs from
+   * 0 at the bottom pole to 1 at the top.
    *
    * @param ray The ray in local coordinates.
    * @param hit Reference to the hit record to store intersection details.
    * @return True if an intersection occurs, false otherwise.
    */
-  bool intersectSphere(const Ray &ray, HitRecord &hit) {
+  bool intersectSphere(const Ray &ray, HitRecord &hit) const {
+    const float pi = 3.14159265358979f;
+    float t;
+    if (!intersectSphere(ray, t))
+      return false;
+    hit.t = t;
+    hit.point = ray.origin + t * ray.direction;
+    hit.normal = glm::normalize(hit.point);
+    float u = std::atan2(-hit.normal.z, hit.normal.x) * (0.5f / pi);
+    float v = std::asin(glm::clamp(hit.normal.y, -1.0f, 1.0f)) / pi + 0.5f;
+    hit.texCoords = glm::vec2((u < 0.0f) ? u + 1.0f : u, v);
+    return true;
+  }
+
+  /**
+   * @brief Find the distance at which the ray hits a sphere.
+   *
+   * Assumes a sphere of radius 1 centered at the origin.
+   *
+   * @param ray The ray in local coordinates.
+   * @param t Set to the distance of the intersection.
+   * @return True if an intersection occurs, false otherwise.
+   */
+  bool intersectSphere(const Ray &ray, float &t) const {
     float radius = 1.0f;
     float A = glm::dot(ray.direction, ray.direction);
     float B = 2.0f * glm::dot(ray.origin, ray.direction);
@@ -260,27 +1518,68 @@ private:
     float sqrtDisc = std::sqrt(disc);
     float t0 = (-B - sqrtDisc) / (2 * A);
     float t1 = (-B + sqrtDisc) / (2 * A);
-    float t = (t0 > 0.0f) ? t0 : t1;
-    if (t < 0.0f)
-      return false;
-    hit.t = t;
-    hit.point = ray.origin + t * ray.direction;
-    hit.normal = glm::normalize(hit.point);
-    return true;
+    t = (t0 > 0.0f) ? t0 : t1;
+    return !(t < 0.0f);
   }
 
   /**
    * @brief Check for intersection between the ray and a box.
    *
    * Assumes an axis-aligned box bounded by [-0.5, 0.5] along each axis.
+   * Each face is mapped to the whole texture, oriented like the faces of
+   * the box mesh.
    *
    * @param ray The ray in local coordinates.
    * @param hit Reference to the hit record to store intersection details.
    * @return True if an intersection occurs, false otherwise.
    */
-  bool intersectBox(const Ray &ray, HitRecord &hit) {
+  bool intersectBox(const Ray &ray, HitRecord &hit) const {
     glm::vec3 minB(-0.5f), maxB(0.5f);
-    float tmin = 0.0f;
+    if (!intersectBox(ray, hit.t))
+      return false;
+    hit.point = ray.origin + hit.t * ray.direction;
+    const float bias = 1e-4f;
+    const glm::vec3 &p = hit.point;
+    // Determine which face of the box was hit based on the offset
+    if (std::fabs(p.x - minB.x) < bias) {
+      hit.normal = glm::vec3(-1, 0, 0);
+      hit.texCoords = glm::vec2(0.5f - p.y, p.z + 0.5f);
+    } else if (std::fabs(p.x - maxB.x) < bias) {
+      hit.normal = glm::vec3(1, 0, 0);
+      hit.texCoords = glm::vec2(0.5f - p.y, 0.5f - p.z);
+    } else if (std::fabs(p.y - minB.y) < bias) {
+      hit.normal = glm::vec3(0, -1, 0);
+      hit.texCoords = glm::vec2(p.z + 0.5f, 0.5f - p.x);
+    } else if (std::fabs(p.y - maxB.y) < bias) {
+      hit.normal = glm::vec3(0, 1, 0);
+      hit.texCoords = glm::vec2(p.z + 0.5f, p.x + 0.5f);
+    } else if (std::fabs(p.z - minB.z) < bias) {
+      hit.normal = glm::vec3(0, 0, -1);
+      hit.texCoords = glm::vec2(p.y + 0.5f, p.x + 0.5f);
+    } else if (std::fabs(p.z - maxB.z) < bias) {
+      hit.normal = glm::vec3(0, 0, 1);
+      hit.texCoords = glm::vec2(0.5f - p.y, p.x + 0.5f);
+    } else {
+      hit.normal = glm::vec3(0, 0, 0);
+      hit.texCoords = glm::vec2(0.0f);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Find the distance at which the ray hits a box.
+   *
+   * Assumes an axis-aligned box bounded by [-0.5, 0.5] along each axis. A
+   * ray that starts inside the box hits the face it leaves through, as a
+   * ray refracted into the box must.
+   *
+   * @param ray The ray in local coordinates.
+   * @param t Set to the distance of the intersection.
+   * @return True if an intersection occurs, false otherwise.
+   */
+  bool intersectBox(const Ray &ray, float &t) const {
+    glm::vec3 minB(-0.5f), maxB(0.5f);
+    float tmin = -std::numeric_limits<float>::max();
     float tmax = std::numeric_limits<float>::max();
     // Iterate over the three dimensions
     for (int i = 0; i < 3; i++) {
@@ -299,90 +1598,235 @@ private:
           return false;
       }
     }
-    hit.t = (tmin >= 0.0f) ? tmin : tmax;
-    if (hit.t < 0.0f)
-      return false;
-    hit.point = ray.origin + hit.t * ray.direction;
-    const float bias = 1e-4f;
-    // Determine which face of the box was hit based on the offset
-    if (std::fabs(hit.point.x - minB.x) < bias)
-      hit.normal = glm::vec3(-1, 0, 0);
-    else if (std::fabs(hit.point.x - maxB.x) < bias)
-      hit.normal = glm::vec3(1, 0, 0);
-    else if (std::fabs(hit.point.y - minB.y) < bias)
-      hit.normal = glm::vec3(0, -1, 0);
-    else if (std::fabs(hit.point.y - maxB.y) < bias)
-      hit.normal = glm::vec3(0, 1, 0);
-    else if (std::fabs(hit.point.z - minB.z) < bias)
-      hit.normal = glm::vec3(0, 0, -1);
-    else if (std::fabs(hit.point.z - maxB.z) < bias)
-      hit.normal = glm::vec3(0, 0, 1);
-    else
-      hit.normal = glm::vec3(0, 0, 0);
-    return true;
+    t = (tmin > 0.0f) ? tmin : tmax;
+    return !(t < 0.0f);
+  }
+
+  /**
+   * @brief Check for intersections between four rays and a sphere.
+   *
+   * Performs the same computation as the single ray version in each lane.
+   *
+   * @param origin The ray origins in local coordinates.
+   * @param dir The ray directions in local coordinates.
+   * @param t Set to the distance of each intersection.
+   * @return The lanes whose ray intersects the sphere.
+   */
+  Mask4 intersectSphere(const Vec3x4 &origin, const Vec3x4 &dir,
+                        Float4 &t) const {
+    Float4 zero(0.0f), two(2.0f);
+    Float4 A = dot(dir, dir);
+    Float4 B = two * dot(origin, dir);
+    Float4 C = dot(origin, origin) - Float4(1.0f);
+    Float4 disc = B * B - Float4(4.0f) * A * C;
+    Float4 sqrtDisc = sqrt(disc);
+    Float4 t0 = (-B - sqrtDisc) / (two * A);
+    Float4 t1 = (-B + sqrtDisc) / (two * A);
+    t = select(t0 > zero, t0, t1);
+    return Mask4::fromBits(0xf).without((disc < zero) | (t < zero));
   }
 
   /**
-   * @brief Compute shading for a hit point by considering lighting and
-   * reflections.
+   * @brief Check for intersections between four rays and a box.
    *
-   * Computes ambient, diffuse, specular components and handles reflection by
-   * recursively tracing a reflection ray.
+   * Performs the same computation as the single ray version in each lane,
+   * with the early exits replaced by a mask of the lanes that have missed.
+   *
+   * @param origin The ray origins in local coordinates.
+   * @param dir The ray directions in local coordinates.
+   * @param t Set to the distance of each intersection.
+   * @return The lanes whose ray intersects the box.
+   */
+  Mask4 intersectBox(const Vec3x4 &origin, const Vec3x4 &dir,
+                     Float4 &t) const {
+    Float4 minB(-0.5f), maxB(0.5f);
+    Float4 tmin(-std::numeric_limits<float>::max());
+    Float4 tmax(std::numeric_limits<float>::max());
+    Mask4 miss;
+    for (int i = 0; i < 3; i++) {
+      Mask4 parallel = abs(dir[i]) < Float4(1e-6f);
+      miss = miss | (parallel & ((origin[i] < minB) | (origin[i] > maxB)));
+      Float4 invD = Float4(1.0f) / dir[i];
+      Float4 t1 = (minB - origin[i]) * invD;
+      Float4 t2 = (maxB - origin[i]) * invD;
+      Mask4 swap = t1 > t2;
+      Float4 tNear = select(swap, t2, t1);
+      Float4 tFar = select(swap, t1, t2);
+      tmin = select(parallel, tmin, max(tmin, tNear));
+      tmax = select(parallel, tmax, min(tmax, tFar));
+      miss = miss | (tmax < tmin).without(parallel);
+    }
+    t = select(tmin > Float4(0.0f), tmin, tmax);
+    return Mask4::fromBits(0xf).without(miss | (t < Float4(0.0f)));
+  }
+
+  /**
+   * @brief Compute the light reflected directly from the light sources at a
+   * hit point.
+   *
+   * Every light adds its ambient part. Its diffuse and specular parts only
+   * reach points that face it, lie inside its cone if it is a spotlight, and
+   * have nothing in the scene between them and the light. The color is
+   * modulated by the texture of the surface, if any, like the OpenGL view
+   * does, and scaled by the material's absorption.
    *
    * @param hit The hit record containing intersection details.
    * @param ray The incoming ray.
-   * @param bounce Remaining bounce count for reflections.
-   * @return The computed color for the hit point.
+   * @param weight Weight of the incoming ray.
+   * @param context The calling worker's trace context.
+   * @return The weighted ambient, diffuse and specular color at the hit
+   * point.
    */
-  glm::vec3 shade(const HitRecord &hit, const Ray &ray, int bounce) {
+  glm::vec3 shadeSurface(const HitRecord &hit, const Ray &ray, float weight,
+                         TraceContext &context) const {
     const float epsilon = 1e-3f;
-    glm::vec3 ambient = glm::vec3(hit.material->getAmbient());
-    glm::vec3 color = ambient;
-
-    // Define light positions and intensities
-    std::vector<glm::vec3> lightPositions = {glm::vec3(0, 0, 30),
-                                             glm::vec3(0, 10, 0)};
-    std::vector<glm::vec3> lightIntensities = {glm::vec3(0.5f),
-                                               glm::vec3(0.5f)};
-
-    // Process each light source for diffuse and specular lighting
-    for (size_t i = 0; i < lightPositions.size(); i++) {
-      glm::vec3 L = glm::normalize(lightPositions[i] - hit.point);
-      // Offset the shadow ray start to prevent self-intersection
-      Ray shadowRay(hit.point + epsilon * hit.normal, L);
-      HitRecord shadowHit;
-      shadowHit.t = std::numeric_limits<float>::max();
-
-      // Determine if the point is in shadow with respect to the current light
-      bool inShadow = ((intersectBox(shadowRay, shadowHit) ||
-                        intersectSphere(shadowRay, shadowHit)) &&
-                       shadowHit.t > epsilon);
-
-      if (!inShadow) {
-        float diff = std::max(glm::dot(hit.normal, L), 0.0f);
-        glm::vec3 diffuse = HadamardProduct(
-            glm::vec3(hit.material->getDiffuse()) * diff, lightIntensities[i]);
-        glm::vec3 R = glm::reflect(-L, hit.normal);
-        glm::vec3 V = glm::normalize(ray.origin - hit.point);
-        float specAngle = std::max(glm::dot(V, R), 0.0f);
-        float spec = std::pow(specAngle, hit.material->getShininess());
-        glm::vec3 specular = HadamardProduct(
-            glm::vec3(hit.material->getSpecular()) * spec, lightIntensities[i]);
-        color += diffuse + specular;
+    const util::Material &material = materials[hit.materialIndex];
+    // Surfaces that only reflect and refract need no shadow rays
+    float surfaceWeight = weight * material.getAbsorption();
+    if (!(surfaceWeight > 0.0f))
+      return glm::vec3(0.0f);
+    glm::vec3 materialAmbient = glm::vec3(material.getAmbient());
+    glm::vec3 materialDiffuse = glm::vec3(material.getDiffuse());
+    glm::vec3 materialSpecular = glm::vec3(material.getSpecular());
+    glm::vec3 V = glm::normalize(ray.origin - hit.point);
+    // Offset the shadow ray start to prevent self-intersection
+    glm::vec3 shadowOrigin = hit.point + epsilon * hit.normal;
+    glm::vec3 color(0.0f);
+
+    for (size_t i = 0; i < lights.size(); i++) {
+      color += HadamardProduct(materialAmbient, lights.ambient[i]);
+      glm::vec3 L;
+      float lightDistance;
+      if (lights.positional[i] != 0.0f) {
+        L = glm::normalize(lights.position[i] - hit.point);
+        lightDistance = glm::length(lights.position[i] - shadowOrigin);
+      } else {
+        L = lights.position[i];
+        lightDistance = std::numeric_limits<float>::max();
       }
+      // Surfaces facing away from the light, or outside a spotlight's cone,
+      // get no direct light and need no shadow ray
+      float nDotL = glm::dot(hit.normal, L);
+      if (nDotL <= 0.0f ||
+          glm::dot(-L, lights.spotDirection[i]) < lights.spotCosCutoff[i])
+        continue;
+      if (occluded(Ray(shadowOrigin, L), lightDistance, context))
+        continue;
+
+      glm::vec3 diffuse =
+          HadamardProduct(materialDiffuse * nDotL, lights.diffuse[i]);
+      glm::vec3 R = glm::reflect(-L, hit.normal);
+      float specAngle = std::max(glm::dot(V, R), 0.0f);
+      float spec = std::pow(specAngle, material.getShininess());
+      glm::vec3 specular =
+          HadamardProduct(materialSpecular * spec, lights.specular[i]);
+      color += diffuse + specular;
     }
+    const Texture *texture = materialTextures[hit.materialIndex];
+    if (texture != NULL)
+      color = HadamardProduct(color, texture->sample(hit.texCoords));
+    return color * surfaceWeight;
+  }
 
-    // Handle reflections if applicable
-    glm::vec3 reflectionColor(0.0f);
-    if (bounce > 0 && hit.material->getReflection() > 0.0f) {
-      const float epsilonReflection = 1e-2f; // increased offset for reflection
-      glm::vec3 reflectDir = glm::reflect(ray.direction, hit.normal);
-      Ray reflectionRay(hit.point + epsilonReflection * hit.normal, reflectDir);
-      reflectionColor = traceRay(reflectionRay, bounce - 1);
+  /**
+   * @brief Find the rays that continue a path from a hit.
+   *
+   * The material's reflection coefficient is carried on by a reflected ray
+   * and its transparency by a refracted ray, except for the fraction of the
+   * transparent part that the Fresnel term reflects instead. Rays whose
+   * weight would fall below MIN_PATH_WEIGHT are dropped.
+   *
+   * @param hit The hit record containing intersection details.
+   * @param ray The incoming ray.
+   * @param weight Weight of the incoming ray.
+   * @param rays Set to the reflected ray in the first element and the
+   * refracted ray in the second, where they continue.
+   * @param weights Set to the weights of the continuing rays, likewise.
+   * @return Bit 0 set if the reflected ray continues, bit 1 set if the
+   * refracted ray does.
+   */
+  int scatter(const HitRecord &hit, const Ray &ray, float weight, Ray *rays,
+              float *weights) const {
+    const util::Material &material = materials[hit.materialIndex];
+    float reflection = material.getReflection();
+    float transmission = material.getTransparency();
+    if (transmission > 0.0f) {
+      float fresnel = refractionRay(hit, ray, material.getRefractiveIndex(),
+                                    rays[1]);
+      reflection += transmission * fresnel;
+      transmission *= 1.0f - fresnel;
+    }
+    int scattered = 0;
+    weights[0] = weight * reflection;
+    if (weights[0] >= MIN_PATH_WEIGHT) {
+      rays[0] = reflectionRay(hit, ray);
+      scattered |= 1;
     }
+    weights[1] = weight * transmission;
+    if (weights[1] >= MIN_PATH_WEIGHT)
+      scattered |= 2;
+    return scattered;
+  }
 
-    return color * hit.material->getAbsorption() +
-           reflectionColor * hit.material->getReflection();
+  /**
+   * @brief Build the ray reflected about the normal at a hit point.
+   *
+   * @param hit The hit record containing intersection details.
+   * @param ray The incoming ray.
+   * @return The reflected ray, offset from the surface.
+   */
+  Ray reflectionRay(const HitRecord &hit, const Ray &ray) const {
+    const float epsilonReflection = 1e-2f; // increased offset for reflection
+    glm::vec3 reflectDir = glm::reflect(ray.direction, hit.normal);
+    // Rays hitting the back of a surface, such as from inside a transparent
+    // object, reflect back to the side they came from
+    glm::vec3 normal =
+        (glm::dot(ray.direction, hit.normal) > 0.0f) ? -hit.normal : hit.normal;
+    return Ray(hit.point + epsilonReflection * normal, reflectDir);
+  }
+
+  /**
+   * @brief Build the ray refracted through a transparent surface.
+   *
+   * The surface separates its material from empty space on the side its
+   * normal points to, so rays entering bend towards the normal and rays
+   * leaving through the back bend away from it.
+   *
+   * @param hit The hit record containing intersection details.
+   * @param ray The incoming ray.
+   * @param refractiveIndex Refractive index of the material.
+   * @param refracted Set to the refracted ray, offset through the surface,
+   * unless all the light is reflected.
+   * @return The fraction of the light that is reflected rather than
+   * refracted, from Schlick's approximation of the Fresnel equations, or 1
+   * on total internal reflection.
+   */
+  float refractionRay(const HitRecord &hit, const Ray &ray,
+                      float refractiveIndex, Ray &refracted) const {
+    const float epsilonRefraction = 1e-2f;
+    // Materials without a valid index let light through unbent
+    float index = (refractiveIndex > 0.0f) ? refractiveIndex : 1.0f;
+    glm::vec3 normal = hit.normal;
+    float cosIncident = -glm::dot(ray.direction, normal);
+    float eta = 1.0f / index;
+    if (cosIncident < 0.0f) {
+      normal = -normal;
+      cosIncident = -cosIncident;
+      eta = index;
+    }
+    float sin2Refracted = eta * eta * (1.0f - cosIncident * cosIncident);
+    if (sin2Refracted >= 1.0f)
+      return 1.0f;
+    float cosRefracted = std::sqrt(1.0f - sin2Refracted);
+    // Schlick's approximation takes the angle on the less dense side
+    float r0 = (index - 1.0f) / (index + 1.0f);
+    r0 *= r0;
+    float c = 1.0f - ((eta > 1.0f) ? cosRefracted : cosIncident);
+    float fresnel = r0 + (1.0f - r0) * (c * c) * (c * c) * c;
+    glm::vec3 refractDir =
+        eta * ray.direction + (eta * cosIncident - cosRefracted) * normal;
+    refracted = Ray(hit.point - epsilonRefraction * normal, refractDir);
+    return fresnel;
   }
 
   /**
@@ -393,59 +1837,87 @@ private:
    * @param b The second vector.
    * @return The resulting vector after element-wise multiplication.
    */
-  inline glm::vec3 HadamardProduct(const glm::vec3 &a, const glm::vec3 &b) {
+  inline glm::vec3 HadamardProduct(const glm::vec3 &a,
+                                  const glm::vec3 &b) const {
     return glm::vec3(a.x * b.x, a.y * b.y, a.z * b.z);
   }
 
   /**
-   * @brief Recursively trace a ray for reflections.
+   * @brief Trace a packet of primary rays and shade what they hit.
    *
-   * Traces the ray through the scene graph and computes the color contribution.
+   * The packet equivalent of traceSample(). Each lane is shaded on its own,
+   * then the lanes that reflect continue together as a packet of reflected
+   * rays, and the lanes that refract as a packet of refracted rays, with
+   * the other lanes masked off. The packets wait on a fixed-size stack in
+   * the same order as the rays of traceSample(), so each lane computes
+   * exactly the same color.
    *
-   * @param ray The ray to trace.
-   * @param bounce Remaining bounce count.
-   * @return The computed color from the traced ray.
+   * @param packet The rays to trace.
+   * @param mask Lanes of the packet that carry a ray, lane i in bit i.
+   * @param colors Set to the color traced by each lane in the mask.
+   * @param context The calling worker's trace context.
+   * @param hitIds Set to the index of the primitive hit by each lane, or
+   * -1, if not null.
    */
-  glm::vec3 traceRay(const Ray &ray, int bounce) {
-    if (bounce <= 0)
-      return backgroundColor;
-    currentHit.t = std::numeric_limits<float>::max();
-    currentHit.material = nullptr;
-    modelview.push(glm::mat4(1.0f));
-    root->accept(this);
-    modelview.pop();
-    if (currentHit.t < std::numeric_limits<float>::max() && currentHit.material)
-      return shade(currentHit, ray, bounce);
-    return backgroundColor;
-  }
-
-  /**
-   * @brief Write the image buffer to a PPM file.
-   *
-   * Outputs the final image computed from the raycasting process to a PPM file.
-   *
-   * @param filename The name of the output file.
-   */
-  void writePPM(const std::string &filename) {
-    std::ofstream ofs(filename);
-    if (!ofs) {
-      std::cerr << "Cannot open file: " << filename << std::endl;
-      return;
+  void tracePacket(const RayPacket &packet, int mask, glm::vec3 *colors,
+                   TraceContext &context, int *hitIds = NULL) const {
+    PacketPath stack[PATH_STACK_SIZE];
+    int size = 0;
+    PacketPath &primary = stack[size++];
+    primary.packet = packet;
+    primary.mask = mask;
+    primary.bounce = maxBounce;
+    for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+      primary.weight[lane] = 1.0f;
+      colors[lane] = glm::vec3(0.0f);
     }
-    ofs << "P3\n" << imageWidth << " " << imageHeight << "\n255\n";
-    // Write each pixel's RGB values to the file in PPM format
-    for (int j = 0; j < imageHeight; j++) {
-      for (int i = 0; i < imageWidth; i++) {
-        glm::vec3 color = imageBuffer[j * imageWidth + i];
-        int r = static_cast<int>(255 * std::min(std::max(color.r, 0.0f), 1.0f));
-        int g = static_cast<int>(255 * std::min(std::max(color.g, 0.0f), 1.0f));
-        int b = static_cast<int>(255 * std::min(std::max(color.b, 0.0f), 1.0f));
-        ofs << r << " " << g << " " << b << "  ";
+    while (size > 0) {
+      PacketPath path = stack[--size];
+      HitRecord hits[RayPacket::SIZE];
+      int hitMask = (path.bounce > 0)
+                        ? intersectPacket(path.packet, path.mask, hits, context)
+                        : 0;
+      if (hitIds != NULL) {
+        for (int lane = 0; lane < RayPacket::SIZE; lane++)
+          hitIds[lane] =
+              (hitMask & (1 << lane)) ? hits[lane].materialIndex : -1;
+        hitIds = NULL;
+      }
+
+      // Lanes that do not continue keep their old ray, masked off
+      PacketPath next[2];
+      for (int k = 0; k < 2; k++) {
+        next[k].packet = path.packet;
+        next[k].mask = 0;
+        next[k].bounce = path.bounce - 1;
+      }
+      for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+        if (!(path.mask & (1 << lane)))
+          continue;
+        if (!(hitMask & (1 << lane))) {
+          colors[lane] += backgroundColor * path.weight[lane];
+          continue;
+        }
+        Ray ray = path.packet.getRay(lane);
+        colors[lane] +=
+            shadeSurface(hits[lane], ray, path.weight[lane], context);
+        Ray rays[2];
+        float weights[2];
+        int scattered =
+            scatter(hits[lane], ray, path.weight[lane], rays, weights);
+        for (int k = 0; k < 2; k++) {
+          if (!(scattered & (1 << k)))
+            continue;
+          next[k].packet.setRay(lane, rays[k]);
+          next[k].weight[lane] = weights[k];
+          next[k].mask |= 1 << lane;
+        }
+      }
+      for (int k = 0; k < 2; k++) {
+        if (next[k].mask != 0 && size < PATH_STACK_SIZE)
+          stack[size++] = next[k];
       }
-      ofs << "\n";
     }
-    ofs.close();
-    std::cout << "PPM image written to " << filename << std::endl;
   }
 };
 
@@ -1,35 +1,52 @@
 #ifndef RAYS_H
 #define RAYS_H
 
-#include <Material.h>
 #include <glm/glm.hpp>
-#include <memory>
-
-// Textures are unimplemented for this project
-class Texture;
 
 // Represents a 3D ray with an origin and a direction
 struct Ray {
   glm::vec3 origin;
   glm::vec3 direction;
 
+  Ray() {}
   Ray(const glm::vec3 &origin, const glm::vec3 &direction)
       : origin(origin), direction(glm::normalize(direction)) {}
 };
 
 // Stores information about a ray-object intersection
 struct HitRecord {
-  float t;          // Ray parameter t at intersection
-  glm::vec3 point;  // Intersection point in view coordinates
-  glm::vec3 normal; // Normal at the intersection point
-  std::shared_ptr<util::Material>
-      material;        // Material properties of the intersected object
+  float t;             // Ray parameter t at intersection
+  glm::vec3 point;     // Intersection point in view coordinates
+  glm::vec3 normal;    // Normal at the intersection point
+  int materialIndex;   // Index into the renderer's material table, or -1
   glm::vec2 texCoords; // Texture coordinates
-  std::shared_ptr<Texture> texture; // Pointer to texture, if applicable
 
   HitRecord()
       : t(0.0f), point(glm::vec3(0.0f)), normal(glm::vec3(0.0f)),
-        texCoords(glm::vec2(0.0f)) {}
+        materialIndex(-1), texCoords(glm::vec2(0.0f)) {}
+};
+
+// Whether a hit at distance t on the item with the given index should replace
+// the closest hit so far, at distance tMax on item closest (-1 for none).
+// Equal distances go to the lower index, so the closest hit does not depend
+// on the order in which items are tested.
+inline bool isCloserHit(float t, int index, float tMax, int closest) {
+  return t < tMax || (t == tMax && (closest < 0 || index < closest));
+}
+
+// Kinds of leaf geometry the ray caster can intersect
+enum PrimitiveKind { PRIMITIVE_BOX, PRIMITIVE_SPHERE, PRIMITIVE_MESH };
+
+// A scene graph leaf flattened into world space. The scene graph is compiled
+// into a contiguous array of these once per frame, so rays never walk the
+// graph or invert matrices themselves.
+struct Primitive {
+  PrimitiveKind kind;     // Which unit shape this leaf instances
+  glm::mat4 model;        // Object-to-world transform
+  glm::mat4 invModel;     // World-to-object transform
+  glm::mat3 normalMatrix; // Inverse transpose of the model transform
+  int materialIndex;      // Index into the renderer's material table
+  int meshIndex;          // Index into the renderer's meshes, for meshes
 };
 
 #endif
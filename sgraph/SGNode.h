@@ -43,6 +43,27 @@ public:
    */
   virtual void setParent(SGNode *parent) = 0;
 
+  /**
+   * Get the transform from this node's coordinate system to that of the root
+   * of the scene graph. It is cached, and only recomputed after this node or
+   * one of its ancestors has changed
+   * \return the world transform of this node
+   */
+  virtual const glm::mat4 &getWorldTransform() = 0;
+
+  /**
+   * Get the inverse of the world transform of this node. It is cached along
+   * with the world transform
+   * \return the inverse world transform of this node
+   */
+  virtual const glm::mat4 &getInverseWorldTransform() = 0;
+
+  /**
+   * Mark the cached world transform of this node, and of every node below it,
+   * as out of date
+   */
+  virtual void markDirty() = 0;
+
   /**
    * Traverse the scene graph rooted at this node, and store references to the
    * scenegraph object
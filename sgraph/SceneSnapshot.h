@@ -0,0 +1,572 @@
+#ifndef _SCENESNAPSHOT_H_
+#define _SCENESNAPSHOT_H_
+
+#include "GroupNode.h"
+#include "IScenegraph.h"
+#include "LeafNode.h"
+#include "Light.h"
+#include "MappedFile.h"
+#include "Material.h"
+#include "RotateTransform.h"
+#include "SGNodeVisitor.h"
+#include "ScaleTransform.h"
+#include "TransformNode.h"
+#include "TranslateTransform.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace sgraph {
+
+/**
+ * @brief A binary snapshot of a whole scene graph, which loads without
+ * parsing any text.
+ *
+ * The file is a header followed by flat arrays of fixed size records: the
+ * nodes in depth-first order, each with the index of its parent, then the
+ * lights, materials and animation transforms the nodes refer to, the mesh
+ * and image declarations, and finally every name and path, which the other
+ * records refer to by index. Loading maps the file and builds each node
+ * straight from its record, attaching it to its already built parent by
+ * index, so nothing is looked up by name. Meshes and images are stored as
+ * paths and loaded as for a text scene file. Records are in the byte order
+ * of the machine that wrote them; a file from another byte order or version
+ * is rejected.
+ */
+class SceneSnapshot {
+public:
+  static const uint32_t VERSION = 1;
+
+  /**
+   * @brief Check whether a file is a scene snapshot rather than a text
+   * scene file.
+   *
+   * @param filename The file to check.
+   * @return True if the file starts with the snapshot signature.
+   */
+  static bool isSnapshot(const string &filename) {
+    ifstream in(filename.c_str(), ios::binary);
+    char magic[sizeof(Header().magic)];
+    return in.read(magic, sizeof(magic)) &&
+           memcmp(magic, signature(), sizeof(magic)) == 0;
+  }
+
+  /**
+   * @brief Save a scene graph, with its mesh and image declarations.
+   *
+   * @param scenegraph The scene graph to save.
+   * @param filename The file to write.
+   * @throws runtime_error If the scene graph has no root, contains a node
+   * that cannot be saved, or the file cannot be written.
+   */
+  static void write(IScenegraph *scenegraph, const string &filename) {
+    if (scenegraph->getRoot() == NULL)
+      throw runtime_error("Cannot save a scene graph without a root");
+    Writer writer;
+    scenegraph->getRoot()->accept(&writer);
+    map<string, string> meshPaths = scenegraph->getMeshPaths();
+    for (auto it = meshPaths.begin(); it != meshPaths.end(); ++it)
+      writer.meshes.push_back(writer.declare(it->first, it->second));
+    map<string, string> texturePaths = scenegraph->getTexturePaths();
+    for (auto it = texturePaths.begin(); it != texturePaths.end(); ++it)
+      writer.textures.push_back(writer.declare(it->first, it->second));
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, signature(), sizeof(header.magic));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.nodeCount = static_cast<uint32_t>(writer.nodes.size());
+    header.lightCount = static_cast<uint32_t>(writer.lights.size());
+    header.materialCount = static_cast<uint32_t>(writer.materials.size());
+    header.animationCount = static_cast<uint32_t>(writer.animations.size());
+    header.meshCount = static_cast<uint32_t>(writer.meshes.size());
+    header.textureCount = static_cast<uint32_t>(writer.textures.size());
+    header.stringCount = static_cast<uint32_t>(writer.strings.size());
+    header.stringBytes = static_cast<uint32_t>(writer.text.size());
+
+    ofstream out(filename.c_str(), ios::binary | ios::trunc);
+    if (!out.is_open())
+      throw runtime_error("Cannot open file: " + filename);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writeArray(out, writer.nodes);
+    writeArray(out, writer.lights);
+    writeArray(out, writer.materials);
+    writeArray(out, writer.animations);
+    writeArray(out, writer.meshes);
+    writeArray(out, writer.textures);
+    writeArray(out, writer.strings);
+    writeArray(out, writer.text);
+    out.close();
+    if (out.fail())
+      throw runtime_error("Cannot write file: " + filename);
+  }
+
+  /**
+   * @brief Load the nodes of a snapshot and its mesh and image declarations.
+   *
+   * @param filename The snapshot file.
+   * @param meshPaths Receives the path of each mesh, by name.
+   * @param texturePaths Receives the path of each image, by texture name.
+   * @return The root of the scene graph, which the caller owns.
+   * @throws runtime_error If the file cannot be read, is of another version
+   * or is damaged.
+   */
+  static SGNode *read(const string &filename, map<string, string> &meshPaths,
+                      map<string, string> &texturePaths) {
+    util::MappedFile file(filename);
+    if (!file.isOpen())
+      throw runtime_error("Cannot open file: " + filename);
+    Header header;
+    if (file.getSize() < sizeof(header))
+      throw runtime_error("Not a scene snapshot: " + filename);
+    memcpy(&header, file.getData(), sizeof(header));
+    if (memcmp(header.magic, signature(), sizeof(header.magic)) != 0)
+      throw runtime_error("Not a scene snapshot: " + filename);
+    if (header.version != VERSION || header.byteOrder != BYTE_ORDER_MARK)
+      throw runtime_error("Unsupported scene snapshot version: " + filename);
+
+    // Every array follows the previous one, so the counts give the size of
+    // the file; checking it up front keeps every read below in bounds
+    Layout layout(header);
+    if (file.getSize() != layout.end || header.nodeCount == 0)
+      throw runtime_error("Damaged scene snapshot: " + filename);
+    const char *data = file.getData();
+
+    vector<string> strings(header.stringCount);
+    for (size_t i = 0; i < strings.size(); i++) {
+      StringRecord s = readRecord<StringRecord>(data + layout.strings, i);
+      if (s.offset > header.stringBytes ||
+          s.length > header.stringBytes - s.offset)
+        throw runtime_error("Damaged scene snapshot: " + filename);
+      strings[i].assign(data + layout.text + s.offset, s.length);
+    }
+    Reader reader(data, layout, header, strings, filename);
+
+    for (uint32_t i = 0; i < header.meshCount; i++) {
+      Declaration d = readRecord<Declaration>(data + layout.meshes, i);
+      meshPaths[reader.getString(d.name)] = reader.getString(d.path);
+    }
+    for (uint32_t i = 0; i < header.textureCount; i++) {
+      Declaration d = readRecord<Declaration>(data + layout.textures, i);
+      texturePaths[reader.getString(d.name)] = reader.getString(d.path);
+    }
+    return reader.buildNodes();
+  }
+
+private:
+  enum NodeType { GROUP, LEAF, SCALE, TRANSLATE, ROTATE };
+
+  // Reads back as a different value if the file has another byte order
+  enum { BYTE_ORDER_MARK = 0x01020304 };
+
+  /**
+   * @brief The start of a snapshot file, giving the length of each array.
+   */
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t nodeCount;
+    uint32_t lightCount;
+    uint32_t materialCount;
+    uint32_t meshCount;
+    uint32_t textureCount;
+    uint32_t stringCount;
+    uint32_t stringBytes;
+    uint32_t animationCount;
+  };
+
+  /**
+   * @brief One node. Names and paths are indices into the string table.
+   */
+  struct NodeRecord {
+    int32_t type;
+    // Index of the parent node, which always comes first; -1 for the root
+    int32_t parent;
+    uint32_t name;
+    // The node's lights, a range of the light array
+    uint32_t firstLight;
+    uint32_t lightCount;
+    // Leaves only: the mesh name, texture name and material index
+    uint32_t instanceOf;
+    uint32_t texture;
+    int32_t material;
+    // Scale or translation; for rotations the angle in radians, then axis
+    float parameters[4];
+    // Parent nodes only: index of the animation transform, or -1 if it is
+    // the identity, as it is for any scene that has not been animated
+    int32_t animation;
+  };
+
+  // A transform, column by column
+  struct MatrixRecord {
+    float m[16];
+  };
+
+  struct LightRecord {
+    float ambient[3], diffuse[3], specular[3];
+    float position[4], spotDirection[4];
+    float spotCutoff;
+  };
+
+  struct MaterialRecord {
+    float emission[4], ambient[4], diffuse[4], specular[4];
+    float shininess, absorption, reflection, transparency, refractiveIndex;
+  };
+
+  // A mesh or image: its name and path
+  struct Declaration {
+    uint32_t name;
+    uint32_t path;
+  };
+
+  // Where a string's characters are in the text at the end of the file
+  struct StringRecord {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  /**
+   * @brief The byte offset of each array, worked out from the header.
+   */
+  struct Layout {
+    explicit Layout(const Header &h) {
+      nodes = sizeof(Header);
+      lights = nodes + uint64_t(h.nodeCount) * sizeof(NodeRecord);
+      materials = lights + uint64_t(h.lightCount) * sizeof(LightRecord);
+      animations =
+          materials + uint64_t(h.materialCount) * sizeof(MaterialRecord);
+      meshes = animations + uint64_t(h.animationCount) * sizeof(MatrixRecord);
+      textures = meshes + uint64_t(h.meshCount) * sizeof(Declaration);
+      strings = textures + uint64_t(h.textureCount) * sizeof(Declaration);
+      text = strings + uint64_t(h.stringCount) * sizeof(StringRecord);
+      end = text + h.stringBytes;
+    }
+    uint64_t nodes, lights, materials, animations, meshes, textures, strings,
+        text, end;
+  };
+
+  static const char *signature() { return "SGSCENE\n"; }
+
+  /**
+   * @brief Copy out one record of an array; the file gives no alignment
+   * guarantees.
+   */
+  template <class T> static T readRecord(const char *array, size_t index) {
+    T record;
+    memcpy(&record, array + index * sizeof(T), sizeof(T));
+    return record;
+  }
+
+  template <class T>
+  static void writeArray(ofstream &out, const vector<T> &records) {
+    if (!records.empty())
+      out.write(reinterpret_cast<const char *>(&records[0]),
+                records.size() * sizeof(T));
+  }
+
+  /**
+   * @brief Flattens a scene graph into records, visiting nodes depth first.
+   */
+  class Writer : public SGNodeVisitor {
+  public:
+    Writer() : parent(-1) {}
+
+    vector<NodeRecord> nodes;
+    vector<LightRecord> lights;
+    vector<MaterialRecord> materials;
+    vector<MatrixRecord> animations;
+    vector<Declaration> meshes, textures;
+    vector<StringRecord> strings;
+    vector<char> text;
+
+    void visitGroupNode(GroupNode *node) {
+      visitParent(add(node, GROUP), node);
+    }
+
+    void visitLeafNode(LeafNode *node) {
+      NodeRecord &record = nodes[add(node, LEAF)];
+      record.instanceOf = intern(node->getInstanceOf());
+      record.texture = intern(node->getTexture());
+      record.material = material(node->getMaterial());
+    }
+
+    void visitTransformNode(TransformNode *node) {
+      throw runtime_error("Cannot save transform node " + node->getName());
+    }
+
+    void visitScaleTransform(ScaleTransform *node) {
+      int index = add(node, SCALE);
+      setParameters(nodes[index], glm::vec4(node->getScale(), 0.0f));
+      visitParent(index, node);
+    }
+
+    void visitTranslateTransform(TranslateTransform *node) {
+      int index = add(node, TRANSLATE);
+      setParameters(nodes[index], glm::vec4(node->getTranslate(), 0.0f));
+      visitParent(index, node);
+    }
+
+    void visitRotateTransform(RotateTransform *node) {
+      int index = add(node, ROTATE);
+      setParameters(nodes[index], glm::vec4(node->getAngleInRadians(),
+                                            node->getRotationAxis()));
+      visitParent(index, node);
+    }
+
+    Declaration declare(const string &name, const string &path) {
+      Declaration d;
+      d.name = intern(name);
+      d.path = intern(path);
+      return d;
+    }
+
+  private:
+    // The node whose children are being visited
+    int parent;
+    // Strings and materials already written, to write each only once
+    map<string, uint32_t> stringIndices;
+    map<vector<float>, int32_t> materialIndices;
+
+    int add(AbstractSGNode *node, NodeType type) {
+      NodeRecord record;
+      memset(&record, 0, sizeof(record));
+      record.type = type;
+      record.parent = parent;
+      record.name = intern(node->getName());
+      record.material = -1;
+      record.animation = -1;
+      const vector<util::Light> &nodeLights = node->getLights();
+      record.firstLight = static_cast<uint32_t>(lights.size());
+      record.lightCount = static_cast<uint32_t>(nodeLights.size());
+      for (size_t i = 0; i < nodeLights.size(); i++)
+        lights.push_back(light(nodeLights[i]));
+      nodes.push_back(record);
+      return static_cast<int>(nodes.size()) - 1;
+    }
+
+    void visitParent(int index, ParentSGNode *node) {
+      glm::mat4 anim = node->getAnimTransform();
+      if (anim != glm::mat4(1.0f)) {
+        MatrixRecord record;
+        memcpy(record.m, &anim[0][0], sizeof(record.m));
+        animations.push_back(record);
+        nodes[index].animation = static_cast<int32_t>(animations.size()) - 1;
+      }
+      int old = parent;
+      parent = index;
+      const vector<SGNode *> &children = node->getChildren();
+      for (size_t i = 0; i < children.size(); i++)
+        children[i]->accept(this);
+      parent = old;
+    }
+
+    static void setParameters(NodeRecord &record, const glm::vec4 &v) {
+      for (int i = 0; i < 4; i++)
+        record.parameters[i] = v[i];
+    }
+
+    uint32_t intern(const string &s) {
+      auto it = stringIndices.find(s);
+      if (it != stringIndices.end())
+        return it->second;
+      StringRecord record;
+      record.offset = static_cast<uint32_t>(text.size());
+      record.length = static_cast<uint32_t>(s.size());
+      text.insert(text.end(), s.begin(), s.end());
+      strings.push_back(record);
+      uint32_t index = static_cast<uint32_t>(strings.size()) - 1;
+      stringIndices[s] = index;
+      return index;
+    }
+
+    int32_t material(const util::Material &m) {
+      MaterialRecord record;
+      copy(m.getEmission(), record.emission);
+      copy(m.getAmbient(), record.ambient);
+      copy(m.getDiffuse(), record.diffuse);
+      copy(m.getSpecular(), record.specular);
+      record.shininess = m.getShininess();
+      record.absorption = m.getAbsorption();
+      record.reflection = m.getReflection();
+      record.transparency = m.getTransparency();
+      record.refractiveIndex = m.getRefractiveIndex();
+      const float *f = reinterpret_cast<const float *>(&record);
+      vector<float> key(f, f + sizeof(record) / sizeof(float));
+      auto it = materialIndices.find(key);
+      if (it != materialIndices.end())
+        return it->second;
+      materials.push_back(record);
+      int32_t index = static_cast<int32_t>(materials.size()) - 1;
+      materialIndices[key] = index;
+      return index;
+    }
+
+    static LightRecord light(const util::Light &l) {
+      LightRecord record;
+      copy(glm::vec4(l.getAmbient(), 0.0f), record.ambient, 3);
+      copy(glm::vec4(l.getDiffuse(), 0.0f), record.diffuse, 3);
+      copy(glm::vec4(l.getSpecular(), 0.0f), record.specular, 3);
+      copy(l.getPosition(), record.position);
+      copy(l.getSpotDirection(), record.spotDirection);
+      record.spotCutoff = l.getSpotCutoff();
+      return record;
+    }
+
+    static void copy(const glm::vec4 &v, float *out, int count = 4) {
+      for (int i = 0; i < count; i++)
+        out[i] = v[i];
+    }
+  };
+
+  /**
+   * @brief Builds nodes from the records of a mapped snapshot, checking
+   * every index as it goes.
+   */
+  class Reader {
+  public:
+    Reader(const char *data, const Layout &layout, const Header &header,
+           const vector<std::string> &strings, const std::string &filename)
+        : data(data), layout(layout), header(header), strings(strings),
+          filename(filename) {}
+
+    const std::string &getString(uint32_t index) const {
+      if (index >= strings.size())
+        damaged();
+      return strings[index];
+    }
+
+    SGNode *buildNodes() {
+      // Parent nodes by index, null for leaves, so children can be attached
+      // without a cast
+      vector<ParentSGNode *> parents(header.nodeCount, NULL);
+      SGNode *root = NULL;
+      SGNode *node = NULL;
+      try {
+        for (uint32_t i = 0; i < header.nodeCount; i++) {
+          NodeRecord r = readRecord<NodeRecord>(data + layout.nodes, i);
+          if ((i == 0) != (r.parent < 0) ||
+              r.parent >= static_cast<int32_t>(i) ||
+              (r.parent >= 0 && parents[r.parent] == NULL))
+            damaged();
+          const std::string &name = getString(r.name);
+          const float *p = r.parameters;
+          ParentSGNode *parentNode = NULL;
+          switch (r.type) {
+          case GROUP:
+            node = parentNode = new GroupNode(name, NULL);
+            break;
+          case LEAF: {
+            LeafNode *leaf = new LeafNode(getString(r.instanceOf), name, NULL);
+            node = leaf;
+            leaf->setTexture(getString(r.texture));
+            leaf->setMaterial(material(r.material));
+            break;
+          }
+          case SCALE:
+            node = parentNode =
+                new ScaleTransform(p[0], p[1], p[2], name, NULL);
+            break;
+          case TRANSLATE:
+            node = parentNode =
+                new TranslateTransform(p[0], p[1], p[2], name, NULL);
+            break;
+          case ROTATE:
+            node = parentNode =
+                new RotateTransform(p[0], p[1], p[2], p[3], name, NULL);
+            break;
+          default:
+            damaged();
+          }
+          if (parentNode != NULL && r.animation >= 0) {
+            if (static_cast<uint32_t>(r.animation) >= header.animationCount)
+              damaged();
+            MatrixRecord m =
+                readRecord<MatrixRecord>(data + layout.animations, r.animation);
+            glm::mat4 anim;
+            memcpy(&anim[0][0], m.m, sizeof(m.m));
+            parentNode->setAnimTransform(anim);
+          }
+          addLights(static_cast<AbstractSGNode *>(node), r);
+          parents[i] = parentNode;
+          if (i == 0)
+            root = node;
+          else
+            parents[r.parent]->addChild(node);
+          node = NULL;
+        }
+      } catch (...) {
+        // The root owns every node attached so far
+        if (node != root)
+          delete node;
+        delete root;
+        throw;
+      }
+      return root;
+    }
+
+  private:
+    const char *data;
+    const Layout &layout;
+    const Header &header;
+    const vector<std::string> &strings;
+    const std::string &filename;
+
+    void damaged() const {
+      throw runtime_error("Damaged scene snapshot: " + filename);
+    }
+
+    util::Material material(int32_t index) const {
+      if (index < 0 || static_cast<uint32_t>(index) >= header.materialCount)
+        damaged();
+      MaterialRecord r =
+          readRecord<MaterialRecord>(data + layout.materials, index);
+      util::Material m;
+      // Transparency also sets the alpha of each color, which the stored
+      // colors then restore exactly
+      m.setShininess(r.shininess);
+      m.setAbsorption(r.absorption);
+      m.setReflection(r.reflection);
+      m.setTransparency(r.transparency);
+      m.setRefractiveIndex(r.refractiveIndex);
+      m.setEmission(toVec4(r.emission));
+      m.setAmbient(toVec4(r.ambient));
+      m.setDiffuse(toVec4(r.diffuse));
+      m.setSpecular(toVec4(r.specular));
+      return m;
+    }
+
+    void addLights(AbstractSGNode *node, const NodeRecord &r) const {
+      if (r.firstLight > header.lightCount ||
+          r.lightCount > header.lightCount - r.firstLight)
+        damaged();
+      for (uint32_t i = 0; i < r.lightCount; i++) {
+        LightRecord l =
+            readRecord<LightRecord>(data + layout.lights, r.firstLight + i);
+        util::Light light;
+        light.setAmbient(l.ambient[0], l.ambient[1], l.ambient[2]);
+        light.setDiffuse(l.diffuse[0], l.diffuse[1], l.diffuse[2]);
+        light.setSpecular(l.specular[0], l.specular[1], l.specular[2]);
+        light.setPosition(toVec4(l.position));
+        light.setSpotDirection(l.spotDirection[0], l.spotDirection[1],
+                               l.spotDirection[2]);
+        light.setSpotAngle(l.spotCutoff);
+        node->addLight(light);
+      }
+    }
+
+    static glm::vec4 toVec4(const float *f) {
+      return glm::vec4(f[0], f[1], f[2], f[3]);
+    }
+  };
+};
+
+} // namespace sgraph
+
+#endif
@@ -25,6 +25,7 @@ protected:
   SGNode *root;
   map<string, util::PolygonMesh<VertexAttrib>> meshes;
   map<string, string> meshPaths;
+  map<string, string> texturePaths;
 
   /**
    * A map to store the (name,node) pairs. A map is chosen for efficient search
@@ -76,6 +77,12 @@ public:
   }
 
   map<string, string> getMeshPaths() { return this->meshPaths; }
+
+  void setTexturePaths(const map<string, string> &texturePaths) {
+    this->texturePaths = texturePaths;
+  }
+
+  map<string, string> getTexturePaths() { return this->texturePaths; }
 };
 } // namespace sgraph
 #endif
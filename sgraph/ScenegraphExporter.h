@@ -177,8 +177,9 @@ private:
     int old = number;
     number = 0;
 
-    for (int i = 0; i < node->getChildren().size(); i = i + 1) {
-      node->getChildren()[i]->accept(this);
+    const vector<SGNode *> &children = node->getChildren();
+    for (int i = 0; i < children.size(); i = i + 1) {
+      children[i]->accept(this);
       stringstream childname;
       childname << "node-" << level << "-" << number;
       append("add-child " + childname.str() + " " + name);
@@ -1,6 +1,7 @@
 #ifndef _SCENEGRAPHIMPORTER_H_
 #define _SCENEGRAPHIMPORTER_H_
 
+#include "AssetLoader.h"
 #include "GroupNode.h"
 #include "IScenegraph.h"
 #include "LeafNode.h"
@@ -9,6 +10,7 @@
 #include "PolygonMesh.h"
 #include "RotateTransform.h"
 #include "ScaleTransform.h"
+#include "SceneSnapshot.h"
 #include "Scenegraph.h"
 #include "TransformNode.h"
 #include "TranslateTransform.h"
@@ -17,6 +19,7 @@
 #include <iostream>
 #include <istream>
 #include <map>
+#include <set>
 #include <sstream>
 #include <string>
 using namespace std;
@@ -24,9 +27,85 @@ namespace sgraph {
 
 class ScenegraphImporter {
 public:
-  ScenegraphImporter() {}
+  ScenegraphImporter() : root(NULL), parsing(false) {}
 
+  /**
+   * @brief Build a scene graph from its commands.
+   *
+   * Meshes, and anything subclasses queue in requestImage(), load on worker
+   * threads while the commands are parsed. Imported files are parsed by
+   * nested calls, so only the outermost call waits for the loads to finish.
+   */
   IScenegraph *parse(istream &input) {
+    bool outermost = !parsing;
+    parsing = true;
+    try {
+      parseCommands(input);
+      if (outermost) {
+        parsing = false;
+        finishLoading();
+      }
+    } catch (...) {
+      if (outermost)
+        parsing = false;
+      throw;
+    }
+    if (root != NULL) {
+      // Copy any subtree added to more than one parent, so that every node
+      // has a single world transform
+      ParentSGNode *parentRoot = dynamic_cast<ParentSGNode *>(root);
+      if (parentRoot != NULL) {
+        set<SGNode *> visited;
+        visited.insert(root);
+        parentRoot->unshareChildren(visited);
+      }
+      return makeScenegraph();
+    } else {
+      throw runtime_error("Parsed scene graph, but nothing set as root");
+    }
+  }
+
+  /**
+   * @brief Build a scene graph from a binary snapshot written by
+   * SceneSnapshot::write().
+   *
+   * The snapshot's meshes and images are requested just as the commands of a
+   * text file would request them.
+   *
+   * @throws runtime_error If the snapshot cannot be read.
+   */
+  IScenegraph *parseSnapshot(const string &filename) {
+    root = SceneSnapshot::read(filename, meshPaths, texturePaths);
+    try {
+      for (auto it = meshPaths.begin(); it != meshPaths.end(); ++it)
+        assets.requestMesh(it->second);
+      for (auto it = texturePaths.begin(); it != texturePaths.end(); ++it)
+        requestImage(it->second);
+      finishLoading();
+    } catch (...) {
+      delete root;
+      root = NULL;
+      throw;
+    }
+    return makeScenegraph();
+  }
+
+protected:
+  // get texture paths
+  const map<string, string> &getTexturePaths() const { return texturePaths; }
+
+  // get the worker threads that load the scene's files
+  AssetLoader &getAssets() { return assets; }
+
+  /**
+   * @brief Called for each image command, so that subclasses can start
+   * decoding the image on getAssets() while parsing continues.
+   *
+   * @param path The path of the image file.
+   */
+  virtual void requestImage(const string & /*path*/) {}
+
+  void parseCommands(istream &input) {
     string command;
     string inputWithOutCommentsString = stripComments(input);
     istringstream inputWithOutComments(inputWithOutCommentsString);
@@ -36,12 +115,7 @@ public:
         string name, path;
         inputWithOutComments >> name >> path;
         meshPaths[name] = path;
-        ifstream in(path);
-        if (in.is_open()) {
-          util::PolygonMesh<VertexAttrib> mesh =
-              util::ObjImporter<VertexAttrib>::importFile(in, true);
-          meshes[name] = mesh;
-        }
+        assets.requestMesh(path);
       } else if (command == "group") {
         parseGroup(inputWithOutComments);
       } else if (command == "leaf") {
@@ -79,20 +153,33 @@ public:
         throw runtime_error("Unrecognized or out-of-place command: " + command);
       }
     }
-    if (root != NULL) {
-      IScenegraph *scenegraph = new Scenegraph();
-      scenegraph->makeScenegraph(root);
-      scenegraph->setMeshes(meshes);
-      scenegraph->setMeshPaths(meshPaths);
-      return scenegraph;
-    } else {
-      throw runtime_error("Parsed scene graph, but nothing set as root");
+  }
+
+  /**
+   * @brief Wait for every requested file to load, then give each mesh name
+   * the mesh its latest instance command asked for.
+   */
+  void finishLoading() {
+    assets.wait();
+    for (auto it = meshPaths.begin(); it != meshPaths.end(); ++it) {
+      const util::PolygonMesh<VertexAttrib> *mesh = assets.getMesh(it->second);
+      if (mesh != NULL)
+        meshes[it->first] = *mesh;
     }
   }
 
-protected:
-  // get texture paths
-  const map<string, string> &getTexturePaths() const { return texturePaths; }
+  /**
+   * @brief Wrap the parsed root, with the meshes and declarations, in a new
+   * scene graph.
+   */
+  IScenegraph *makeScenegraph() {
+    IScenegraph *scenegraph = new Scenegraph();
+    scenegraph->makeScenegraph(root);
+    scenegraph->setMeshes(meshes);
+    scenegraph->setMeshPaths(meshPaths);
+    scenegraph->setTexturePaths(texturePaths);
+    return scenegraph;
+  }
 
   virtual void parseGroup(istream &input) {
     string varname, name;
@@ -144,6 +231,7 @@ protected:
     string texName, texPath;
     input >> texName >> texPath;
     texturePaths[texName] = texPath;
+    requestImage(texPath);
   }
 
   virtual void parseAssignTexture(istream &input) {
@@ -315,6 +403,10 @@ private:
   map<string, string> texturePaths;
 
   map<string, util::Light> lightTable;
+  // Loads meshes and images while commands are parsed
+  AssetLoader assets;
+  // Whether a call to parse() is in progress
+  bool parsing;
 };
 } // namespace sgraph
 #endif
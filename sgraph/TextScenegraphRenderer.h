@@ -50,8 +50,9 @@ public:
    */
   void visitGroupNode(GroupNode *groupNode, int depth) {
     printNodeHelper(groupNode->getName(), depth);
-    for (int i = 0; i < groupNode->getChildren().size(); i = i + 1) {
-      groupNode->getChildren()[i]->accept(this, depth);
+    const vector<SGNode *> &children = groupNode->getChildren();
+    for (int i = 0; i < children.size(); i = i + 1) {
+      children[i]->accept(this, depth);
     }
   }
 
@@ -66,18 +67,16 @@ public:
   }
 
   /**
-   * @brief Multiply the transform to the modelview and recur to child
+   * @brief Recur to the child. Only names are printed, so the transform
+   * itself is not needed
    *
    * @param transformNode
    */
   void visitTransformNode(TransformNode *transformNode, int depth) {
     printNodeHelper(transformNode->getName(), depth);
-    modelview.push(modelview.top());
-    modelview.top() = modelview.top() * transformNode->getTransform();
     if (transformNode->getChildren().size() > 0) {
       transformNode->getChildren()[0]->accept(this, depth);
     }
-    modelview.pop();
   }
 
   /**
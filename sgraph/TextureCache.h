@@ -0,0 +1,134 @@
+#ifndef _TEXTURECACHE_H_
+#define _TEXTURECACHE_H_
+
+#include <cmath>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace sgraph {
+
+/**
+ * @brief An RGB image decoded once into floats for sampling by the ray
+ * tracer.
+ *
+ * Texels are stored row by row from the bottom of the image up, in the order
+ * they are handed to OpenGL, so texture coordinates address the same texels
+ * in both renderers.
+ */
+class Texture {
+public:
+  Texture() : width(0), height(0) {}
+
+  /**
+   * @brief Convert 8-bit RGB pixels into a texture.
+   *
+   * @param pixels The pixels, three bytes each, rows from the bottom up.
+   * @param width Width of the image in pixels.
+   * @param height Height of the image in pixels.
+   */
+  Texture(const unsigned char *pixels, int width, int height)
+      : width(width), height(height),
+        texels(static_cast<size_t>(width) * height) {
+    const float scale = 1.0f / 255.0f;
+    for (size_t i = 0; i < texels.size(); i++)
+      texels[i] = glm::vec3(pixels[3 * i], pixels[3 * i + 1],
+                            pixels[3 * i + 2]) *
+                  scale;
+  }
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+
+  /**
+   * @brief Bilinearly filter the texture at a point.
+   *
+   * Matches OpenGL's GL_LINEAR filtering with GL_REPEAT wrapping, without
+   * mipmaps: texel centers lie at half-integer coordinates and the texture
+   * repeats outside [0, 1].
+   *
+   * @param uv The texture coordinates of the point.
+   * @return The filtered color, each channel in [0, 1].
+   */
+  glm::vec3 sample(const glm::vec2 &uv) const {
+    float x = (uv.x - std::floor(uv.x)) * width - 0.5f;
+    float y = (uv.y - std::floor(uv.y)) * height - 0.5f;
+    float fx = std::floor(x), fy = std::floor(y);
+    int x0 = static_cast<int>(fx), y0 = static_cast<int>(fy);
+    // Points within half a texel of an edge blend with the opposite edge
+    if (x0 < 0)
+      x0 = width - 1;
+    if (y0 < 0)
+      y0 = height - 1;
+    int x1 = (x0 + 1 < width) ? x0 + 1 : 0;
+    int y1 = (y0 + 1 < height) ? y0 + 1 : 0;
+    const glm::vec3 *row0 = &texels[static_cast<size_t>(y0) * width];
+    const glm::vec3 *row1 = &texels[static_cast<size_t>(y1) * width];
+    float ax = x - fx;
+    glm::vec3 bottom = glm::mix(row0[x0], row0[x1], ax);
+    glm::vec3 top = glm::mix(row1[x0], row1[x1], ax);
+    return glm::mix(bottom, top, y - fy);
+  }
+
+private:
+  int width, height;
+  // Colors of the texels, row by row from the bottom up.
+  std::vector<glm::vec3> texels;
+};
+
+/**
+ * @brief The textures of a scene, keyed by the names its image commands
+ * give them.
+ *
+ * Each image is decoded by the caller and converted once when it is added;
+ * renders then only look textures up and sample them.
+ */
+class TextureCache {
+public:
+  /**
+   * @brief Add a texture, replacing any texture of the same name.
+   *
+   * Empty images are ignored.
+   *
+   * @param name The name of the texture.
+   * @param pixels The pixels, three bytes each, rows from the bottom up.
+   * @param width Width of the image in pixels.
+   * @param height Height of the image in pixels.
+   */
+  void add(const std::string &name, const unsigned char *pixels, int width,
+           int height) {
+    if (pixels == NULL || width <= 0 || height <= 0)
+      return;
+    textures[name] = Texture(pixels, width, height);
+  }
+
+  /**
+   * @brief Find a texture by name.
+   *
+   * @param name The name of the texture.
+   * @return The texture, or null if there is none of that name.
+   */
+  const Texture *find(const std::string &name) const {
+    std::map<std::string, Texture>::const_iterator it = textures.find(name);
+    return (it == textures.end()) ? NULL : &it->second;
+  }
+
+  /**
+   * @brief Get the number of textures in the cache.
+   */
+  size_t size() const { return textures.size(); }
+
+  /**
+   * @brief Remove every texture.
+   */
+  void clear() { textures.clear(); }
+
+private:
+  std::map<std::string, Texture> textures;
+};
+
+} // namespace sgraph
+
+#endif
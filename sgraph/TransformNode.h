@@ -20,7 +20,15 @@ class TransformNode : public ParentSGNode {
 protected:
   glm::mat4 transform;
 
-  void setTransform(glm::mat4 &transform) { this->transform = transform; }
+  void setTransform(glm::mat4 &transform) {
+    this->transform = transform;
+    markDirty();
+  }
+
+  /**
+   * The node's transform, followed by any animation applied to it
+   */
+  glm::mat4 getLocalTransform() { return transform * animTransform; }
 
 public:
   TransformNode(const string &name, sgraph::IScenegraph *graph)
@@ -47,7 +55,7 @@ public:
   /**
    * Gets the transform at this node (not the animation transform)
    */
-  glm::mat4 getTransform() { return transform; }
+  const glm::mat4 &getTransform() const { return transform; }
 
   /**
    * Sets the scene graph object of which this node is a part, and then recurses
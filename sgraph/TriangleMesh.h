@@ -0,0 +1,275 @@
+#ifndef _TRIANGLEMESH_H_
+#define _TRIANGLEMESH_H_
+
+#include "BVH.h"
+#include "PolygonMesh.h"
+#include "RayPacket.h"
+#include "Rays.h"
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+namespace sgraph {
+
+/**
+ * @brief A triangle mesh prepared for ray intersection in its own
+ * coordinate system.
+ *
+ * Holds the triangles of a polygon mesh together with a BVH over them. One
+ * TriangleMesh is built per mesh instance and shared by every leaf that
+ * refers to it; the leaves only contribute their transforms, so the scene
+ * forms a two-level hierarchy with this BVH at the bottom.
+ */
+class TriangleMesh {
+public:
+  TriangleMesh() {}
+
+  /**
+   * @brief Build the mesh from a polygon mesh of triangles.
+   *
+   * Meshes made of anything other than triangles produce an empty mesh.
+   *
+   * @param mesh The mesh to copy the triangles from.
+   */
+  template <class VertexType>
+  explicit TriangleMesh(const util::PolygonMesh<VertexType> &mesh) {
+    typedef util::VertexTraits<VertexType> Traits;
+    if (mesh.getPrimitiveSize() != 3)
+      return;
+    std::vector<VertexType> vertices = mesh.getVertexAttributes();
+    std::vector<unsigned int> indices = mesh.getPrimitives();
+    size_t triangleCount = indices.size() / 3;
+    triangles.reserve(triangleCount);
+    attributes.reserve(triangleCount);
+    std::vector<AABB> triangleBounds;
+    triangleBounds.reserve(triangleCount);
+    for (size_t i = 0; i < triangleCount; i++) {
+      glm::vec3 p[3];
+      Attributes attribute;
+      bool valid = true;
+      for (int k = 0; k < 3; k++) {
+        unsigned int index = indices[3 * i + k];
+        if (index >= vertices.size()) {
+          valid = false;
+          break;
+        }
+        const VertexType &v = vertices[index];
+        p[k] = glm::vec3(Traits::template get<util::PositionAttribute>(v));
+        attribute.normal[k] =
+            glm::vec3(Traits::template get<util::NormalAttribute>(v));
+        attribute.texcoord[k] =
+            glm::vec2(Traits::template get<util::TexcoordAttribute>(v));
+      }
+      if (!valid)
+        continue;
+      Triangle triangle;
+      triangle.v0 = p[0];
+      triangle.e1 = p[1] - p[0];
+      triangle.e2 = p[2] - p[0];
+      triangles.push_back(triangle);
+      attributes.push_back(attribute);
+      AABB box;
+      for (int k = 0; k < 3; k++)
+        box.grow(p[k]);
+      bounds.grow(box);
+      triangleBounds.push_back(box);
+    }
+    bvh.build(triangleBounds);
+  }
+
+  /**
+   * @brief Get the bounds of the mesh in its own coordinate system.
+   */
+  const AABB &getBounds() const { return bounds; }
+
+  /**
+   * @brief Get the number of triangles in the mesh.
+   */
+  size_t getTriangleCount() const { return triangles.size(); }
+
+  /**
+   * @brief Find the closest triangle along a ray.
+   *
+   * Of equally distant triangles, the one with the lowest index is chosen.
+   *
+   * @param ray The ray in the mesh's coordinate system.
+   * @param tMax The farthest distance of interest, inclusive; set to the
+   * distance of the hit, if any.
+   * @return The index of the closest triangle hit, or -1.
+   */
+  int intersect(const Ray &ray, float &tMax) const {
+    int closest = -1;
+    auto intersectTriangle = [&](int index, float &tMax) {
+      float t, u, v;
+      if (!intersectTriangleAt(triangles[index], ray, t, u, v) ||
+          !isCloserHit(t, index, tMax, closest))
+        return false;
+      tMax = t;
+      closest = index;
+      return true;
+    };
+    bvh.traverse(ray, tMax, intersectTriangle);
+    return closest;
+  }
+
+  /**
+   * @brief Find whether any triangle blocks a ray.
+   *
+   * @param ray The ray in the mesh's coordinate system.
+   * @param tMax The distance beyond which triangles do not block the ray.
+   * @return True if a triangle is hit before tMax.
+   */
+  bool occluded(const Ray &ray, float tMax) const {
+    auto testTriangle = [&](int index) {
+      float t, u, v;
+      return intersectTriangleAt(triangles[index], ray, t, u, v) && t < tMax;
+    };
+    return bvh.occluded(ray, tMax, testTriangle);
+  }
+
+  /**
+   * @brief Find the closest triangle along each of four rays.
+   *
+   * Each lane computes exactly what intersect() computes for its ray.
+   *
+   * @param origin The ray origins in the mesh's coordinate system.
+   * @param dir The ray directions in the mesh's coordinate system.
+   * @param mask Lanes that carry a ray, lane i in bit i.
+   * @param tMax The farthest distance of interest per lane, inclusive; set
+   * to the distance of the hit for every lane that hits.
+   * @param closest Set to the closest triangle for every lane that hits.
+   * @return The lanes that hit a triangle.
+   */
+  int intersectPacket(const Vec3x4 &origin, const Vec3x4 &dir, int mask,
+                      Float4 &tMax, int *closest) const {
+    int hitLanes = 0;
+    for (int lane = 0; lane < RayPacket::SIZE; lane++)
+      closest[lane] = -1;
+    auto intersectTriangle = [&](int index, int lanes, Float4 &tMax) {
+      Float4 t;
+      Mask4 hit = intersectTriangleAt(triangles[index], origin, dir, t);
+      int closer = closerLanes(hit & Mask4::fromBits(lanes), t, tMax, index,
+                               closest);
+      if (closer == 0)
+        return;
+      tMax = select(Mask4::fromBits(closer), t, tMax);
+      for (int lane = 0; lane < RayPacket::SIZE; lane++) {
+        if (closer & (1 << lane))
+          closest[lane] = index;
+      }
+      hitLanes |= closer;
+    };
+    bvh.traversePacket(origin, dir, mask, tMax, intersectTriangle);
+    return hitLanes;
+  }
+
+  /**
+   * @brief Fill in a hit record for a ray known to hit a triangle.
+   *
+   * The normal and texture coordinates are interpolated from the triangle's
+   * vertices; where the vertex normals cancel out or are missing, the
+   * geometric normal of the triangle is used instead.
+   *
+   * @param triangle Index of the triangle that was hit.
+   * @param ray The ray in the mesh's coordinate system.
+   * @param hit The hit record to fill, in the mesh's coordinate system.
+   */
+  void getHit(int triangle, const Ray &ray, HitRecord &hit) const {
+    const Triangle &tri = triangles[triangle];
+    const Attributes &attribute = attributes[triangle];
+    float t, u, v;
+    intersectTriangleAt(tri, ray, t, u, v);
+    float w = 1.0f - u - v;
+    hit.t = t;
+    hit.point = ray.origin + t * ray.direction;
+    glm::vec3 normal = w * attribute.normal[0] + u * attribute.normal[1] +
+                       v * attribute.normal[2];
+    if (!(glm::dot(normal, normal) > 1e-12f))
+      normal = glm::cross(tri.e1, tri.e2);
+    hit.normal = glm::normalize(normal);
+    hit.texCoords = w * attribute.texcoord[0] + u * attribute.texcoord[1] +
+                    v * attribute.texcoord[2];
+  }
+
+private:
+  /**
+   * @brief A triangle stored as one vertex and the two edges leaving it,
+   * which is the form the intersection test needs.
+   */
+  struct Triangle {
+    glm::vec3 v0, e1, e2;
+  };
+
+  /**
+   * @brief Per-vertex attributes of a triangle, only read to shade a hit.
+   */
+  struct Attributes {
+    glm::vec3 normal[3];
+    glm::vec2 texcoord[3];
+  };
+
+  // Triangles, indexed by the BVH.
+  std::vector<Triangle> triangles;
+  // Shading attributes of each triangle, kept apart to keep the triangles
+  // compact during traversal.
+  std::vector<Attributes> attributes;
+  // Bounds of all the triangles.
+  AABB bounds;
+  // Hierarchy over the triangles.
+  BVH bvh;
+
+  /**
+   * @brief Moller-Trumbore intersection of a ray with a triangle.
+   *
+   * Points on a shared edge count as inside both triangles, so rays cannot
+   * slip between neighbouring triangles.
+   *
+   * @param tri The triangle.
+   * @param ray The ray.
+   * @param t Set to the distance of the hit.
+   * @param u Set to the barycentric weight of the second vertex.
+   * @param v Set to the barycentric weight of the third vertex.
+   * @return True if the ray hits the triangle in front of its origin.
+   */
+  static bool intersectTriangleAt(const Triangle &tri, const Ray &ray,
+                                  float &t, float &u, float &v) {
+    glm::vec3 p = glm::cross(ray.direction, tri.e2);
+    float det = glm::dot(tri.e1, p);
+    float invDet = 1.0f / det;
+    glm::vec3 s = ray.origin - tri.v0;
+    u = glm::dot(s, p) * invDet;
+    glm::vec3 q = glm::cross(s, tri.e1);
+    v = glm::dot(ray.direction, q) * invDet;
+    t = glm::dot(tri.e2, q) * invDet;
+    // Written so that NaNs from a ray parallel to the triangle fail
+    return (det < 0.0f || det > 0.0f) && (u >= 0.0f) && (v >= 0.0f) &&
+           (u + v <= 1.0f) && (t > 0.0f);
+  }
+
+  /**
+   * @brief Moller-Trumbore intersection of four rays with a triangle.
+   *
+   * Performs the same computation as the single ray version in each lane.
+   */
+  static Mask4 intersectTriangleAt(const Triangle &tri, const Vec3x4 &origin,
+                                   const Vec3x4 &dir, Float4 &t) {
+    Vec3x4 e1(Float4(tri.e1.x), Float4(tri.e1.y), Float4(tri.e1.z));
+    Vec3x4 e2(Float4(tri.e2.x), Float4(tri.e2.y), Float4(tri.e2.z));
+    Vec3x4 p = cross(dir, e2);
+    Float4 det = dot(e1, p);
+    Float4 invDet = Float4(1.0f) / det;
+    Vec3x4 s(origin.x - Float4(tri.v0.x), origin.y - Float4(tri.v0.y),
+             origin.z - Float4(tri.v0.z));
+    Float4 u = dot(s, p) * invDet;
+    Vec3x4 q = cross(s, e1);
+    Float4 v = dot(dir, q) * invDet;
+    t = dot(e2, q) * invDet;
+    Float4 zero(0.0f);
+    return ((det < zero) | (det > zero)) & (u >= zero) & (v >= zero) &
+           (u + v <= Float4(1.0f)) & (t > zero);
+  }
+};
+
+} // namespace sgraph
+
+#endif
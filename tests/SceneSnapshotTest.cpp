@@ -0,0 +1,318 @@
+/**
+ * @file SceneSnapshotTest.cpp
+ * @brief Round-trip test and load-time benchmark for SceneSnapshot.
+ *
+ * Every scene is parsed from text, saved as a snapshot and loaded back. The
+ * two scene graphs must agree on every node's type, name, parameters,
+ * transforms, material, lights and texture, and on the mesh and texture
+ * declarations. Saving the loaded scene again must give a byte-identical
+ * file. The time to load each scene from text and from its snapshot is then
+ * compared, including on a generated scene with many nodes.
+ *
+ * Usage: SceneSnapshotTest [scene.txt...], by default every scene in
+ * scenegraphmodels/. Run from the repository root so the meshes are found.
+ */
+#include <glad/glad.h>
+
+#include "PolygonMesh.h"
+#include "VertexAttrib.h"
+#include "ObjImporter.h"
+#include "sgraph/SGNodeVisitor.h"
+#include "sgraph/ScenegraphImporter.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace sgraph;
+
+static const int RUNS = 7;
+static const int GENERATED_NODES = 20000;
+static const char *SNAPSHOT = "SceneSnapshotTest.sgs";
+static const char *RESAVED = "SceneSnapshotTest-resaved.sgs";
+
+/**
+ * @brief Writes everything a snapshot stores about a scene graph as text,
+ * with floats as bit patterns so that any change shows.
+ */
+class SceneDump : public SGNodeVisitor {
+public:
+  SceneDump() : depth(0) {}
+
+  void visitGroupNode(GroupNode *node) {
+    begin(node, "group");
+    visitChildren(node);
+  }
+
+  void visitLeafNode(LeafNode *node) {
+    begin(node, "leaf");
+    out << " instance " << node->getInstanceOf() << " texture "
+        << node->getTexture() << " material";
+    util::Material m = node->getMaterial();
+    write(m.getEmission());
+    write(m.getAmbient());
+    write(m.getDiffuse());
+    write(m.getSpecular());
+    write(m.getShininess());
+    write(m.getAbsorption());
+    write(m.getReflection());
+    write(m.getTransparency());
+    write(m.getRefractiveIndex());
+    out << " world";
+    write(node->getWorldTransform());
+    out << "\n";
+  }
+
+  void visitTransformNode(TransformNode *node) {
+    begin(node, "transform");
+    visitChildren(node);
+  }
+
+  void visitScaleTransform(ScaleTransform *node) {
+    begin(node, "scale");
+    write(glm::vec4(node->getScale(), 0.0f));
+    visitChildren(node);
+  }
+
+  void visitTranslateTransform(TranslateTransform *node) {
+    begin(node, "translate");
+    write(glm::vec4(node->getTranslate(), 0.0f));
+    visitChildren(node);
+  }
+
+  void visitRotateTransform(RotateTransform *node) {
+    begin(node, "rotate");
+    write(node->getAngleInRadians());
+    write(glm::vec4(node->getRotationAxis(), 0.0f));
+    visitChildren(node);
+  }
+
+  /**
+   * @brief Dump a scene graph and its declarations.
+   */
+  static std::string dump(IScenegraph *scenegraph) {
+    SceneDump dump;
+    scenegraph->getRoot()->accept(&dump);
+    std::map<std::string, std::string> meshes = scenegraph->getMeshPaths();
+    for (auto it = meshes.begin(); it != meshes.end(); ++it)
+      dump.out << "mesh " << it->first << " " << it->second << "\n";
+    std::map<std::string, std::string> textures =
+        scenegraph->getTexturePaths();
+    for (auto it = textures.begin(); it != textures.end(); ++it)
+      dump.out << "image " << it->first << " " << it->second << "\n";
+    return dump.out.str();
+  }
+
+private:
+  std::ostringstream out;
+  int depth;
+
+  void write(float f) {
+    unsigned int bits;
+    memcpy(&bits, &f, sizeof(bits));
+    out << " " << std::hex << bits << std::dec;
+  }
+
+  void write(const glm::vec4 &v) {
+    for (int i = 0; i < 4; i++)
+      write(v[i]);
+  }
+
+  void write(const glm::mat4 &m) {
+    for (int i = 0; i < 4; i++)
+      write(m[i]);
+  }
+
+  void begin(AbstractSGNode *node, const char *type) {
+    out << std::string(depth, ' ') << type << " " << node->getName()
+        << " lights";
+    const std::vector<util::Light> &lights = node->getLights();
+    for (size_t i = 0; i < lights.size(); i++) {
+      write(glm::vec4(lights[i].getAmbient(), 0.0f));
+      write(glm::vec4(lights[i].getDiffuse(), 0.0f));
+      write(glm::vec4(lights[i].getSpecular(), 0.0f));
+      write(lights[i].getPosition());
+      write(lights[i].getSpotDirection());
+      write(lights[i].getSpotCutoff());
+      out << " |";
+    }
+  }
+
+  void visitChildren(ParentSGNode *node) {
+    out << " animation";
+    write(node->getAnimTransform());
+    out << " world";
+    write(node->getWorldTransform());
+    out << "\n";
+    depth++;
+    const std::vector<SGNode *> &children = node->getChildren();
+    for (size_t i = 0; i < children.size(); i++)
+      children[i]->accept(this);
+    depth--;
+  }
+};
+
+static std::string readFile(const std::string &filename) {
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+
+static double milliseconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/**
+ * @brief Check that a scene survives a round trip through a snapshot.
+ *
+ * @return An empty string on success, or else what went wrong.
+ */
+static std::string roundTrip(const std::string &text) {
+  ScenegraphImporter textImporter;
+  std::istringstream in(text);
+  IScenegraph *original = textImporter.parse(in);
+  // Animation transforms are stored too, so give the root one
+  ParentSGNode *root = dynamic_cast<ParentSGNode *>(original->getRoot());
+  if (root != NULL)
+    root->setAnimTransform(
+        glm::rotate(glm::mat4(1.0f), 0.7f, glm::vec3(0.0f, 1.0f, 0.0f)));
+  SceneSnapshot::write(original, SNAPSHOT);
+  std::string error;
+  if (!SceneSnapshot::isSnapshot(SNAPSHOT))
+    error = "the snapshot is not recognized as one";
+
+  ScenegraphImporter snapshotImporter;
+  IScenegraph *loaded = snapshotImporter.parseSnapshot(SNAPSHOT);
+  SceneSnapshot::write(loaded, RESAVED);
+  if (error.empty() && SceneDump::dump(original) != SceneDump::dump(loaded))
+    error = "the loaded scene differs from the text scene";
+  if (error.empty() && readFile(SNAPSHOT) != readFile(RESAVED))
+    error = "saving the loaded scene gives a different file";
+  delete original;
+  delete loaded;
+  return error;
+}
+
+/**
+ * @brief Report the best times to load a scene from text and from its
+ * snapshot.
+ */
+static void benchmark(const std::string &name, const std::string &text) {
+  {
+    ScenegraphImporter importer;
+    std::istringstream in(text);
+    IScenegraph *scenegraph = importer.parse(in);
+    SceneSnapshot::write(scenegraph, SNAPSHOT);
+    delete scenegraph;
+  }
+  double textTime = 1e30, snapshotTime = 1e30;
+  for (int i = 0; i < RUNS; i++) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    {
+      ScenegraphImporter importer;
+      std::istringstream in(text);
+      delete importer.parse(in);
+    }
+    textTime = std::min(textTime, milliseconds(start));
+    start = std::chrono::steady_clock::now();
+    {
+      ScenegraphImporter importer;
+      delete importer.parseSnapshot(SNAPSHOT);
+    }
+    snapshotTime = std::min(snapshotTime, milliseconds(start));
+  }
+  printf("%-54s %9.2f ms %9.2f ms %10zu %10zu\n", name.c_str(), textTime,
+         snapshotTime, text.size(), readFile(SNAPSHOT).size());
+}
+
+/**
+ * @brief Make a flat scene of boxes, each under its own translation.
+ */
+static std::string generatedScene(int boxes) {
+  std::ostringstream text;
+  text << "instance box models/box.obj\n"
+       << "material red\nambient 0.2 0 0\ndiffuse 0.8 0.1 0.1\n"
+       << "specular 0.5 0.5 0.5\nshininess 20\nend-material\n"
+       << "group root root\n";
+  for (int i = 0; i < boxes / 2; i++) {
+    text << "translate t" << i << " t" << i << " " << (i % 100) * 2 << " 0 "
+         << (i / 100) * 2 << "\n"
+         << "leaf l" << i << " l" << i << " instanceof box\n"
+         << "assign-material l" << i << " red\n"
+         << "add-child l" << i << " t" << i << "\n"
+         << "add-child t" << i << " root\n";
+  }
+  text << "assign-root root\n";
+  return text.str();
+}
+
+static std::vector<std::string> sceneFiles(const std::string &directory) {
+  std::vector<std::string> files;
+  DIR *dir = opendir(directory.c_str());
+  if (dir == NULL)
+    return files;
+  while (dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0)
+      files.push_back(directory + "/" + name);
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> files(argv + 1, argv + argc);
+  if (files.empty())
+    files = sceneFiles("scenegraphmodels");
+  if (files.empty()) {
+    fprintf(stderr, "No scenes given or found in scenegraphmodels/\n");
+    return EXIT_FAILURE;
+  }
+  std::vector<std::string> texts;
+  for (size_t f = 0; f < files.size(); f++)
+    texts.push_back(readFile(files[f]));
+
+  // The importers report the files they load; keep that out of the results
+  std::ostringstream log;
+  std::streambuf *cout = std::cout.rdbuf(log.rdbuf());
+
+  int failures = 0;
+  for (size_t f = 0; f < files.size(); f++) {
+    std::string error;
+    try {
+      error = roundTrip(texts[f]);
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+    if (!error.empty()) {
+      fprintf(stderr, "FAIL %s: %s\n", files[f].c_str(), error.c_str());
+      failures++;
+    }
+  }
+  printf("%d of %zu scenes round-trip through a snapshot\n\n",
+         static_cast<int>(files.size()) - failures, files.size());
+
+  printf("%-54s %12s %12s %10s %10s\n", "scene", "text", "snapshot",
+         "text bytes", "snap bytes");
+  for (size_t f = 0; f < files.size(); f++)
+    benchmark(files[f], texts[f]);
+  std::ostringstream name;
+  name << "generated, " << GENERATED_NODES + 1 << " nodes";
+  benchmark(name.str(), generatedScene(GENERATED_NODES));
+
+  std::cout.rdbuf(cout);
+  std::remove(SNAPSHOT);
+  std::remove(RESAVED);
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}